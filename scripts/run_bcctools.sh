@@ -14,8 +14,8 @@ usage()
     echo "SYNOPSIS" 1>&2
     echo "    ./$0 [OPTIONS] <FASTQ1> <FASTQ2>" 1>&2
     echo "" 1>&2
-    echo "    Script for correcting barcodes with bcctools, sorting the output by barcode" 1>&2
-    echo "    with Unix sort, and file conversion to (gzipped) FASTQ, SAM, or BAM." 1>&2
+    echo "    Script for correcting barcodes with bcctools, sorting the output by barcode," 1>&2
+    echo "    and file conversion to (gzipped) FASTQ, SAM, or BAM." 1>&2
     echo "" 1>&2
     echo "    -h" 1>&2
     echo "        Display this help message." 1>&2
@@ -30,16 +30,18 @@ usage()
     echo "    -a  NUM" 1>&2
     echo "        Maximum number of alternative barcode corrections." 1>&2
     echo "        In range [1..16]. Default: 4." 1>&2
+    echo "    -t  NUM" 1>&2
+    echo "        Number of threads for barcode correction and compression. Default: 1." 1>&2
     echo "" 1>&2
     echo "SORTING OPTIONS" 1>&2
     echo "    -n" 1>&2
     echo "        Do not sort output of bcctools by barcode." 1>&2
     echo "    -S  SIZE" 1>&2
-    echo "        Size for main memory buffer, e.g. '8G'. Value is passed to Unix sort" 1>&2
-    echo "        -S, --buffer-size option. Default: 4G" 1>&2
+    echo "        Size for main memory buffer, e.g. '8G'. Value is passed to bcctools" 1>&2
+    echo "        correct --max-memory option. Default: 4G" 1>&2
     echo "    -T  DIR" 1>&2
     echo "        Directory for tempoarary files, e.g. '/path/to/tmp/'. Value is passed to" 1>&2
-    echo "        Unix sort -T, --temporary-directory option." 1>&2
+    echo "        bcctools correct --tmp-dir option." 1>&2
     echo "" 1>&2
     echo "OUTPUT OPTIONS" 1>&2
     echo "    -o  STR" 1>&2
@@ -47,50 +49,14 @@ usage()
     echo "    -f  STR" 1>&2
     echo "        Ouptut format. One of: fastq, fastq.gz, sam, bam, tsv" 1>&2
     echo "    -s  STR" 1>&2
-    echo "        Path to samtools program for BAM conversion, e.g. '/path/to/samtools'." 1>&2
-    echo "        Necessary only if output format is 'bam'. Default: samtools" 1>&2
+    echo "        Path to samtools program. Ignored, BAM output is written by bcctools." 1>&2
+    echo "        Default: samtools" 1>&2
     echo "" 1>&2
     echo "INFO" 1>&2
     echo "    Created on Aug 31, 2018" 1>&2
     exit 1
 }
 
-################################################################################
-# FASTQ conversion with compression
-
-convert_and_compress_first()
-{
-    awk '{print "@" $1 " BX:Z:" $2 " RX:Z:" $3 " QX:Z:" $7 " TR:Z:" $4 " TQ:Z:" $8 "\n" $5 "\n+\n" $9}' \
-    | gzip -c \
-    > ${outprefix}.1.fastq.gz
-}
-export -f convert_and_compress_first
-
-convert_and_compress_second()
-{
-    awk '{print "@" $1 "\n" $6 "\n+\n" $10}' \
-    | gzip -c \
-    > ${outprefix}.2.fastq.gz
-}
-export -f convert_and_compress_second
-
-################################################################################
-# FASTQ conversion without compression
-
-convert_first()
-{
-    awk '{print "@" $1 " BX:Z:" $2 " RX:Z:" $3 " QX:Z:" $7 " TR:Z:" $4 " TQ:Z:" $8 "\n" $5 "\n+\n" $9}' \
-    > ${outprefix}.1.fastq
-}
-export -f convert_first
-
-convert_second()
-{
-    awk '{print "@" $1 "\n" $6 "\n+\n" $10}' \
-    > ${outprefix}.2.fastq
-}
-export -f convert_second
-
 ################################################################################
 # SAM conversion
 
@@ -116,6 +82,7 @@ bcctools="bcctools"
 whitelist="-"
 cutoff="inferred"
 alts=4
+threads=1
 sort="on"
 buffersize=4G
 tempdir="-"
@@ -123,7 +90,7 @@ outprefix="-"
 format="fastq.gz"
 samtools="samtools"
 
-while getopts 'hb:w:c:a:nS:T:o:f:s:' OPTION; do
+while getopts 'hb:w:c:a:t:nS:T:o:f:s:' OPTION; do
     case "${OPTION}" in
         b)
             bcctools="${OPTARG}"
@@ -137,6 +104,9 @@ while getopts 'hb:w:c:a:nS:T:o:f:s:' OPTION; do
         a)
             alts="${OPTARG}"
             ;;
+        t)
+            threads="${OPTARG}"
+            ;;
         n)
             sort="off"
             ;;
@@ -184,11 +154,14 @@ fi
 
 # Set the sorting options.
 sortopt=""
-if [ "${buffersize}" != '-' ]; then
-    sortopt="${sortopt} --buffer-size=${buffersize}"
-fi
-if [ "${tempdir}" != '-' ]; then
-    sortopt="${sortopt} --temporary-directory=${tempdir}"
+if [ "${sort}" = "on" ]; then
+    sortopt="--sort"
+    if [ "${buffersize}" != '-' ]; then
+        sortopt="${sortopt} --max-memory ${buffersize}"
+    fi
+    if [ "${tempdir}" != '-' ]; then
+        sortopt="${sortopt} --tmp-dir ${tempdir}"
+    fi
 fi
 
 echo "Barcode correction, sorting, file conversion" 1>&2
@@ -203,6 +176,7 @@ echo "    Path to bcctools program:      $bcctools" 1>&2
 echo "    Whitelist file:                $whitelist" 1>&2
 echo "    Whitelist cutoff:              $cutoff" 1>&2
 echo "    Max. num. of alt. corrections: $alts" 1>&2
+echo "    Number of threads:             $threads" 1>&2
 echo "    Sorting:                       $sort" 1>&2
 echo "    Sorting buffer size:           $buffersize" 1>&2
 echo "    Sorting tmp directory:         $tempdir" 1>&2
@@ -226,84 +200,15 @@ fi
 echo "" 1>&2
 
 # Run barcode correction, sorting and file conversion as specified.
-if [ ${sort} = "on" ]; then
-    case "${format}" in
-        "fastq.gz")
-            ${bcctools} correct -a ${alts} ${whitelist} ${FASTQ1} ${FASTQ2} \
-            | sort -k2,2 ${sortopt} \
-            | tee >(convert_and_compress_first) \
-            | convert_and_compress_second
-            echo "" 1>&2
-            echo "Output written to '${outprefix}.1.fastq.gz' and '${outprefix}.2.fastq.gz'." 1>&2
-            ;;
-        "fastq")
-            ${bcctools} correct -a ${alts} ${whitelist} ${FASTQ1} ${FASTQ2} \
-            | sort -k2,2 ${sortopt} \
-            | tee >(convert_first) \
-            | convert_second
-            echo "" 1>&2
-            echo "Output written to '${outprefix}.1.fastq' and '${outprefix}.2.fastq'." 1>&2
-            ;;
-        "sam")
-            ${bcctools} correct -a ${alts} ${whitelist} ${FASTQ1} ${FASTQ2} \
-            | sort -k2,2 ${sortopt} \
-            | convert_sam \
-            > ${outprefix}.sam
-            echo "" 1>&2
-            echo "Output written to '${outprefix}.sam'." 1>&2
-            ;;
-        "bam")
-            ${bcctools} correct -a ${alts} ${whitelist} ${FASTQ1} ${FASTQ2} \
-            | sort -k2,2 ${sortopt} \
-            | convert_sam \
-            | ${samtools} view -Sb \
-            > ${outprefix}.bam
-            echo "" 1>&2
-            echo "Output written to '${outprefix}.bam'." 1>&2
-            ;;
-        "tsv")
-            ${bcctools} correct -a ${alts} ${whitelist} ${FASTQ1} ${FASTQ2} \
-            | sort -k2,2 ${sortopt} \
-            > ${outprefix}.tsv
-            echo "" 1>&2
-            echo "Output written to '${outprefix}.tsv'." 1>&2
-    esac
-else
-    case "${format}" in
-        "fastq.gz")
-            ${bcctools} correct -a ${alts} ${whitelist} ${FASTQ1} ${FASTQ2} \
-            | tee >(convert_and_compress_first) \
-            | convert_and_compress_second
-            echo "" 1>&2
-            echo "Output written to '${outprefix}.1.fastq.gz' and '${outprefix}.2.fastq.gz'." 1>&2
-            ;;
-        "fastq")
-            ${bcctools} correct -a ${alts} ${whitelist} ${FASTQ1} ${FASTQ2} \
-            | tee >(convert_first) \
-            | convert_second
-            echo "" 1>&2
-            echo "Output written to '${outprefix}.1.fastq' and '${outprefix}.2.fastq'." 1>&2
-            ;;
-        "sam")
-            ${bcctools} correct -a ${alts} ${whitelist} ${FASTQ1} ${FASTQ2} \
-            | convert_sam \
-            > ${outprefix}.sam
-            echo "" 1>&2
-            echo "Output written to '${outprefix}.sam'." 1>&2
-            ;;
-        "bam")
-            ${bcctools} correct -a ${alts} ${whitelist} ${FASTQ1} ${FASTQ2} \
-            | convert_sam \
-            | samtools view -Sb \
-            > ${outprefix}.bam
-            echo "" 1>&2
-            echo "Output written to '${outprefix}.bam'." 1>&2
-            ;;
-        "tsv")
-            ${bcctools} correct -a ${alts} ${whitelist} ${FASTQ1} ${FASTQ2} \
-            > ${outprefix}.tsv
-            echo "" 1>&2
-            echo "Output written to '${outprefix}.tsv'." 1>&2
-    esac
-fi
-
+case "${format}" in
+    "sam")
+        ${bcctools} correct -a ${alts} -t ${threads} ${sortopt} ${whitelist} ${FASTQ1} ${FASTQ2} \
+        | convert_sam \
+        > ${outprefix}.sam
+        echo "" 1>&2
+        echo "Output written to '${outprefix}.sam'." 1>&2
+        ;;
+    *)
+        ${bcctools} correct -a ${alts} -t ${threads} ${sortopt} -f ${format} -o ${outprefix} ${whitelist} ${FASTQ1} ${FASTQ2}
+        ;;
+esac
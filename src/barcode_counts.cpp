@@ -0,0 +1,312 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <queue>
+#include <unistd.h>
+#include <seqan/stream.h>
+
+#include "barcode_counts.h"
+#include "barcode_sort.h"
+#include "output_buffer.h"
+#include "utils.h"
+
+using namespace seqan;
+
+// Initial number of slots of the hash table.
+const uint64_t MIN_COUNT_SLOTS = (uint64_t)1 << 16;
+
+BarcodeCounter::BarcodeCounter(unsigned bcLength, size_t maxMemory, std::string const & tmpDir) :
+    bcLength(bcLength), maxMemory(maxMemory), tmpDir(tmpDir), table(MIN_COUNT_SLOTS, BarcodeCountEntry{0, 0}),
+    numEntries(0), shift(48), numSorted(0)
+{}
+
+BarcodeCounter::~BarcodeCounter()
+{
+    for (CountRun & run : runs)
+        close(run.fd);
+}
+
+// ---------------------------------------------------------------------------------------
+// Counting
+// ---------------------------------------------------------------------------------------
+
+// Moves the entries of the table to its front and sorts them by code.
+void sort_entries(BarcodeCounter & counter)
+{
+    uint64_t n = 0;
+    for (BarcodeCountEntry const & entry : counter.table)
+        if (entry.count != 0)
+            counter.table[n++] = entry;
+    std::sort(counter.table.begin(), counter.table.begin() + n, [](BarcodeCountEntry const & a, BarcodeCountEntry const & b) {
+        return a.code < b.code;
+    });
+    counter.numSorted = n;
+}
+
+void write_count_run(BarcodeCounter & counter)
+{
+    sort_entries(counter);
+
+    CountRun run;
+    run.fd = open_tmp_file(counter.tmpDir);
+    run.offset = 0;
+    run.numRecords = counter.numSorted;
+    counter.runs.push_back(run);
+
+    OutputBuffer out(run.fd);
+    for (uint64_t i = 0; i < counter.numSorted; ++i)
+    {
+        out.append(reinterpret_cast<char const *>(&counter.table[i].code), sizeof(uint64_t));
+        out.append(reinterpret_cast<char const *>(&counter.table[i].count), sizeof(uint32_t));
+    }
+    out.flush();
+
+    std::fill(counter.table.begin(), counter.table.end(), BarcodeCountEntry{0, 0});
+    counter.numEntries = 0;
+    counter.numSorted = 0;
+}
+
+// Doubles the hash table or, if the old and the new table together exceed the memory budget,
+// writes its entries to a sorted run.
+void grow_or_spill(BarcodeCounter & counter)
+{
+    uint64_t numSlots = counter.table.size();
+    if (3 * numSlots * sizeof(BarcodeCountEntry) > counter.maxMemory || counter.shift == 0)
+    {
+        write_count_run(counter);
+        return;
+    }
+
+    std::vector<BarcodeCountEntry> table(2 * numSlots, BarcodeCountEntry{0, 0});
+    table.swap(counter.table);
+    --counter.shift;
+    uint64_t mask = counter.table.size() - 1;
+    for (BarcodeCountEntry const & entry : table)
+    {
+        if (entry.count == 0)
+            continue;
+        uint64_t slot = count_slot(counter, entry.code);
+        while (counter.table[slot].count != 0)
+            slot = (slot + 1) & mask;
+        counter.table[slot] = entry;
+    }
+}
+
+// Prepares iterating the counts. Entries stay in the table if no run has been written.
+void finish_counts(BarcodeCounter & counter)
+{
+    if (counter.runs.empty())
+    {
+        sort_entries(counter);
+        return;
+    }
+
+    if (counter.numEntries != 0)
+        write_count_run(counter);
+    std::vector<BarcodeCountEntry>().swap(counter.table);
+}
+
+// Continues counting after finish_counts(), e.g. after the counts of a sample were iterated.
+void resume_counts(BarcodeCounter & counter)
+{
+    std::vector<BarcodeCountEntry> entries;
+    if (counter.runs.empty())
+        entries.assign(counter.table.begin(), counter.table.begin() + counter.numSorted);
+    uint64_t numSlots = std::max<uint64_t>(counter.table.size(), MIN_COUNT_SLOTS);
+    counter.table.assign(numSlots, BarcodeCountEntry{0, 0});
+    counter.shift = 64;
+    for (uint64_t n = numSlots; n > 1; n /= 2)
+        --counter.shift;
+    counter.numEntries = 0;
+    counter.numSorted = 0;
+    for (BarcodeCountEntry const & entry : entries)
+        add_barcode(counter, entry.code, entry.count);
+}
+
+// ---------------------------------------------------------------------------------------
+// Partitions
+// ---------------------------------------------------------------------------------------
+
+// Returns the number of partitions for iterating the counts with numThreads threads, a power
+// of two with several partitions per thread for load balance.
+unsigned count_partitions(unsigned bcLength, unsigned numThreads)
+{
+    unsigned numParts = 1;
+    while (numParts < 8 * numThreads && numThreads > 1 && (uint64_t)numParts < ((uint64_t)1 << std::min(2 * bcLength, 32u)))
+        numParts *= 2;
+    return numParts;
+}
+
+// Returns the first and the last code of a partition, a range of codes with a common prefix.
+void partition_codes(uint64_t & first, uint64_t & last, unsigned bcLength, unsigned part, unsigned numParts)
+{
+    unsigned bits = 0;
+    while (((unsigned)1 << bits) < numParts)
+        ++bits;
+    unsigned shift = 2 * bcLength - bits;
+    first = shift == 64 ? 0 : (uint64_t)part << shift;
+    last = first + (shift == 64 ? ~(uint64_t)0 : ((uint64_t)1 << shift) - 1);
+}
+
+// ---------------------------------------------------------------------------------------
+// Merging
+// ---------------------------------------------------------------------------------------
+
+// Sorted (code, count) records of one shard within a partition, either entries of its table
+// or records of a run that are read in chunks with pread().
+struct CountSource
+{
+    BarcodeCountEntry const * entries;
+    int fd;
+    uint64_t offset;
+    uint64_t next;
+    uint64_t end;
+    std::vector<char> buffer;
+    size_t begin;
+    size_t size;
+};
+
+void read_records(int fd, uint64_t offset, char * data, uint64_t first, uint64_t n)
+{
+    offset += first * COUNT_RECORD_SIZE;
+    size_t done = 0;
+    while (done < n * COUNT_RECORD_SIZE)
+    {
+        ssize_t bytes = pread(fd, data + done, n * COUNT_RECORD_SIZE - done, offset + done);
+        if (bytes < 0 && errno == EINTR)
+            continue;
+        if (bytes <= 0)
+            SEQAN_THROW(IOError("Reading sorted barcode counts failed."));
+        done += bytes;
+    }
+}
+
+inline uint64_t run_code(CountRun const & run, uint64_t i)
+{
+    char data[COUNT_RECORD_SIZE];
+    read_records(run.fd, run.offset, data, i, 1);
+    uint64_t code;
+    std::memcpy(&code, data, sizeof(code));
+    return code;
+}
+
+// Returns the first record of a run with a code not less than 'code'.
+uint64_t run_lower_bound(CountRun const & run, uint64_t code)
+{
+    uint64_t lo = 0;
+    uint64_t hi = run.numRecords;
+    while (lo < hi)
+    {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (run_code(run, mid) < code)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// Makes sure that the source has a current record. Returns false at its end.
+bool fill_source(CountSource & source)
+{
+    if (source.entries != NULL)
+        return source.next < source.end;
+    if (source.begin < source.size)
+        return true;
+    if (source.next == source.end)
+        return false;
+
+    uint64_t n = std::min<uint64_t>(source.end - source.next, source.buffer.size() / COUNT_RECORD_SIZE);
+    read_records(source.fd, source.offset, &source.buffer[0], source.next, n);
+    source.next += n;
+    source.begin = 0;
+    source.size = n * COUNT_RECORD_SIZE;
+    return true;
+}
+
+inline uint64_t source_code(CountSource const & source)
+{
+    if (source.entries != NULL)
+        return source.entries[source.next].code;
+    uint64_t code;
+    std::memcpy(&code, &source.buffer[source.begin], sizeof(code));
+    return code;
+}
+
+// Returns the count of the current record and moves to the next one.
+inline uint32_t pop_count(CountSource & source)
+{
+    if (source.entries != NULL)
+        return source.entries[source.next++].count;
+    uint32_t count;
+    std::memcpy(&count, &source.buffer[source.begin + sizeof(uint64_t)], sizeof(count));
+    source.begin += COUNT_RECORD_SIZE;
+    return count;
+}
+
+// Calls f(code, count) for the barcodes of a partition in lexicographical order, summing the
+// counts of all shards. Returns the number of distinct barcodes of the partition. Different
+// partitions can be iterated by different threads at the same time, and partitions can be
+// iterated repeatedly after finish_counts() of all shards.
+uint64_t for_each_barcode_count(std::vector<std::unique_ptr<BarcodeCounter> > const & shards, unsigned part, unsigned numParts,
+                                std::function<void(uint64_t, uint32_t)> const & f)
+{
+    uint64_t first, last;
+    partition_codes(first, last, shards[0]->bcLength, part, numParts);
+
+    // Share the memory budget of a shard among the read buffers of all runs.
+    size_t numRuns = 0;
+    for (auto const & shard : shards)
+        numRuns += shard->runs.size();
+    size_t bufferSize = std::min(std::max(shards[0]->maxMemory / std::max(numRuns, (size_t)1), (size_t)1 << 16), (size_t)1 << 24);
+    bufferSize -= bufferSize % COUNT_RECORD_SIZE;
+
+    auto lessCode = [](BarcodeCountEntry const & entry, uint64_t code) { return entry.code < code; };
+    std::vector<CountSource> sources;
+    for (auto const & shard : shards)
+    {
+        if (shard->numSorted != 0)
+        {
+            BarcodeCountEntry const * begin = &shard->table[0];
+            BarcodeCountEntry const * end = begin + shard->numSorted;
+            CountSource source{begin, -1, 0, 0, 0, std::vector<char>(), 0, 0};
+            source.next = std::lower_bound(begin, end, first, lessCode) - begin;
+            source.end = last == ~(uint64_t)0 ? shard->numSorted : std::lower_bound(begin, end, last + 1, lessCode) - begin;
+            sources.push_back(std::move(source));
+        }
+        for (CountRun const & run : shard->runs)
+        {
+            CountSource source{NULL, run.fd, run.offset, 0, 0, std::vector<char>(), 0, 0};
+            source.next = run_lower_bound(run, first);
+            source.end = last == ~(uint64_t)0 ? run.numRecords : run_lower_bound(run, last + 1);
+            source.buffer.resize(bufferSize);
+            sources.push_back(std::move(source));
+        }
+    }
+
+    // K-way merge of the sources that sums the counts of each barcode.
+    std::priority_queue<std::pair<uint64_t, unsigned>,
+                        std::vector<std::pair<uint64_t, unsigned> >,
+                        std::greater<std::pair<uint64_t, unsigned> > > heap;
+    for (unsigned i = 0; i < sources.size(); ++i)
+        if (fill_source(sources[i]))
+            heap.push(std::make_pair(source_code(sources[i]), i));
+
+    uint64_t numDistinct = 0;
+    while (!heap.empty())
+    {
+        uint64_t code = heap.top().first;
+        uint64_t count = 0;
+        while (!heap.empty() && heap.top().first == code)
+        {
+            unsigned i = heap.top().second;
+            heap.pop();
+            count += pop_count(sources[i]);
+            if (fill_source(sources[i]))
+                heap.push(std::make_pair(source_code(sources[i]), i));
+        }
+        f(code, std::min<uint64_t>(count, MAX_BARCODE_COUNT));
+        ++numDistinct;
+    }
+    return numDistinct;
+}
@@ -0,0 +1,106 @@
+#ifndef BARCODE_COUNTS_H_
+#define BARCODE_COUNTS_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+// Sparse counting of barcodes
+// -----------------------------------------------------------------------------
+
+// Counts the occurrences of barcodes of up to 32 bases without N. Instead of an array over all
+// 4^bcLength codes, counts are kept in an open-addressing hash table with linear probing that
+// grows with the number of distinct barcodes. When the table cannot grow within the memory
+// budget, its barcodes are sorted and written with their counts as a sorted run to an
+// unlinked temporary file, and counting continues with an empty table.
+//
+// Each counting thread owns a counter (a shard). The counts of all shards are merged when
+// they are iterated, one range of codes (a partition) at a time, so that threads can iterate
+// different partitions in parallel. Counts are reported in lexicographical order of the
+// barcodes and saturate at 65535 like the counts of the former dense array.
+
+// Largest reported count.
+const uint32_t MAX_BARCODE_COUNT = 65535;
+
+struct BarcodeCountEntry
+{
+    uint64_t code;
+    uint32_t count;     // 0 marks an empty slot.
+};
+
+// File of (code, count) records sorted by code that start at 'offset', either a temporary file
+// or a count table (see count_table.h).
+struct CountRun
+{
+    int fd;
+    uint64_t offset;
+    uint64_t numRecords;
+};
+
+// Size of a (code, count) record of a sorted run.
+const size_t COUNT_RECORD_SIZE = sizeof(uint64_t) + sizeof(uint32_t);
+
+struct BarcodeCounter
+{
+    unsigned bcLength;
+    size_t maxMemory;
+    std::string tmpDir;
+
+    std::vector<BarcodeCountEntry> table;
+    uint64_t numEntries;
+    unsigned shift;     // 64 - log2 of the number of slots.
+
+    // Sorted runs and the number of entries in the table after finish_counts() sorted them
+    // to its front.
+    std::vector<CountRun> runs;
+    uint64_t numSorted;
+
+    BarcodeCounter(unsigned bcLength, size_t maxMemory, std::string const & tmpDir);
+    ~BarcodeCounter();
+};
+
+inline uint64_t count_slot(BarcodeCounter const & counter, uint64_t code)
+{
+    return (code * 0x9E3779B97F4A7C15ULL) >> counter.shift;
+}
+
+void grow_or_spill(BarcodeCounter & counter);
+
+// Adds occurrences of a barcode.
+inline void add_barcode(BarcodeCounter & counter, uint64_t code, uint32_t n = 1)
+{
+    uint64_t mask = counter.table.size() - 1;
+    uint64_t slot = count_slot(counter, code);
+    while (true)
+    {
+        BarcodeCountEntry & entry = counter.table[slot];
+        if (entry.count == 0)
+        {
+            entry.code = code;
+            entry.count = n;
+            if (++counter.numEntries * 4 > counter.table.size() * 3)
+                grow_or_spill(counter);
+            return;
+        }
+        if (entry.code == code)
+        {
+            entry.count = std::min<uint64_t>((uint64_t)entry.count + n, MAX_BARCODE_COUNT);
+            return;
+        }
+        slot = (slot + 1) & mask;
+    }
+}
+
+void finish_counts(BarcodeCounter & counter);
+void resume_counts(BarcodeCounter & counter);
+
+unsigned count_partitions(unsigned bcLength, unsigned numThreads);
+void partition_codes(uint64_t & first, uint64_t & last, unsigned bcLength, unsigned part, unsigned numParts);
+uint64_t for_each_barcode_count(std::vector<std::unique_ptr<BarcodeCounter> > const & shards, unsigned part, unsigned numParts,
+                                std::function<void(uint64_t, uint32_t)> const & f);
+
+#endif  // BARCODE_COUNTS_H_
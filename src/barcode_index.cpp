@@ -1,17 +1,40 @@
+#include <sys/mman.h>
 #include <sdsl/bit_vectors.hpp>
 #include <seqan/stream.h>
 #include <seqan/sequence.h>
 
 #include "barcode_index.h"
+#include "pipeline.h"
 #include "utils.h"
 
 using namespace seqan;
 
-inline BarcodeStatus get_status(BarcodeIndex & sbi, uint64_t h)
+// Lookups of the dense index are templated on the representation of the barcode table. Calls
+// f with the barcode table selected by select_barcode_table().
+template <typename TFunction>
+inline auto with_barcode_table(BarcodeIndex & sbi, TFunction f)
 {
-    if (sbi.barcode_table[h])
+    switch (sbi.tableType)
     {
-        if (sbi.match_table[sbi.rank_support_barcode_table(h)])
+        case BarcodeTableType::SD:
+            return f(*sbi.sd_table);
+        case BarcodeTableType::RRR:
+            return f(*sbi.rrr_table);
+        case BarcodeTableType::HYB:
+            return f(*sbi.hyb_table);
+        case BarcodeTableType::INTERLEAVED:
+            return f(*sbi.il_table);
+        default:
+            return f(PlainBarcodeTable(sbi.barcode_table, sbi.rank_support_barcode_table));
+    }
+}
+
+template <typename TTable>
+inline BarcodeStatus get_status(BarcodeIndex & sbi, TTable const & table, uint64_t h)
+{
+    if (table.is_set(h))
+    {
+        if (sbi.match_table[table.rank(h)])
             return BarcodeStatus::ONE_ERROR;
         else
             return BarcodeStatus::MATCH;
@@ -22,18 +45,31 @@ inline BarcodeStatus get_status(BarcodeIndex & sbi, uint64_t h)
     }
 }
 
+inline BarcodeStatus get_status(BarcodeIndex & /*sbi*/, InterleavedBarcodeTable const & table, uint64_t h)
+{
+    switch (table.status(h))
+    {
+        case 1:
+            return BarcodeStatus::MATCH;
+        case 2:
+            return BarcodeStatus::ONE_ERROR;
+        default:
+            return BarcodeStatus::UNRECOGNIZED;
+    }
+}
+
 inline BarcodeStatus get_status_uncondensed(BarcodeIndex & sbi, uint64_t h)
 {
-    if (sbi.barcode_table[h])
+    if (sbi.barcode_bits[h])
     {
-        if (sbi.match_table[h])
+        if (sbi.match_bits[h])
             return BarcodeStatus::ONE_ERROR;
         else
             return BarcodeStatus::MATCH;
     }
     else
     {
-        if (sbi.match_table[h])
+        if (sbi.match_bits[h])
             return BarcodeStatus::INVALID;
         else
             return BarcodeStatus::UNRECOGNIZED;
@@ -42,8 +78,8 @@ inline BarcodeStatus get_status_uncondensed(BarcodeIndex & sbi, uint64_t h)
 
 inline void set_match(BarcodeIndex & sbi, uint64_t h)
 {
-    sbi.barcode_table[h] = 1;
-    sbi.match_table[h] = 0;
+    sbi.barcode_bits[h] = 1;
+    sbi.match_bits[h] = 0;
 }
 
 inline void set_one_error(BarcodeIndex & sbi, uint64_t h, sdsl::int_vector<> & helper_table)
@@ -52,8 +88,8 @@ inline void set_one_error(BarcodeIndex & sbi, uint64_t h, sdsl::int_vector<> & h
     if (current == BarcodeStatus::UNRECOGNIZED && helper_table[h] != 1)
     {
         // Set to ONE_ERROR.
-        sbi.barcode_table[h] = 1;
-        sbi.match_table[h] = 1;
+        sbi.barcode_bits[h] = 1;
+        sbi.match_bits[h] = 1;
         helper_table[h] = 0;
     }
     else if (current == BarcodeStatus::ONE_ERROR && helper_table[h] != sbi.numAlts-1)
@@ -63,33 +99,59 @@ inline void set_one_error(BarcodeIndex & sbi, uint64_t h, sdsl::int_vector<> & h
     else if (current == BarcodeStatus::ONE_ERROR && helper_table[h] == sbi.numAlts-1)
     {
         // Set to INVALID.
-        sbi.barcode_table[h] = 0;
-        sbi.match_table[h] = 0;
+        sbi.barcode_bits[h] = 0;
+        sbi.match_bits[h] = 0;
         helper_table[h] = 1;
         // INVALID and helper_table[h] = 1 indicates that too many one_error corrections are possible.
     }
 }
 
-inline void add_similar_barcodes(BarcodeIndex & sbi, uint64_t h, sdsl::int_vector<> & helper_table)
+// Whether code h is in the range [begin, end) of codes.
+inline bool in_range(uint64_t h, uint64_t begin, uint64_t end)
+{
+    return h - begin < end - begin;
+}
+
+template <typename TLength>
+inline void add_similar_barcodes(BarcodeIndex & sbi, uint64_t h, sdsl::int_vector<> & helper_table, uint64_t begin, uint64_t end,
+                                 TLength bcLength)
 {
-    for (uint64_t i = 0; i < sbi.bcLength; ++i)
+    for (uint64_t i = 0; i < bcLength; ++i)
     {
         h ^= static_cast<uint64_t>(1) << 2*i;
-        set_one_error(sbi, h, helper_table);
+        if (in_range(h, begin, end))
+            set_one_error(sbi, h, helper_table);
 
         h ^= static_cast<uint64_t>(2) << 2*i;
-        set_one_error(sbi, h, helper_table);
+        if (in_range(h, begin, end))
+            set_one_error(sbi, h, helper_table);
 
         h ^= static_cast<uint64_t>(1) << 2*i;
-        set_one_error(sbi, h, helper_table);
+        if (in_range(h, begin, end))
+            set_one_error(sbi, h, helper_table);
 
         h ^= static_cast<uint64_t>(2) << 2*i;
     }
 }
 
-inline bool get_substitution(unsigned & i, BarcodeIndex & sbi, uint64_t h, unsigned offset)
+// Number of ONE_ERROR codes before code h, i.e. the position of its substitutions.
+template <typename TTable>
+inline uint64_t substitution_rank(BarcodeIndex & sbi, TTable const & table, uint64_t h)
 {
-    uint64_t index = (sbi.rank_support_match_table(sbi.rank_support_barcode_table(h)) << (sbi.numAltsBase)) + offset;
+    return sbi.rank_support_match_table(table.rank(h));
+}
+
+inline uint64_t substitution_rank(BarcodeIndex & /*sbi*/, InterleavedBarcodeTable const & table, uint64_t h)
+{
+    uint64_t rank, oneErrorRank;
+    table.ranks(rank, oneErrorRank, h);
+    return oneErrorRank;
+}
+
+template <typename TTable>
+inline bool get_substitution(unsigned & i, BarcodeIndex & sbi, TTable const & table, uint64_t h, unsigned offset)
+{
+    uint64_t index = (substitution_rank(sbi, table, h) << (sbi.numAltsBase)) + offset;
 
     if (offset > 0 && sbi.substitution_table[index] == sbi.substitution_table[index - 1])
         return false;
@@ -99,36 +161,86 @@ inline bool get_substitution(unsigned & i, BarcodeIndex & sbi, uint64_t h, unsig
 }
 
 
-inline bool set_substitution(BarcodeIndex & sbi, uint64_t h, uint64_t i, sdsl::int_vector<> & helper_subst_table)
+// Writes entries of an sdsl vector from several threads. Each thread owns a range of entries.
+// Writes to words shared with the ranges of other threads are deferred until flush() is called
+// after all threads finished.
+template <typename TVector>
+struct SharedRangeWriter
+{
+    TVector & vector;
+    uint64_t firstBit;
+    uint64_t lastBit;
+    std::vector<std::pair<uint64_t, uint64_t> > deferred;
+
+    SharedRangeWriter(TVector & vector, uint64_t begin, uint64_t end) :
+        vector(vector), firstBit((begin * vector.width() + 63) / 64 * 64), lastBit(end * vector.width() / 64 * 64) {}
+
+    inline void set(uint64_t i, uint64_t value)
+    {
+        uint64_t bit = i * vector.width();
+        if (bit >= firstBit && bit + vector.width() <= lastBit)
+            vector[i] = value;
+        else
+            deferred.push_back(std::make_pair(i, value));
+    }
+
+    void flush()
+    {
+        for (auto const & d : deferred)
+            vector[d.first] = d.second;
+        deferred.clear();
+    }
+};
+
+// Adds substitution entry i of ONE_ERROR code h. The helper table counts the entries of the
+// ONE_ERROR codes from firstPos on.
+inline bool set_substitution(BarcodeIndex & sbi, uint64_t h, uint64_t i, sdsl::int_vector<> & helper_subst_table,
+                             uint64_t firstPos, SharedRangeWriter<sdsl::int_vector<> > & writer)
 {
-    if (get_status(sbi, h) != BarcodeStatus::ONE_ERROR)
+    PlainBarcodeTable table(sbi.barcode_table, sbi.rank_support_barcode_table);
+    if (get_status(sbi, table, h) != BarcodeStatus::ONE_ERROR)
         return 1;
 
-    uint64_t pos = sbi.rank_support_match_table(sbi.rank_support_barcode_table(h));
-    unsigned offset = helper_subst_table[pos];
+    uint64_t pos = sbi.rank_support_match_table(table.rank(h));
+    unsigned offset = helper_subst_table[pos - firstPos];
     uint64_t index = (pos << (sbi.numAltsBase)) + offset;
 
-    sbi.substitution_table[index] = i;
-    ++helper_subst_table[pos];
+    writer.set(index, i);
+    ++helper_subst_table[pos - firstPos];
     if (offset < sbi.numAlts - 1)
     {
-        sbi.substitution_table[index+1] = i;
+        writer.set(index+1, i);
     }
     return 0;
 }
 
-inline uint64_t get_corrected_barcode(BarcodeIndex & sbi, uint64_t h, unsigned i)
+// Position of the substituted base of a substitution entry.
+inline unsigned substitution_position(BarcodeIndex const & sbi, unsigned entry)
+{
+    return sbi.substitutionBases ? entry >> 2 : entry;
+}
+
+// Returns the whitelisted barcode of substitution entry i. Entries with the base of the
+// whitelisted barcode are resolved without lookups, otherwise all bases are probed.
+template <typename TTable>
+inline uint64_t get_corrected_barcode(BarcodeIndex & sbi, TTable const & table, uint64_t h, unsigned i)
 {
+    if (sbi.substitutionBases)
+    {
+        unsigned shift = 2 * (i >> 2);
+        return (h & ~(static_cast<uint64_t>(3) << shift)) | (static_cast<uint64_t>(i & 3) << shift);
+    }
+
     h ^= static_cast<uint64_t>(1) << 2*i;
-    if (get_status(sbi, h) == BarcodeStatus::MATCH)
+    if (get_status(sbi, table, h) == BarcodeStatus::MATCH)
         return h;
 
     h ^= static_cast<uint64_t>(2) << 2*i;
-    if (get_status(sbi, h) == BarcodeStatus::MATCH)
+    if (get_status(sbi, table, h) == BarcodeStatus::MATCH)
         return h;
 
     h ^= static_cast<uint64_t>(1) << 2*i;
-    if (get_status(sbi, h) == BarcodeStatus::MATCH)
+    if (get_status(sbi, table, h) == BarcodeStatus::MATCH)
         return h;
 
     h ^= static_cast<uint64_t>(2) << 2*i;
@@ -147,94 +259,445 @@ BarcodeIndex::BarcodeIndex(CharString & filename)
         SEQAN_THROW(ParseError(what.str()));
     }
     bcLength = barcode.size();
+    if (bcLength > MAX_SPARSE_BARCODE_LENGTH)
+    {
+        std::stringstream what;
+        what << "Barcodes longer than " << MAX_SPARSE_BARCODE_LENGTH << " bases are not supported.";
+        SEQAN_THROW(ParseError(what.str()));
+    }
+    engine = IndexEngine::DENSE;
+    substitutionBases = false;
+    tableType = BarcodeTableType::PLAIN;
+    mapping = NULL;
+    mappingSize = 0;
 }
 
-void condenseMatchTable(BarcodeIndex & sbi)
+InterleavedBarcodeTable::InterleavedBarcodeTable(BitTable const & barcodes, BitTable const & matches)
 {
-    printStatus("Condensing match table");
-    uint64_t m = 0;
-    for (uint64_t b = 0; b < sbi.barcode_table.size(); ++b)
+    uint64_t size = barcodes.size();
+    uint64_t numLines = size / CODES_PER_LINE + 1;
+
+    // Align the lines to cache lines.
+    storage.assign(numLines * 8 + 7, 0);
+    lines = storage.data() + (64 - reinterpret_cast<uintptr_t>(storage.data()) % 64) % 64 / sizeof(uint64_t);
+
+    // Set the statuses of all codes in the barcode table. The match table holds one bit per code
+    // in the barcode table.
+    uint64_t rank = 0;
+    for (uint64_t w = 0; w < (size + 63) / 64; ++w)
+    {
+        for (uint64_t x = barcodes.data()[w]; x != 0; x &= x - 1)
+        {
+            uint64_t h = w * 64 + __builtin_ctzll(x);
+            if (h >= size)
+                break;
+            uint64_t status = matches[rank] ? 2 : 1;
+            ++rank;
+            uint64_t b = h / CODES_PER_LINE;
+            uint64_t j = h - b * CODES_PER_LINE;
+            lines[b * 8 + 1 + (j >> 5)] |= status << (2 * (j & 31));
+        }
+    }
+
+    // Count the codes before each line and superblock.
+    superblocks.assign(2 * ((numLines >> LINES_PER_SUPERBLOCK_LOG) + 1), 0);
+    uint64_t numSet = 0;
+    uint64_t numOneError = 0;
+    for (uint64_t b = 0; b < numLines; ++b)
     {
-        if (sbi.barcode_table[b] == 1)
+        uint64_t * sb = &superblocks[2 * (b >> LINES_PER_SUPERBLOCK_LOG)];
+        if ((b & ((static_cast<uint64_t>(1) << LINES_PER_SUPERBLOCK_LOG) - 1)) == 0)
         {
-            sbi.match_table[m] = sbi.match_table[b];
-            ++m;
+            sb[0] = numSet;
+            sb[1] = numOneError;
+        }
+        uint64_t * l = lines + b * 8;
+        l[0] = (numSet - sb[0]) | ((numOneError - sb[1]) << 32);
+        for (unsigned w = 1; w < 8; ++w)
+        {
+            numSet += sdsl::bits::cnt((l[w] | (l[w] >> 1)) & 0x5555555555555555ULL);
+            numOneError += sdsl::bits::cnt(l[w] & 0xaaaaaaaaaaaaaaaaULL);
         }
     }
-    sbi.match_table.resize(m);
+}
+
+BarcodeIndex::~BarcodeIndex()
+{
+    if (mapping != NULL)
+        munmap(mapping, mappingSize);
+}
+
+// First of the codes 0..size-1 of thread t if they are split into ranges of whole words.
+inline uint64_t range_begin(uint64_t size, unsigned t, unsigned numThreads)
+{
+    uint64_t chunk = ((size + numThreads - 1) / numThreads + 63) / 64 * 64;
+    return std::min(size, t * chunk);
+}
+
+// Builds the rank support of a bit vector of the given size. The words must extend at least
+// one bit beyond the size, as in sdsl::bit_vector, to answer rank queries up to the size.
+void build_rank_table(std::vector<uint64_t> & blocks, uint64_t const * words, uint64_t size, unsigned numThreads)
+{
+    uint64_t numBlocks = (size >> 9) + 1;
+    uint64_t numWords = (size >> 6) + 1;
+    blocks.assign(2 * numBlocks, 0);
+
+    // Each thread counts the ones of a range of superblocks from the start of its range.
+    std::vector<uint64_t> counts(numThreads + 1, 0);
+    runParallel(numThreads, [&](unsigned t) {
+        uint64_t rank = 0;
+        for (uint64_t b = range_begin(numBlocks, t, numThreads); b < range_begin(numBlocks, t + 1, numThreads); ++b)
+        {
+            blocks[2 * b] = rank;
+            uint64_t relative = 0;
+            for (uint64_t j = 0; j < 8; ++j)
+            {
+                uint64_t w = 8 * b + j;
+                if (j > 0)
+                    blocks[2 * b + 1] |= relative << (63 - 9 * j);
+                if (w < numWords)
+                    relative += sdsl::bits::cnt(words[w]);
+            }
+            rank += relative;
+        }
+        counts[t + 1] = rank;
+    });
+
+    // Add the ones before the range of each thread.
+    for (unsigned t = 1; t <= numThreads; ++t)
+        counts[t] += counts[t - 1];
+    runParallel(numThreads, [&](unsigned t) {
+        for (uint64_t b = range_begin(numBlocks, t, numThreads); b < range_begin(numBlocks, t + 1, numThreads); ++b)
+            blocks[2 * b] += counts[t];
+    });
+}
+
+// Points the lookup tables to the storage of the index.
+void attach_bit_table(BitTable & table, RankTable & rank, sdsl::bit_vector const & bits, std::vector<uint64_t> & blocks,
+                      unsigned numThreads = 1)
+{
+    build_rank_table(blocks, bits.data(), bits.size(), numThreads);
+    table.words = bits.data();
+    table.length = bits.size();
+    rank.blocks = &blocks[0];
+    rank.words = bits.data();
+}
+
+void attach_substitution_table(BarcodeIndex & sbi)
+{
+    PackedTable & table = sbi.substitution_table;
+    table.words = sbi.substitution_values.data();
+    table.length = sbi.substitution_values.size();
+    table.bits = sbi.substitution_values.width();
+    table.mask = table.bits == 64 ? ~static_cast<uint64_t>(0) : (static_cast<uint64_t>(1) << table.bits) - 1;
+}
+
+// The dense index is built by numThreads threads that each process the codes of a range of
+// whole words of the tables. Each thread walks the whole whitelist in order and skips codes
+// outside of its range, thus the tables are identical for any number of threads.
+
+void condenseMatchTable(BarcodeIndex & sbi, unsigned numThreads)
+{
+    printStatus("Condensing match table");
+    uint64_t size = sbi.barcode_bits.size();
+    uint64_t const * words = sbi.barcode_bits.data();
+
+    // Find the first bit of each range in the condensed match table.
+    std::vector<uint64_t> starts(numThreads + 1, 0);
+    runParallel(numThreads, [&](unsigned t) {
+        uint64_t count = 0;
+        for (uint64_t w = range_begin(size, t, numThreads) >> 6; w < (range_begin(size, t + 1, numThreads) + 63) >> 6; ++w)
+            count += sdsl::bits::cnt(words[w]);
+        starts[t + 1] = count;
+    });
+    for (unsigned t = 1; t <= numThreads; ++t)
+        starts[t] += starts[t - 1];
+
+    sdsl::bit_vector condensed(starts[numThreads], 0u);
+    std::vector<SharedRangeWriter<sdsl::bit_vector> > writers;
+    for (unsigned t = 0; t < numThreads; ++t)
+        writers.emplace_back(condensed, starts[t], starts[t + 1]);
+    runParallel(numThreads, [&](unsigned t) {
+        uint64_t m = starts[t];
+        for (uint64_t w = range_begin(size, t, numThreads) >> 6; w < (range_begin(size, t + 1, numThreads) + 63) >> 6; ++w)
+        {
+            for (uint64_t x = words[w]; x != 0; x &= x - 1)
+            {
+                writers[t].set(m, sbi.match_bits[w * 64 + __builtin_ctzll(x)]);
+                ++m;
+            }
+        }
+    });
+    for (unsigned t = 0; t < numThreads; ++t)
+        writers[t].flush();
+
+    sbi.match_bits.swap(condensed);
     printDone();
 }
 
-void buildBarcodeAndMatchTable(BarcodeIndex & sbi, seqan::CharString & filename)
+void buildBarcodeAndMatchTable(BarcodeIndex & sbi, std::vector<uint64_t> const & whitelist, unsigned numThreads)
 {
     printStatus("Building barcode table and match table of barcode index");
 
     // Initialize the barcode table.
-    sbi.barcode_table = sdsl::bit_vector((uint64_t)1 << (2*sbi.bcLength), 0u);
-    sbi.match_table = sdsl::bit_vector((uint64_t)1 << (2*sbi.bcLength), 0u);
-    sdsl::int_vector<> helper_table((uint64_t)1 << (2*sbi.bcLength), 0u, sbi.numAlts);
+    uint64_t size = (uint64_t)1 << (2*sbi.bcLength);
+    sbi.barcode_bits = sdsl::bit_vector(size, 0u);
+    sbi.match_bits = sdsl::bit_vector(size, 0u);
+    sdsl::int_vector<> helper_table(size, 0u, sbi.numAlts);
 
     // Fill the barcode table.
-    std::ifstream infile(toCString(filename));
-    std::string barcode;
-    DnaString bc;
-    uint64_t h;
-    while (infile >> barcode)
-    {
-        bc = barcode;
-        h = hash(bc);
-        set_match(sbi, h);
-        add_similar_barcodes(sbi, h, helper_table);
-    }
+    runParallel(numThreads, [&](unsigned t) {
+        uint64_t begin = range_begin(size, t, numThreads);
+        uint64_t end = range_begin(size, t + 1, numThreads);
+        with_barcode_length(sbi.bcLength, sbi.specializedKernels, [&](auto bcLength) {
+            for (uint64_t h : whitelist)
+            {
+                if (in_range(h, begin, end))
+                    set_match(sbi, h);
+                add_similar_barcodes(sbi, h, helper_table, begin, end, bcLength);
+            }
+        });
+    });
     printDone();
 
-    condenseMatchTable(sbi);
+    condenseMatchTable(sbi, numThreads);
 }
 
-void buildSubstitutionTable(BarcodeIndex & sbi, seqan::CharString & filename)
+void buildSubstitutionTable(BarcodeIndex & sbi, std::vector<uint64_t> const & whitelist, unsigned numThreads)
 {
     printStatus("Building substitution table of barcode index");
 
     // Initialize the rank support tables.
-    sbi.rank_support_barcode_table = sdsl::rank_support_v<>(&sbi.barcode_table);
-    sbi.rank_support_match_table = sdsl::rank_support_v<>(&sbi.match_table);
+    attach_bit_table(sbi.barcode_table, sbi.rank_support_barcode_table, sbi.barcode_bits, sbi.barcode_rank, numThreads);
+    attach_bit_table(sbi.match_table, sbi.rank_support_match_table, sbi.match_bits, sbi.match_rank, numThreads);
 
-    // Initialize the substitution table.
+    // Initialize the substitution table. Entries hold the position and the base of the
+    // whitelisted barcode.
     unsigned bcPos = std::ceil(std::log(sbi.bcLength) / std::log(2));
     uint64_t subst = sbi.rank_support_match_table(sbi.match_table.size());
-    sbi.substitution_table = sdsl::int_vector<>(subst * sbi.numAlts, 0u, bcPos);
-    sdsl::int_vector<> helper_subst_table(subst, 0u, sbi.numAlts);
+    sbi.substitution_values = sdsl::int_vector<>(subst * sbi.numAlts, 0u, bcPos + 2);
+    sbi.substitutionBases = true;
+
+    // The entries of the ONE_ERROR codes of a range are consecutive in the substitution table.
+    uint64_t size = sbi.barcode_table.size();
+    PlainBarcodeTable table(sbi.barcode_table, sbi.rank_support_barcode_table);
+    std::vector<uint64_t> firstPos(numThreads + 1);
+    std::vector<SharedRangeWriter<sdsl::int_vector<> > > writers;
+    for (unsigned t = 0; t <= numThreads; ++t)
+        firstPos[t] = sbi.rank_support_match_table(table.rank(range_begin(size, t, numThreads)));
+    for (unsigned t = 0; t < numThreads; ++t)
+        writers.emplace_back(sbi.substitution_values, firstPos[t] * sbi.numAlts, firstPos[t + 1] * sbi.numAlts);
 
     // Fill the substitution table.
+    runParallel(numThreads, [&](unsigned t) {
+        uint64_t begin = range_begin(size, t, numThreads);
+        uint64_t end = range_begin(size, t + 1, numThreads);
+        sdsl::int_vector<> helper_subst_table(firstPos[t + 1] - firstPos[t], 0u, sbi.numAlts);
+        with_barcode_length(sbi.bcLength, sbi.specializedKernels, [&](auto bcLength) {
+            for (uint64_t h : whitelist)
+            {
+                for (unsigned i = 0; i < bcLength; ++i)
+                {
+                    uint64_t entry = (i << 2) | ((h >> 2*i) & 3);
+                    h ^= static_cast<uint64_t>(1) << 2*i;
+                    if (in_range(h, begin, end))
+                        set_substitution(sbi, h, entry, helper_subst_table, firstPos[t], writers[t]);
+                    h ^= static_cast<uint64_t>(2) << 2*i;
+                    if (in_range(h, begin, end))
+                        set_substitution(sbi, h, entry, helper_subst_table, firstPos[t], writers[t]);
+                    h ^= static_cast<uint64_t>(1) << 2*i;
+                    if (in_range(h, begin, end))
+                        set_substitution(sbi, h, entry, helper_subst_table, firstPos[t], writers[t]);
+                    h ^= static_cast<uint64_t>(2) << 2*i;
+                }
+            }
+        });
+    });
+    for (unsigned t = 0; t < numThreads; ++t)
+        writers[t].flush();
+
+    attach_substitution_table(sbi);
+    printDone();
+}
+
+// ---------------------------------------------------------------------------------------
+// Low-memory build
+// ---------------------------------------------------------------------------------------
+
+// The low-memory build does not hold the uncondensed match table and the helper tables over
+// all codes. It collects the neighbours of the whitelisted barcodes for one range of codes at
+// a time, sorts them and writes the condensed tables in the order of the codes. The tables
+// are identical to those of buildBarcodeAndMatchTable() and buildSubstitutionTable().
+
+// Memory for the neighbours of one range of codes in the low-memory build.
+const uint64_t MIN_NEIGHBOUR_MEMORY = (uint64_t)64 << 20;
+
+// Neighbour of a whitelisted barcode. 'order' is the position of the barcode in the whitelist
+// times bcLength plus the substituted position, i.e. the order buildSubstitutionTable() adds
+// them in, times 4 plus the base of the whitelisted barcode at the substituted position.
+struct Neighbour
+{
+    uint64_t code;
+    uint64_t order;
+
+    bool operator<(Neighbour const & other) const
+    {
+        return code < other.code || (code == other.code && order < other.order);
+    }
+};
+
+// Collects the neighbours in the range [begin, end) of codes sorted by code and order.
+template <typename TLength>
+void collect_neighbours(std::vector<Neighbour> & neighbours, std::vector<uint64_t> const & whitelist, TLength bcLength,
+                        uint64_t begin, uint64_t end)
+{
+    neighbours.clear();
+    for (uint64_t n = 0; n < whitelist.size(); ++n)
+    {
+        uint64_t h = whitelist[n];
+        for (unsigned i = 0; i < bcLength; ++i)
+        {
+            uint64_t order = (n * bcLength + i) << 2 | ((h >> 2*i) & 3);
+            for (uint64_t v = 1; v < 4; ++v)
+            {
+                uint64_t code = h ^ (v << 2*i);
+                if (in_range(code, begin, end))
+                    neighbours.push_back({code, order});
+            }
+        }
+    }
+    std::sort(neighbours.begin(), neighbours.end());
+}
+
+void buildTablesLowMemory(BarcodeIndex & sbi, std::vector<uint64_t> const & whitelist, unsigned numThreads)
+{
+    uint64_t size = (uint64_t)1 << (2*sbi.bcLength);
+    uint64_t memory = std::max(MIN_NEIGHBOUR_MEMORY, size / 32);
+    uint64_t numRanges = (whitelist.size() * 3 * sbi.bcLength * sizeof(Neighbour) + memory - 1) / memory;
+    numRanges = std::max(std::min(numRanges, size / 64), (uint64_t)1);
+    std::vector<Neighbour> neighbours;
+
+    // Pass 1: Set the whitelisted codes and the codes with at most numAlts whitelisted
+    // neighbours in the barcode table.
+    printStatus("Building barcode table of barcode index");
+    sbi.barcode_bits = sdsl::bit_vector(size, 0u);
+    for (uint64_t h : whitelist)
+        sbi.barcode_bits[h] = 1;
+    uint64_t numOneError = 0;
+    for (uint64_t r = 0; r < numRanges; ++r)
+    {
+        with_barcode_length(sbi.bcLength, sbi.specializedKernels, [&](auto bcLength) {
+            collect_neighbours(neighbours, whitelist, bcLength, range_begin(size, r, numRanges), range_begin(size, r + 1, numRanges));
+        });
+        for (uint64_t first = 0, last; first < neighbours.size(); first = last)
+        {
+            for (last = first + 1; last < neighbours.size() && neighbours[last].code == neighbours[first].code; ++last) ;
+            if (last - first <= sbi.numAlts && sbi.barcode_bits[neighbours[first].code] == 0)
+            {
+                sbi.barcode_bits[neighbours[first].code] = 1;
+                ++numOneError;
+            }
+        }
+    }
+    attach_bit_table(sbi.barcode_table, sbi.rank_support_barcode_table, sbi.barcode_bits, sbi.barcode_rank, numThreads);
+    printDone();
+
+    // Pass 2: Set the match table bits and the substitution table entries of the ONE_ERROR codes.
+    printStatus("Building match table and substitution table of barcode index");
+    std::vector<uint64_t> sorted(whitelist);
+    std::sort(sorted.begin(), sorted.end());
+    unsigned bcPos = std::ceil(std::log(sbi.bcLength) / std::log(2));
+    sbi.match_bits = sdsl::bit_vector(sbi.rank_support_barcode_table(size), 0u);
+    sbi.substitution_values = sdsl::int_vector<>(numOneError * sbi.numAlts, 0u, bcPos + 2);
+    sbi.substitutionBases = true;
+    uint64_t pos = 0;
+    for (uint64_t r = 0; r < numRanges; ++r)
+    {
+        with_barcode_length(sbi.bcLength, sbi.specializedKernels, [&](auto bcLength) {
+            collect_neighbours(neighbours, whitelist, bcLength, range_begin(size, r, numRanges), range_begin(size, r + 1, numRanges));
+        });
+        for (uint64_t first = 0, last; first < neighbours.size(); first = last)
+        {
+            uint64_t code = neighbours[first].code;
+            for (last = first + 1; last < neighbours.size() && neighbours[last].code == code; ++last) ;
+            if (last - first > sbi.numAlts || std::binary_search(sorted.begin(), sorted.end(), code))
+                continue;
+
+            // Entries are followed by a copy of the last entry if there is space left.
+            sbi.match_bits[sbi.rank_support_barcode_table(code)] = 1;
+            uint64_t index = pos << sbi.numAltsBase;
+            uint64_t entry = 0;
+            for (uint64_t k = first; k < last; ++k)
+            {
+                entry = (((neighbours[k].order >> 2) % sbi.bcLength) << 2) | (neighbours[k].order & 3);
+                sbi.substitution_values[index++] = entry;
+            }
+            if (last - first < sbi.numAlts)
+                sbi.substitution_values[index] = entry;
+            ++pos;
+        }
+    }
+    std::vector<Neighbour>().swap(neighbours);
+    attach_bit_table(sbi.match_table, sbi.rank_support_match_table, sbi.match_bits, sbi.match_rank, numThreads);
+    attach_substitution_table(sbi);
+    printDone();
+
+    std::ostringstream msg;
+    msg << "Neighbours of the whitelisted barcodes were processed in " << numRanges << " ranges of codes.";
+    printInfo(msg);
+}
+
+// Reads the codes of the whitelisted barcodes in the order of the whitelist.
+void read_whitelist(std::vector<uint64_t> & whitelist, seqan::CharString & filename, unsigned bcLength)
+{
     std::ifstream infile(toCString(filename));
     std::string barcode;
     while (infile >> barcode)
     {
-        DnaString bc = barcode;
-        uint64_t h = hash(bc);
-        for (unsigned i = 0; i < sbi.bcLength; ++i)
+        uint64_t h;
+        unsigned posN;
+        if (barcode.size() == bcLength)
+        {
+            hash(h, posN, barcode.c_str(), bcLength);
+        }
+        else
         {
-            h ^= static_cast<uint64_t>(1) << 2*i;
-            set_substitution(sbi, h, i, helper_subst_table);
-            h ^= static_cast<uint64_t>(2) << 2*i;
-            set_substitution(sbi, h, i, helper_subst_table);
-            h ^= static_cast<uint64_t>(1) << 2*i;
-            set_substitution(sbi, h, i, helper_subst_table);
-            h ^= static_cast<uint64_t>(2) << 2*i;
+            DnaString bc = barcode;
+            h = hash(bc);
         }
+        whitelist.push_back(h);
     }
-    printDone();
 }
 
-void buildIndex(BarcodeIndex & sbi, seqan::CharString & filename, unsigned alternatives)
+void buildIndex(BarcodeIndex & sbi, seqan::CharString & filename, unsigned alternatives, unsigned numThreads, bool lowMemory)
 {
     sbi.numAlts = alternatives;
     sbi.numAltsBase = std::log(sbi.numAlts) / std::log(2);
 
-    buildBarcodeAndMatchTable(sbi, filename);
-    buildSubstitutionTable(sbi, filename);
+    // Long barcodes and small whitelists are indexed sparsely.
+    std::vector<uint64_t> whitelist;
+    if (sbi.bcLength <= 32)
+        read_whitelist(whitelist, filename, sbi.bcLength);
+    if (use_sparse_index(sbi.bcLength, whitelist.size()))
+    {
+        std::vector<uint64_t>().swap(whitelist);
+        sbi.engine = IndexEngine::SPARSE;
+        sbi.substitutionBases = true;
+        build_sparse_index(sbi.sparse, filename, sbi.bcLength, sbi.numAlts);
+        return;
+    }
+    sbi.engine = IndexEngine::DENSE;
+
+    if (lowMemory)
+    {
+        buildTablesLowMemory(sbi, whitelist, std::max(numThreads, 1u));
+        return;
+    }
+    buildBarcodeAndMatchTable(sbi, whitelist, std::max(numThreads, 1u));
+    buildSubstitutionTable(sbi, whitelist, std::max(numThreads, 1u));
 }
 
+// Loads an index written to separate files by earlier versions. The rank support is rebuilt.
 int load(BarcodeIndex & sbi, seqan::CharString & filename)
 {
     printStatus("Loading barcode index");
@@ -254,173 +717,349 @@ int load(BarcodeIndex & sbi, seqan::CharString & filename)
     // Load sbi.numAlts from file.
     in.read((char*)&sbi.numAlts,sizeof(sbi.numAlts));
     sbi.numAltsBase = std::log(sbi.numAlts) / std::log(2);
+    sbi.substitutionBases = false;
 
     // Load the barcode table of the index from file.
-    sbi.barcode_table.load(in);
+    sbi.barcode_bits.load(in);
     in.close();
 
-    sbi.rank_support_barcode_table = sdsl::rank_support_v<>(&sbi.barcode_table);
+    attach_bit_table(sbi.barcode_table, sbi.rank_support_barcode_table, sbi.barcode_bits, sbi.barcode_rank);
 
     // Load the match table of the index from file.
     CharString matchFilename = filename;
     matchFilename += ".match";
-    bool ret = sdsl::load_from_file(sbi.match_table, toCString(matchFilename));
+    bool ret = sdsl::load_from_file(sbi.match_bits, toCString(matchFilename));
     if (ret == false)
     {
         std::cerr << "Match table does not exist." << std::endl;
         return 2;
     }
 
-    sbi.rank_support_match_table = sdsl::rank_support_v<>(&sbi.match_table);
+    attach_bit_table(sbi.match_table, sbi.rank_support_match_table, sbi.match_bits, sbi.match_rank);
 
     // Load the substitution table of the index from file.
     CharString substFilename = filename;
     substFilename += ".subst";
-    ret = sdsl::load_from_file(sbi.substitution_table, toCString(substFilename));
+    ret = sdsl::load_from_file(sbi.substitution_values, toCString(substFilename));
     if (ret == false)
     {
         std::cerr << "Substitution table does not exist." << std::endl;
         return 3;
     }
+    attach_substitution_table(sbi);
 
     printDone();
     return 0;
 }
 
-void write(seqan::CharString & filename, BarcodeIndex & sbi)
+char const * barcode_table_name(BarcodeTableType type)
 {
-    writeBarcodeTable(filename, sbi);
-    writeMatchTable(filename, sbi);
-    writeSubstitutionTable(filename, sbi);
+    switch (type)
+    {
+        case BarcodeTableType::SD:
+            return "sd";
+        case BarcodeTableType::RRR:
+            return "rrr";
+        case BarcodeTableType::HYB:
+            return "hyb";
+        case BarcodeTableType::INTERLEAVED:
+            return "il";
+        default:
+            return "plain";
+    }
 }
 
-void writeBarcodeTable(seqan::CharString & filename, BarcodeIndex & sbi)
+// Builds the compressed barcode table of the given type from the plain barcode table. The plain
+// barcode table is kept so that the table can be selected again.
+void select_barcode_table(BarcodeIndex & sbi, BarcodeTableType type)
 {
-    printStatus("Writing barcode table of barcode index");
+    if (sbi.engine != IndexEngine::DENSE || type == sbi.tableType)
+        return;
+    if (sbi.barcode_table.words == NULL)
+        SEQAN_THROW(IOError("The plain barcode table has been released."));
+
+    sbi.tableType = BarcodeTableType::PLAIN;
+    sbi.sd_table.reset();
+    sbi.rrr_table.reset();
+    sbi.hyb_table.reset();
+    sbi.il_table.reset();
+    if (type == BarcodeTableType::PLAIN)
+        return;
 
-    CharString bcFilename = filename;
-    bcFilename += ".bc";
+    std::ostringstream msg;
+    msg << "Compressing barcode table (" << barcode_table_name(type) << ")";
+    printStatus(msg);
 
-    // Open the barcode table file.
-    std::ofstream out;
-    out.open(toCString(bcFilename), std::ios::binary | std::ios::trunc | std::ios::out);
-    if (!out)
+    // A mapped barcode table is copied to a temporary bit vector.
+    sdsl::bit_vector copy;
+    if (type != BarcodeTableType::INTERLEAVED && sbi.barcode_bits.size() != sbi.barcode_table.size())
     {
-        std::cerr << "Cannot open file '" << toCString(bcFilename) << "'." << std::endl;
-        return;
+        copy.resize(sbi.barcode_table.size());
+        std::copy(sbi.barcode_table.data(), sbi.barcode_table.data() + (sbi.barcode_table.size() >> 6) + 1, copy.data());
     }
+    sdsl::bit_vector const & plain = sbi.barcode_bits.size() == sbi.barcode_table.size() ? sbi.barcode_bits : copy;
 
-    // Write sbi.numAlts to file.
-    out.write((char*)&sbi.numAlts,sizeof(sbi.numAlts));
-
-    // Write the barcode table of the index to file.
-    sbi.barcode_table.serialize(out);
-    out.close();
-
+    switch (type)
+    {
+        case BarcodeTableType::SD:
+            sbi.sd_table.reset(new CompressedBarcodeTable<sdsl::sd_vector<> >(plain));
+            break;
+        case BarcodeTableType::RRR:
+            sbi.rrr_table.reset(new CompressedBarcodeTable<sdsl::rrr_vector<> >(plain));
+            break;
+        case BarcodeTableType::HYB:
+            sbi.hyb_table.reset(new CompressedBarcodeTable<sdsl::hyb_vector<> >(plain));
+            break;
+        case BarcodeTableType::INTERLEAVED:
+            sbi.il_table.reset(new InterleavedBarcodeTable(sbi.barcode_table, sbi.match_table));
+            break;
+        default:
+            break;
+    }
+    sbi.tableType = type;
     printDone();
 }
 
-void writeMatchTable(seqan::CharString & filename, BarcodeIndex & sbi)
+// Frees a bit table and its rank support. Pages of a mapped index file are dropped from the
+// resident set of the process. Sections are aligned to pages, a bit table is followed by its
+// rank support.
+void release_bit_table(BarcodeIndex & sbi, BitTable & table, RankTable & rank, sdsl::bit_vector & bits, std::vector<uint64_t> & blocks)
 {
-    printStatus("Writing match table of barcode index");
+    if (bits.size() == table.size())
+    {
+        sdsl::util::clear(bits);
+        std::vector<uint64_t>().swap(blocks);
+    }
+    else if (sbi.mapping != NULL)
+    {
+        char * begin = reinterpret_cast<char *>(const_cast<uint64_t *>(table.words));
+        char * end = reinterpret_cast<char *>(const_cast<uint64_t *>(rank.blocks)) + ((table.size() >> 9) + 1) * 2 * sizeof(uint64_t);
+        madvise(begin, end - begin, MADV_DONTNEED);
+    }
+    table = BitTable();
+    rank = RankTable();
+}
 
-    CharString matchFilename = filename;
-    matchFilename += ".match";
+// Frees the plain barcode table after another barcode table was selected. The interleaved
+// table replaces the match table as well.
+void release_plain_barcode_table(BarcodeIndex & sbi)
+{
+    if (sbi.engine != IndexEngine::DENSE || sbi.tableType == BarcodeTableType::PLAIN)
+        return;
 
-    // Write the match table of the index to a file.
-    sdsl::store_to_file(sbi.match_table, toCString(matchFilename));
+    release_bit_table(sbi, sbi.barcode_table, sbi.rank_support_barcode_table, sbi.barcode_bits, sbi.barcode_rank);
+    if (sbi.tableType == BarcodeTableType::INTERLEAVED)
+        release_bit_table(sbi, sbi.match_table, sbi.rank_support_match_table, sbi.match_bits, sbi.match_rank);
+}
 
-    printDone();
+// Size of the barcode table used for lookups including its rank support. For the sparse index
+// the size of its hash table.
+uint64_t barcode_table_bytes(BarcodeIndex & sbi)
+{
+    if (sbi.engine == IndexEngine::SPARSE)
+        return sbi.sparse.numSlots * 3 * sizeof(uint64_t);
+    switch (sbi.tableType)
+    {
+        case BarcodeTableType::SD:
+            return sdsl::size_in_bytes(sbi.sd_table->vector) + sdsl::size_in_bytes(sbi.sd_table->rank_support);
+        case BarcodeTableType::RRR:
+            return sdsl::size_in_bytes(sbi.rrr_table->vector) + sdsl::size_in_bytes(sbi.rrr_table->rank_support);
+        case BarcodeTableType::HYB:
+            return sdsl::size_in_bytes(sbi.hyb_table->vector) + sdsl::size_in_bytes(sbi.hyb_table->rank_support);
+        case BarcodeTableType::INTERLEAVED:
+            return (sbi.il_table->storage.size() + sbi.il_table->superblocks.size()) * sizeof(uint64_t);
+        default:
+            return ((sbi.barcode_table.size() >> 6) + 1) * sizeof(uint64_t)
+                   + ((sbi.barcode_table.size() >> 9) + 1) * 2 * sizeof(uint64_t);
+    }
 }
 
-void writeSubstitutionTable(seqan::CharString & filename, BarcodeIndex & sbi)
+// Appends the corrections to a list of barcodes.
+void append_barcodes(std::vector<seqan::DnaString> & bx, CorrectedBarcodes const & corrected, unsigned bcLength)
 {
-    printStatus("Writing substitution table of barcode index");
+    for (unsigned k = 0; k < corrected.size; ++k)
+        bx.push_back(unhash_long(corrected.codes[k], bcLength));
+}
 
-    CharString substFilename = filename;
-    substFilename += ".subst";
+template <typename TTable, typename TLength>
+inline void add_corrected_barcodes(CorrectedBarcodes & bx, BarcodeIndex & sbi, TTable const & table, uint64_t h, char const * qx,
+                                   TLength bcLength)
+{
+    unsigned offset = 0;
+    unsigned i;
+    while(offset != sbi.numAlts && get_substitution(i, sbi, table, h, offset))
+    {
+        uint64_t h_corrected = get_corrected_barcode(sbi, table, h, i);
+        SEQAN_ASSERT_NEQ(h_corrected, h);
+        insert_correction(bx, BarcodeCode{0, h_corrected}, qx[bcLength-1 - substitution_position(sbi, i)]);
+        ++offset;
+    }
+}
 
-    // Write the substitution table of the index to a file.
-    sdsl::store_to_file(sbi.substitution_table, toCString(substFilename));
+// ---------------------------------------------------------------------------------------
+// Retrieval from the sparse index
+// ---------------------------------------------------------------------------------------
 
-    printDone();
+inline bool is_sparse_match(SparseIndex const & index, BarcodeCode const & code)
+{
+    return (sparse_lookup(index, code) & SPARSE_STATUS) == SPARSE_MATCH;
 }
 
-BarcodeStatus retrieve(std::vector<seqan::DnaString> & bx, BarcodeIndex & sbi, seqan::DnaString & rx, seqan::CharString & qx)
+// Returns the whitelisted barcode of substitution entry i as get_corrected_barcode() does.
+inline BarcodeCode get_corrected_barcode_sparse(BarcodeIndex const & sbi, BarcodeCode const & code, unsigned i)
 {
-    uint64_t h = hash(rx);
-    BarcodeStatus s = get_status(sbi, h);
-    std::vector<std::pair<DnaString, unsigned> > bxx;
+    if (sbi.substitutionBases)
+    {
+        unsigned pos = i >> 2;
+        uint64_t base = (pos < 32 ? code.lo >> 2*pos : code.hi >> 2*(pos - 32)) & 3;
+        return substitute(code, pos, base ^ (i & 3));
+    }
 
-    switch (s)
+    SparseIndex const & index = sbi.sparse;
+    unsigned pos = i;
+    static const uint64_t variants[3] = {1, 3, 2};
+    for (uint64_t v : variants)
     {
-        case BarcodeStatus::UNRECOGNIZED:
-            break;
-        case BarcodeStatus::INVALID:
+        BarcodeCode corrected = substitute(code, pos, v);
+        if (is_sparse_match(index, corrected))
+            return corrected;
+    }
+    return code;
+}
+
+inline void add_corrected_barcodes_sparse(CorrectedBarcodes & bx, BarcodeIndex & sbi, BarcodeCode const & code, uint64_t value, char const * qx)
+{
+    // Positions are enumerated until a position repeats, as in add_corrected_barcodes().
+    uint8_t const * positions = sbi.sparse.positions + (value & SPARSE_PAYLOAD);
+    unsigned count = std::min((unsigned)positions[0], sbi.numAlts);
+    for (unsigned offset = 0; offset < count; ++offset)
+    {
+        unsigned i = positions[1 + offset];
+        if (offset > 0 && i == positions[offset])
             break;
-        case BarcodeStatus::MATCH:
+        BarcodeCode corrected = get_corrected_barcode_sparse(sbi, code, i);
+        insert_correction(bx, corrected, qx[sbi.bcLength-1 - substitution_position(sbi, i)]);
+    }
+}
+
+BarcodeStatus retrieve_sparse(CorrectedBarcodes & bx, BarcodeIndex & sbi, BarcodeCode code, unsigned numN, unsigned posN, char const * qx)
+{
+    switch (numN)
+    {
+        case 0:
         {
-            bx.push_back(rx);
-            break;
+            uint64_t value = sparse_lookup(sbi.sparse, code);
+            if ((value & SPARSE_STATUS) == SPARSE_MATCH)
+            {
+                append_correction(bx, code);
+                return BarcodeStatus::MATCH;
+            }
+            if ((value & SPARSE_STATUS) == SPARSE_ONE_ERROR)
+            {
+                add_corrected_barcodes_sparse(bx, sbi, code, value, qx);
+                return BarcodeStatus::ONE_ERROR;
+            }
+            return BarcodeStatus::UNRECOGNIZED;
         }
-        case BarcodeStatus::ONE_ERROR:
+        case 1:
         {
-            unsigned offset = 0;
-            unsigned i;
-            while(offset != sbi.numAlts && get_substitution(i, sbi, h, offset))
+            // Try all bases at the position of the N.
+            BarcodeStatus ret = BarcodeStatus::UNRECOGNIZED;
+            unsigned i = sbi.bcLength - 1 - posN;
+            uint64_t base = (i < 32 ? code.lo >> 2*i : code.hi >> 2*(i - 32)) & 3;
+            code = substitute(code, i, base);
+            for (uint64_t v = 0; v < ValueSize<Dna>::VALUE; ++v)
             {
-                uint64_t h_corrected = get_corrected_barcode(sbi, h, i);
-                SEQAN_ASSERT_NEQ(h_corrected, h);
-                bxx.push_back(std::pair<DnaString, unsigned>(unhash(h_corrected, sbi.bcLength), qx[length(qx)-1 - i]));
-                ++offset;
+                BarcodeCode candidate = substitute(code, i, v);
+                if (is_sparse_match(sbi.sparse, candidate))
+                {
+                    ret = BarcodeStatus::ONE_ERROR;
+                    append_correction(bx, candidate);
+                }
             }
-
-            std::sort(bxx.begin(), bxx.end(), [](auto & left, auto & right) {
-                return left.second < right.second;
-            });
-
-            for (unsigned i = 0; i < bxx.size(); ++i)
-                bx.push_back(bxx[i].first);
-
-            break;
+            return ret;
         }
+        default:
+            return BarcodeStatus::UNRECOGNIZED;
     }
+}
 
-    return s;
+// Rank of a whitelisted barcode that orders barcodes lexicographically.
+uint64_t barcode_rank(BarcodeIndex & sbi, BarcodeCode const & code)
+{
+    if (sbi.engine == IndexEngine::SPARSE)
+        return sparse_lookup(sbi.sparse, code) & SPARSE_PAYLOAD;
+    return with_barcode_table(sbi, [&](auto const & table) { return table.rank(code.lo); });
 }
 
-BarcodeStatus retrieve(std::vector<seqan::DnaString> & bx, BarcodeIndex & sbi, seqan::Dna5String & rx, seqan::CharString & qx)
+uint64_t barcode_rank(BarcodeIndex & sbi, seqan::DnaString & barcode)
 {
-    // Find N positions in the barcode.
-    typename Iterator<Dna5String, Rooted>::Type it = begin(rx);
-    typename Iterator<Dna5String, Rooted>::Type itEnd = end(rx);
-    String<unsigned> posN;
-    for (; it != itEnd; ++it)
+    return barcode_rank(sbi, hash_long(barcode));
+}
+
+// Collects the codes of the whitelisted barcodes of an index of barcodes of up to 32 bases in
+// lexicographical order. The dense index marks them in the barcode table but not in the match
+// table, thus they are found by a scan over the words of both tables without rank queries.
+void whitelisted_codes(std::vector<uint64_t> & codes, BarcodeIndex const & sbi)
+{
+    codes.clear();
+    if (sbi.engine == IndexEngine::SPARSE)
     {
-        if (*it == 'N')
-            appendValue(posN, position(it));
+        for (uint64_t slot = 0; slot < sbi.sparse.numSlots; ++slot)
+            if ((sbi.sparse.values[slot] & SPARSE_STATUS) == SPARSE_MATCH && sbi.sparse.keys[2 * slot] == 0)
+                codes.push_back(sbi.sparse.keys[2 * slot + 1]);
+        std::sort(codes.begin(), codes.end());
+        return;
+    }
+
+    uint64_t rank = 0;
+    uint64_t numWords = (sbi.barcode_table.size() + 63) >> 6;
+    for (uint64_t w = 0; w < numWords; ++w)
+    {
+        for (uint64_t word = sbi.barcode_table.data()[w]; word != 0; word &= word - 1)
+        {
+            if (!sbi.match_table[rank++])
+                codes.push_back((w << 6) | __builtin_ctzll(word));
+        }
     }
+}
+
+BarcodeStatus retrieve(CorrectedBarcodes & bx, BarcodeIndex & sbi, BarcodeCode const & code, unsigned numN, unsigned posN, char const * qx)
+{
+    if (sbi.engine == IndexEngine::SPARSE)
+        return retrieve_sparse(bx, sbi, code, numN, posN, qx);
+    return retrieve(bx, sbi, code.lo, numN, posN, qx);
+}
 
-    // Call retrieve() for each possible nucleotide at N positions in the barcode.
-    DnaString rxx = rx;
-    switch(length(posN))
+template <typename TTable, typename TLength>
+BarcodeStatus retrieve_dense(CorrectedBarcodes & bx, BarcodeIndex & sbi, TTable const & table, uint64_t h, unsigned numN, unsigned posN, char const * qx,
+                             TLength bcLength)
+{
+    switch (numN)
     {
         case 0:
-            return retrieve(bx, sbi, rxx, qx);
+        {
+            BarcodeStatus s = get_status(sbi, table, h);
+            if (s == BarcodeStatus::MATCH)
+                append_correction(bx, BarcodeCode{0, h});
+            else if (s == BarcodeStatus::ONE_ERROR)
+                add_corrected_barcodes(bx, sbi, table, h, qx, bcLength);
+            return s;
+        }
         case 1:
         {
             // Determine whether the barcode status will be ONE_ERROR or UNRECOGNIZED.
             BarcodeStatus ret = BarcodeStatus::UNRECOGNIZED;
-            for (unsigned i = 0; i < ValueSize<Dna>::VALUE; ++i)
+            unsigned shift = 2 * (bcLength - 1 - posN);
+            h &= ~(static_cast<uint64_t>(3) << shift);
+            for (uint64_t i = 0; i < ValueSize<Dna>::VALUE; ++i)
             {
-                rxx[posN[0]] = Dna(i);
-                uint64_t h = hash(rxx);
-                BarcodeStatus s = get_status(sbi, h);
-                if (s == BarcodeStatus::MATCH)
+                uint64_t hh = h | (i << shift);
+                if (get_status(sbi, table, hh) == BarcodeStatus::MATCH)
                 {
                     // Add N substituted MATCH barcode as ONE_ERROR barcode.
                     ret = BarcodeStatus::ONE_ERROR;
-                    bx.push_back(rxx);
+                    append_correction(bx, BarcodeCode{0, hh});
                 }
             }
             return ret;
@@ -428,5 +1067,194 @@ BarcodeStatus retrieve(std::vector<seqan::DnaString> & bx, BarcodeIndex & sbi, s
         default: // more than 2 Ns in the barcode
             return BarcodeStatus::UNRECOGNIZED;
     }
-    return BarcodeStatus::INVALID;
+}
+
+BarcodeStatus retrieve(CorrectedBarcodes & bx, BarcodeIndex & sbi, uint64_t h, unsigned numN, unsigned posN, char const * qx)
+{
+    if (sbi.engine == IndexEngine::SPARSE)
+        return retrieve_sparse(bx, sbi, BarcodeCode{0, h}, numN, posN, qx);
+    return with_barcode_table(sbi, [&](auto const & table) {
+        return with_barcode_length(sbi.bcLength, sbi.specializedKernels, [&](auto bcLength) {
+            return retrieve_dense(bx, sbi, table, h, numN, posN, qx, bcLength);
+        });
+    });
+}
+
+// The following overloads append the corrections to a list of barcodes.
+BarcodeStatus retrieve(std::vector<seqan::DnaString> & bx, BarcodeIndex & sbi, uint64_t h, unsigned numN, unsigned posN, char const * qx)
+{
+    CorrectedBarcodes corrected;
+    BarcodeStatus s = retrieve(corrected, sbi, h, numN, posN, qx);
+    append_barcodes(bx, corrected, sbi.bcLength);
+    return s;
+}
+
+BarcodeStatus retrieve(std::vector<seqan::DnaString> & bx, BarcodeIndex & sbi, BarcodeCode const & code, unsigned numN, unsigned posN, char const * qx)
+{
+    CorrectedBarcodes corrected;
+    BarcodeStatus s = retrieve(corrected, sbi, code, numN, posN, qx);
+    append_barcodes(bx, corrected, sbi.bcLength);
+    return s;
+}
+
+BarcodeStatus retrieve(std::vector<seqan::DnaString> & bx, BarcodeIndex & sbi, seqan::DnaString & rx, seqan::CharString & qx)
+{
+    return retrieve(bx, sbi, hash_long(rx), 0, 0, toCString(qx));
+}
+
+// Prefetches the 64-bit word of an sdsl vector that holds bit 'pos'.
+template <typename TVector>
+inline void prefetch_bit(TVector const & v, uint64_t pos)
+{
+    __builtin_prefetch(v.data() + (pos >> 6));
+}
+
+// Number of barcodes whose lookups are interleaved in retrieveBatch().
+const unsigned RETRIEVE_BLOCK_SIZE = 32;
+
+// Determines the statuses of a block of codes and the substitution table positions of ONE_ERROR codes.
+template <typename TTable>
+inline void lookupBlock(BarcodeStatus * status, uint64_t * substIndex, BarcodeIndex & sbi, TTable const & table, uint64_t const * codes, unsigned n)
+{
+    uint64_t bcRank[RETRIEVE_BLOCK_SIZE];
+
+    // Stage 1: Prefetch the barcode table words and their rank superblocks.
+    for (unsigned k = 0; k < n; ++k)
+    {
+        table.prefetch(codes[k]);
+        table.prefetch_rank(codes[k]);
+    }
+
+    // Stage 2: Read the barcode table bits and prefetch the match table words and their rank
+    // superblocks of the hits.
+    for (unsigned k = 0; k < n; ++k)
+    {
+        if (table.is_set(codes[k]))
+        {
+            bcRank[k] = table.rank(codes[k]);
+            prefetch_bit(sbi.match_table, bcRank[k]);
+            sbi.rank_support_match_table.prefetch(bcRank[k]);
+            status[k] = BarcodeStatus::MATCH;
+        }
+        else
+        {
+            status[k] = BarcodeStatus::UNRECOGNIZED;
+        }
+    }
+
+    // Stage 3: Read the match table bits and prefetch the substitution table entries.
+    unsigned width = sbi.substitution_table.width();
+    for (unsigned k = 0; k < n; ++k)
+    {
+        if (status[k] == BarcodeStatus::MATCH && sbi.match_table[bcRank[k]])
+        {
+            status[k] = BarcodeStatus::ONE_ERROR;
+            substIndex[k] = sbi.rank_support_match_table(bcRank[k]) << sbi.numAltsBase;
+            prefetch_bit(sbi.substitution_table, substIndex[k] * width);
+            prefetch_bit(sbi.substitution_table, (substIndex[k] + sbi.numAlts) * width - 1);
+        }
+    }
+}
+
+// The interleaved table holds the status and the ranks of a code in one cache line.
+inline void lookupBlock(BarcodeStatus * status, uint64_t * substIndex, BarcodeIndex & sbi, InterleavedBarcodeTable const & table, uint64_t const * codes, unsigned n)
+{
+    // Stage 1: Prefetch the cache lines.
+    for (unsigned k = 0; k < n; ++k)
+        table.prefetch(codes[k]);
+
+    // Stages 2 and 3: Read the statuses and prefetch the substitution table entries.
+    unsigned width = sbi.substitution_table.width();
+    for (unsigned k = 0; k < n; ++k)
+    {
+        status[k] = get_status(sbi, table, codes[k]);
+        if (status[k] == BarcodeStatus::ONE_ERROR)
+        {
+            substIndex[k] = substitution_rank(sbi, table, codes[k]) << sbi.numAltsBase;
+            prefetch_bit(sbi.substitution_table, substIndex[k] * width);
+            prefetch_bit(sbi.substitution_table, (substIndex[k] + sbi.numAlts) * width - 1);
+        }
+    }
+}
+
+template <typename TTable, typename TLength>
+void retrieveBlock(CorrectedBarcodes * bx, BarcodeStatus * status, BarcodeIndex & sbi, TTable const & table, uint64_t const * codes, char const * const * qx, unsigned n,
+                   TLength bcLength)
+{
+    uint64_t substIndex[RETRIEVE_BLOCK_SIZE];
+    lookupBlock(status, substIndex, sbi, table, codes, n);
+
+    // Stage 4: Prefetch the barcode table words of all candidate corrections. Not needed if the
+    // substitution entries hold the bases of the whitelisted barcodes.
+    for (unsigned k = 0; k < n; ++k)
+    {
+        if (status[k] != BarcodeStatus::ONE_ERROR || sbi.substitutionBases)
+            continue;
+        for (unsigned offset = 0; offset < sbi.numAlts; ++offset)
+        {
+            unsigned i = sbi.substitution_table[substIndex[k] + offset];
+            if (offset > 0 && i == sbi.substitution_table[substIndex[k] + offset - 1])
+                break;
+            table.prefetch(codes[k] ^ (static_cast<uint64_t>(1) << 2*i));
+            table.prefetch(codes[k] ^ (static_cast<uint64_t>(2) << 2*i));
+            table.prefetch(codes[k] ^ (static_cast<uint64_t>(3) << 2*i));
+        }
+    }
+
+    // Stage 5: Resolve the barcodes.
+    for (unsigned k = 0; k < n; ++k)
+    {
+        if (status[k] == BarcodeStatus::MATCH)
+            append_correction(bx[k], BarcodeCode{0, codes[k]});
+        else if (status[k] == BarcodeStatus::ONE_ERROR)
+            add_corrected_barcodes(bx[k], sbi, table, codes[k], qx[k], bcLength);
+    }
+}
+
+// Retrieves the barcodes for n codes of barcodes without N. The lookups of blocks of codes are interleaved
+// and their memory accesses prefetched. Corrections are appended to bx[0..n-1].
+void retrieveBatch(CorrectedBarcodes * bx, BarcodeStatus * status, BarcodeIndex & sbi, uint64_t const * codes, char const * const * qx, unsigned n)
+{
+    if (sbi.engine == IndexEngine::SPARSE)
+    {
+        for (unsigned k = 0; k < n; ++k)
+            prefetch_sparse(sbi.sparse, BarcodeCode{0, codes[k]});
+        for (unsigned k = 0; k < n; ++k)
+            status[k] = retrieve_sparse(bx[k], sbi, BarcodeCode{0, codes[k]}, 0, 0, qx[k]);
+        return;
+    }
+
+    with_barcode_table(sbi, [&](auto const & table) {
+        with_barcode_length(sbi.bcLength, sbi.specializedKernels, [&](auto bcLength) {
+            for (unsigned k = 0; k < n; k += RETRIEVE_BLOCK_SIZE)
+                retrieveBlock(bx + k, status + k, sbi, table, codes + k, qx + k, std::min(RETRIEVE_BLOCK_SIZE, n - k), bcLength);
+        });
+    });
+}
+
+BarcodeStatus retrieve(std::vector<seqan::DnaString> & bx, BarcodeIndex & sbi, seqan::Dna5String & rx, seqan::CharString & qx)
+{
+    // Find N positions in the barcode.
+    typename Iterator<Dna5String, Rooted>::Type it = begin(rx);
+    typename Iterator<Dna5String, Rooted>::Type itEnd = end(rx);
+    unsigned numN = 0;
+    unsigned posN = 0;
+    BarcodeCode code = {0, 0};
+    for (; it != itEnd; ++it)
+    {
+        code.hi = (code.hi << 2) | (code.lo >> 62);
+        if (*it == 'N')
+        {
+            if (numN == 0)
+                posN = position(it);
+            ++numN;
+            code.lo <<= 2;
+        }
+        else
+        {
+            code.lo = (code.lo << 2) | ordValue(*it);
+        }
+    }
+
+    return retrieve(bx, sbi, code, numN, posN, toCString(qx));
 }
@@ -1,43 +1,299 @@
 #ifndef BARCODE_INDEX_H_
 #define BARCODE_INDEX_H_
 
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <vector>
 #include <sdsl/bit_vectors.hpp>
 #include <seqan/sequence.h>
 
+#include "command_line_parsing.h"
+#include "sparse_index.h"
+#include "two_error_index.h"
+
 // -----------------------------------------------------------------------------
 // Succinct barcode index
 // -----------------------------------------------------------------------------
 
 
+// Read-only views of the tables used for lookups. They point either into the sdsl vectors
+// of an index built or loaded in memory or into a memory-mapped index file.
+
+// Bit vector with bit i at bit i % 64 of word i / 64 as in sdsl::bit_vector.
+struct BitTable
+{
+    uint64_t const * words;
+    uint64_t length;
+
+    BitTable() : words(NULL), length(0) {}
+
+    inline bool operator[](uint64_t i) const
+    {
+        return (words[i >> 6] >> (i & 63)) & 1;
+    }
+
+    inline uint64_t const * data() const { return words; }
+    inline uint64_t size() const { return length; }
+};
+
+// Rank support in the layout of sdsl::rank_support_v. For each superblock of 512 bits, one
+// word holds the number of ones before the superblock and one word the 9-bit counts of ones
+// before its second to eighth word, the count before word j at bits 63 - 9j to 71 - 9j.
+struct RankTable
+{
+    uint64_t const * blocks;
+    uint64_t const * words;
+
+    RankTable() : blocks(NULL), words(NULL) {}
+
+    // Number of ones before position i.
+    inline uint64_t operator()(uint64_t i) const
+    {
+        uint64_t const * block = blocks + ((i >> 9) << 1);
+        uint64_t rank = block[0] + ((block[1] >> (63 - 9 * ((i >> 6) & 7))) & 0x1ff);
+        return rank + sdsl::bits::cnt(words[i >> 6] & ((static_cast<uint64_t>(1) << (i & 63)) - 1));
+    }
+
+    // Prefetches the superblock counts of position i.
+    inline void prefetch(uint64_t i) const { __builtin_prefetch(blocks + ((i >> 9) << 1)); }
+};
+
+// Vector of fixed-width integers packed as in sdsl::int_vector<>.
+struct PackedTable
+{
+    uint64_t const * words;
+    uint64_t length;
+    unsigned bits;
+    uint64_t mask;
+
+    PackedTable() : words(NULL), length(0), bits(0), mask(0) {}
+
+    inline uint64_t operator[](uint64_t i) const
+    {
+        uint64_t pos = i * bits;
+        uint64_t const * w = words + (pos >> 6);
+        unsigned offset = pos & 63;
+        uint64_t value = w[0] >> offset;
+        if (offset + bits > 64)
+            value |= w[1] << (64 - offset);
+        return value & mask;
+    }
+
+    inline uint64_t const * data() const { return words; }
+    inline uint64_t size() const { return length; }
+    inline unsigned width() const { return bits; }
+};
+
+// Barcode table of the dense index as a plain bit vector with rank support.
+struct PlainBarcodeTable
+{
+    BitTable const & bits;
+    RankTable const & ranks;
+
+    PlainBarcodeTable(BitTable const & bits, RankTable const & ranks) : bits(bits), ranks(ranks) {}
+
+    inline bool is_set(uint64_t h) const { return bits[h]; }
+    inline uint64_t rank(uint64_t h) const { return ranks(h); }
+    inline void prefetch(uint64_t h) const { __builtin_prefetch(bits.words + (h >> 6)); }
+    inline void prefetch_rank(uint64_t h) const { ranks.prefetch(h); }
+};
+
+// Barcode table of the dense index as a compressed sdsl bit vector (sd_vector, rrr_vector or
+// hyb_vector) with its rank support. The rank support points to the vector, thus the table
+// is neither copied nor moved. Memory accesses are not prefetched as they depend on each other.
+template <typename TVector>
+struct CompressedBarcodeTable
+{
+    TVector vector;
+    typename TVector::rank_1_type rank_support;
+
+    explicit CompressedBarcodeTable(sdsl::bit_vector const & plain) : vector(plain), rank_support(&vector) {}
+    CompressedBarcodeTable(CompressedBarcodeTable const &) = delete;
+    CompressedBarcodeTable & operator=(CompressedBarcodeTable const &) = delete;
+
+    inline bool is_set(uint64_t h) const { return vector[h]; }
+    inline uint64_t rank(uint64_t h) const { return rank_support(h); }
+    inline void prefetch(uint64_t /*h*/) const {}
+    inline void prefetch_rank(uint64_t /*h*/) const {}
+};
+
+// Barcode table and match table of the dense index interleaved with their rank support so that
+// the status and the ranks of a code are read from a single cache line. Each line holds the
+// 2-bit statuses of 224 codes (0 = UNRECOGNIZED, 1 = MATCH, 2 = ONE_ERROR) in words 1 to 7 and
+// in word 0 the number of codes with status MATCH or ONE_ERROR (low 32 bits) and of codes with
+// status ONE_ERROR (high 32 bits) before the line, counted from the start of its superblock of
+// 2^24 lines. The counts before each superblock are kept in a separate small table.
+struct InterleavedBarcodeTable
+{
+    static const uint64_t CODES_PER_LINE = 224;
+    static const unsigned LINES_PER_SUPERBLOCK_LOG = 24;
+
+    std::vector<uint64_t> storage;
+    uint64_t * lines;
+    std::vector<uint64_t> superblocks;
+
+    InterleavedBarcodeTable(BitTable const & barcodes, BitTable const & matches);
+    InterleavedBarcodeTable(InterleavedBarcodeTable const &) = delete;
+    InterleavedBarcodeTable & operator=(InterleavedBarcodeTable const &) = delete;
+
+    inline uint64_t const * line(uint64_t h) const { return lines + (h / CODES_PER_LINE) * 8; }
+
+    inline unsigned status(uint64_t h) const
+    {
+        uint64_t j = h % CODES_PER_LINE;
+        return (line(h)[1 + (j >> 5)] >> (2 * (j & 31))) & 3;
+    }
+
+    // Number of codes with status MATCH or ONE_ERROR (rank) and with status ONE_ERROR
+    // (oneErrorRank) before code h.
+    inline void ranks(uint64_t & rank, uint64_t & oneErrorRank, uint64_t h) const
+    {
+        uint64_t b = h / CODES_PER_LINE;
+        uint64_t j = h - b * CODES_PER_LINE;
+        uint64_t const * l = lines + b * 8;
+        uint64_t const * sb = &superblocks[2 * (b >> LINES_PER_SUPERBLOCK_LOG)];
+        rank = sb[0] + (l[0] & 0xffffffff);
+        oneErrorRank = sb[1] + (l[0] >> 32);
+        for (uint64_t w = 1; w <= (j >> 5); ++w)
+        {
+            uint64_t x = l[w];
+            rank += sdsl::bits::cnt((x | (x >> 1)) & 0x5555555555555555ULL);
+            oneErrorRank += sdsl::bits::cnt(x & 0xaaaaaaaaaaaaaaaaULL);
+        }
+        uint64_t x = l[1 + (j >> 5)] & ((static_cast<uint64_t>(1) << (2 * (j & 31))) - 1);
+        rank += sdsl::bits::cnt((x | (x >> 1)) & 0x5555555555555555ULL);
+        oneErrorRank += sdsl::bits::cnt(x & 0xaaaaaaaaaaaaaaaaULL);
+    }
+
+    inline bool is_set(uint64_t h) const { return status(h) != 0; }
+    inline uint64_t rank(uint64_t h) const { uint64_t r, o; ranks(r, o, h); return r; }
+    inline void prefetch(uint64_t h) const { __builtin_prefetch(line(h)); }
+};
+
+// The dense index holds bit tables over all 4^bcLength codes, the sparse index only the
+// whitelisted barcodes and their neighbours (see sparse_index.h).
+enum class IndexEngine
+{
+    DENSE,
+    SPARSE
+};
+
 struct BarcodeIndex
 {
     unsigned numAlts;
     unsigned numAltsBase;
     unsigned bcLength;
-    sdsl::bit_vector barcode_table;
-    sdsl::rank_support_v<> rank_support_barcode_table;
-    sdsl::bit_vector match_table;
-    sdsl::rank_support_v<> rank_support_match_table;
-    sdsl::int_vector<> substitution_table;
-    
-    BarcodeIndex() {}    
+    IndexEngine engine;
+    SparseIndex sparse;
+
+    // Optional second-tier index for barcodes with two substitutions.
+    TwoErrorIndex two_errors;
+
+    // Whether substitution entries hold the position and the base of the whitelisted barcode
+    // as (position << 2 | base) or, in indices of earlier versions, only the position.
+    bool substitutionBases;
+
+    // Whether lookups and builds use the kernels for the barcode length as compile-time
+    // constant if there are any (see with_barcode_length()).
+    bool specializedKernels;
+
+    // Representation of the barcode table used for lookups by the dense index.
+    BarcodeTableType tableType;
+    std::unique_ptr<CompressedBarcodeTable<sdsl::sd_vector<> > > sd_table;
+    std::unique_ptr<CompressedBarcodeTable<sdsl::rrr_vector<> > > rrr_table;
+    std::unique_ptr<CompressedBarcodeTable<sdsl::hyb_vector<> > > hyb_table;
+    std::unique_ptr<InterleavedBarcodeTable> il_table;
+
+    // Tables used by the lookups.
+    BitTable barcode_table;
+    RankTable rank_support_barcode_table;
+    BitTable match_table;
+    RankTable rank_support_match_table;
+    PackedTable substitution_table;
+
+    // Storage of the tables if the index is built in memory or loaded from separate files.
+    sdsl::bit_vector barcode_bits;
+    sdsl::bit_vector match_bits;
+    sdsl::int_vector<> substitution_values;
+    std::vector<uint64_t> barcode_rank;
+    std::vector<uint64_t> match_rank;
+
+    // Storage of the tables if the index is mapped from a single index file.
+    void * mapping;
+    size_t mappingSize;
+
+    BarcodeIndex() : engine(IndexEngine::DENSE), substitutionBases(false), specializedKernels(true), tableType(BarcodeTableType::PLAIN), mapping(NULL), mappingSize(0) {}
     BarcodeIndex(seqan::CharString & filename);
+    BarcodeIndex(BarcodeIndex const &) = delete;
+    BarcodeIndex & operator=(BarcodeIndex const &) = delete;
+    ~BarcodeIndex();
 };
 
 enum class BarcodeStatus {
     UNRECOGNIZED,
     INVALID,
     MATCH,
-    ONE_ERROR
+    ONE_ERROR,
+    TWO_ERRORS
+};
+
+// Maximum number of corrections of a barcode, i.e. the maximum number of alternatives. The
+// largest --alts of 48 is raised to the next power of two.
+const unsigned MAX_CORRECTIONS = 64;
+
+// Corrections of a barcode in a buffer of fixed capacity owned by the caller. Lookups fill it
+// without allocating memory. Corrections with one or two substitutions are ordered by their
+// keys, the sum of the qualities of the read at the substituted positions.
+struct CorrectedBarcodes
+{
+    unsigned size;
+    BarcodeCode codes[MAX_CORRECTIONS];
+    unsigned keys[MAX_CORRECTIONS];
+
+    CorrectedBarcodes() : size(0) {}
 };
 
-void buildIndex(BarcodeIndex & sbi, seqan::CharString & filename, unsigned alternatives);
-void buildSubstitutionTable(BarcodeIndex & sbi, seqan::CharString & filename);
+inline void append_correction(CorrectedBarcodes & bx, BarcodeCode const & code)
+{
+    assert(bx.size < MAX_CORRECTIONS);
+    bx.codes[bx.size] = code;
+    bx.keys[bx.size] = 0;
+    ++bx.size;
+}
+
+// Inserts a correction after all corrections with a key that is not larger.
+inline void insert_correction(CorrectedBarcodes & bx, BarcodeCode const & code, unsigned key)
+{
+    assert(bx.size < MAX_CORRECTIONS);
+    unsigned k = bx.size++;
+    for (; k > 0 && bx.keys[k - 1] > key; --k)
+    {
+        bx.codes[k] = bx.codes[k - 1];
+        bx.keys[k] = bx.keys[k - 1];
+    }
+    bx.codes[k] = code;
+    bx.keys[k] = key;
+}
+
+void build_rank_table(std::vector<uint64_t> & blocks, uint64_t const * words, uint64_t size, unsigned numThreads = 1);
+void read_whitelist(std::vector<uint64_t> & whitelist, seqan::CharString & filename, unsigned bcLength);
+void buildIndex(BarcodeIndex & sbi, seqan::CharString & filename, unsigned alternatives, unsigned numThreads = 1,
+                bool lowMemory = false);
 int load(BarcodeIndex & sbi, seqan::CharString & filename);
-void write(seqan::CharString & filename, BarcodeIndex & sbi);
-void writeBarcodeTable(seqan::CharString & filename, BarcodeIndex & sbi);
-void writeMatchTable(seqan::CharString & filename, BarcodeIndex & sbi);
-void writeSubstitutionTable(seqan::CharString & filename, BarcodeIndex & sbi);
+void select_barcode_table(BarcodeIndex & sbi, BarcodeTableType type);
+void release_plain_barcode_table(BarcodeIndex & sbi);
+uint64_t barcode_table_bytes(BarcodeIndex & sbi);
+char const * barcode_table_name(BarcodeTableType type);
+uint64_t barcode_rank(BarcodeIndex & sbi, BarcodeCode const & code);
+uint64_t barcode_rank(BarcodeIndex & sbi, seqan::DnaString & barcode);
+void whitelisted_codes(std::vector<uint64_t> & codes, BarcodeIndex const & sbi);
+BarcodeStatus retrieve(CorrectedBarcodes & bx, BarcodeIndex & sbi, uint64_t h, unsigned numN, unsigned posN, char const * qx);
+BarcodeStatus retrieve(CorrectedBarcodes & bx, BarcodeIndex & sbi, BarcodeCode const & code, unsigned numN, unsigned posN, char const * qx);
+void append_barcodes(std::vector<seqan::DnaString> & bx, CorrectedBarcodes const & corrected, unsigned bcLength);
+void retrieveBatch(CorrectedBarcodes * bx, BarcodeStatus * status, BarcodeIndex & sbi, uint64_t const * codes, char const * const * qx, unsigned n);
+BarcodeStatus retrieve(std::vector<seqan::DnaString> & bx, BarcodeIndex & sbi, uint64_t h, unsigned numN, unsigned posN, char const * qx);
+BarcodeStatus retrieve(std::vector<seqan::DnaString> & bx, BarcodeIndex & sbi, BarcodeCode const & code, unsigned numN, unsigned posN, char const * qx);
 BarcodeStatus retrieve(std::vector<seqan::DnaString> & bx, BarcodeIndex & sbi, seqan::DnaString & rx, seqan::CharString & qx);
 BarcodeStatus retrieve(std::vector<seqan::DnaString> & bx, BarcodeIndex & sbi, seqan::Dna5String & rx, seqan::CharString & qx);
 
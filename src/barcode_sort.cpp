@@ -0,0 +1,299 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdlib.h>
+#include <unistd.h>
+#include <seqan/stream.h>
+
+#include "barcode_sort.h"
+#include "utils.h"
+
+using namespace seqan;
+
+// Size of the key and length that precede each sort record.
+const size_t SORT_RECORD_HEADER = 12;
+
+// Initial memory for the records of a run. The buffers grow geometrically up to the budget.
+const size_t MIN_SORT_BUFFER = (size_t)1 << 20;
+
+BarcodeSorter::BarcodeSorter(unsigned bcLength, size_t maxMemory, std::string const & tmpDir) :
+    bcLength(bcLength), maxMemory(maxMemory), tmpDir(tmpDir), numRecords(0), next(0)
+{}
+
+BarcodeSorter::~BarcodeSorter()
+{
+    for (SortedRun & run : runs)
+        close(run.fd);
+}
+
+// ---------------------------------------------------------------------------------------
+// Encoding and decoding of sort records
+// ---------------------------------------------------------------------------------------
+
+template <typename TValue>
+inline void append_value(OutputBuffer & out, TValue const & value)
+{
+    out.append(reinterpret_cast<char const *>(&value), sizeof(TValue));
+}
+
+template <typename TValue>
+inline TValue read_value(char const * & p)
+{
+    TValue value;
+    std::memcpy(&value, p, sizeof(TValue));
+    p += sizeof(TValue);
+    return value;
+}
+
+uint64_t sort_key(BarcodeIndex & sbi, std::vector<BarcodeCode> const & barcodes)
+{
+    if (barcodes.size() == 0)
+        return 0;
+    return barcode_rank(sbi, barcodes[0]) + 1;
+}
+
+void append_sort_record(OutputBuffer & out, uint64_t key, ReadRecord const & read1, ReadRecord const & read2, std::vector<BarcodeCode> const & barcodes)
+{
+    size_t start = out.size;
+    append_value(out, key);
+    append_value(out, (uint32_t)0);
+
+    append_value(out, (uint8_t)barcodes.size());
+    for (BarcodeCode const & code : barcodes)
+    {
+        append_value(out, code.hi);
+        append_value(out, code.lo);
+    }
+
+    uint32_t lengths[5] = {(uint32_t)read1.name.size(), (uint32_t)read1.seq.size(), (uint32_t)read1.qual.size(),
+                           (uint32_t)read2.seq.size(), (uint32_t)read2.qual.size()};
+    out.append(reinterpret_cast<char const *>(lengths), sizeof(lengths));
+    out.append(read1.name);
+    out.append(read1.seq);
+    out.append(read1.qual);
+    out.append(read2.seq);
+    out.append(read2.qual);
+
+    uint32_t length = out.size - start - SORT_RECORD_HEADER;
+    std::memcpy(&out.data[start + sizeof(uint64_t)], &length, sizeof(length));
+}
+
+// Decodes the record that follows the key and length.
+void decode_sort_record(ReadRecord & read1, ReadRecord & read2, std::vector<BarcodeCode> & barcodes, char const * p)
+{
+    unsigned numBarcodes = read_value<uint8_t>(p);
+    barcodes.clear();
+    for (unsigned i = 0; i < numBarcodes; ++i)
+    {
+        BarcodeCode code;
+        code.hi = read_value<uint64_t>(p);
+        code.lo = read_value<uint64_t>(p);
+        barcodes.push_back(code);
+    }
+
+    uint32_t lengths[5];
+    for (unsigned i = 0; i < 5; ++i)
+        lengths[i] = read_value<uint32_t>(p);
+    read1.name.assign(p, lengths[0]);
+    p += lengths[0];
+    read1.seq.assign(p, lengths[1]);
+    p += lengths[1];
+    read1.qual.assign(p, lengths[2]);
+    p += lengths[2];
+    read2.seq.assign(p, lengths[3]);
+    p += lengths[3];
+    read2.qual.assign(p, lengths[4]);
+}
+
+// ---------------------------------------------------------------------------------------
+// Sorted runs
+// ---------------------------------------------------------------------------------------
+
+// Creates a temporary file that is removed as soon as it is closed.
+int open_tmp_file(std::string const & tmpDir)
+{
+    std::string pattern = tmpDir + "/bcctools_sort_XXXXXX";
+    std::vector<char> filename(pattern.begin(), pattern.end());
+    filename.push_back('\0');
+    int fd = mkstemp(&filename[0]);
+    if (fd < 0)
+    {
+        std::ostringstream what;
+        what << "Cannot create temporary file in '" << tmpDir << "': " << std::strerror(errno);
+        SEQAN_THROW(IOError(what.str()));
+    }
+    unlink(&filename[0]);
+    return fd;
+}
+
+// Sorts the records in memory. Offsets increase in input order, thus sorting by
+// (key, offset) keeps read pairs with the same key in input order.
+inline void sort_keys(BarcodeSorter & sorter)
+{
+    std::sort(sorter.keys.begin(), sorter.keys.end());
+}
+
+void write_run(BarcodeSorter & sorter)
+{
+    if (sorter.keys.empty())
+        return;
+    sort_keys(sorter);
+
+    SortedRun run;
+    run.fd = open_tmp_file(sorter.tmpDir);
+    sorter.runs.push_back(run);
+
+    OutputBuffer out(run.fd);
+    for (auto const & key : sorter.keys)
+    {
+        char const * record = &sorter.records[key.second];
+        uint32_t length;
+        std::memcpy(&length, record + sizeof(uint64_t), sizeof(length));
+        out.append(record, SORT_RECORD_HEADER + length);
+    }
+    out.flush();
+
+    sorter.records.clear();
+    sorter.keys.clear();
+}
+
+// Makes sure that the next n bytes of the run are in its buffer. Returns false at the end of the run.
+bool fill_run(SortedRun & run, size_t n)
+{
+    if (run.end - run.begin >= n)
+        return true;
+
+    std::memmove(&run.buffer[0], &run.buffer[run.begin], run.end - run.begin);
+    run.end -= run.begin;
+    run.begin = 0;
+    if (run.buffer.size() < n)
+        run.buffer.resize(n);
+
+    while (run.end < run.buffer.size())
+    {
+        ssize_t bytes = ::read(run.fd, &run.buffer[run.end], run.buffer.size() - run.end);
+        if (bytes < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            SEQAN_THROW(IOError("Reading temporary file failed."));
+        }
+        if (bytes == 0)
+            break;
+        run.end += bytes;
+    }
+    return run.end >= n;
+}
+
+inline uint64_t peek_key(SortedRun const & run)
+{
+    uint64_t key;
+    std::memcpy(&key, &run.buffer[run.begin], sizeof(key));
+    return key;
+}
+
+// ---------------------------------------------------------------------------------------
+// Functions add_sort_records(), finish_sort() and next_sorted()
+// ---------------------------------------------------------------------------------------
+
+// Adds the sort records of a batch. Writes a sorted run whenever the memory budget is exhausted.
+void add_sort_records(BarcodeSorter & sorter, OutputBuffer const & in)
+{
+    size_t pos = 0;
+    while (pos < in.size)
+    {
+        char const * record = &in.data[pos];
+        uint64_t key;
+        uint32_t length;
+        std::memcpy(&key, record, sizeof(key));
+        std::memcpy(&length, record + sizeof(key), sizeof(length));
+        size_t size = SORT_RECORD_HEADER + length;
+
+        // Split the budget between the records and the keys to sort them by. A record that
+        // exceeds the budget alone forms a run of its own.
+        size_t recordBudget = sorter.maxMemory / 8 * 7;
+        size_t keyBudget = std::max(sorter.maxMemory / 8 / sizeof(sorter.keys[0]), (size_t)1);
+        if (!sorter.keys.empty() && (sorter.records.size() + size > recordBudget || sorter.keys.size() == keyBudget))
+            write_run(sorter);
+
+        // Grow the buffers geometrically, but not beyond the budget.
+        if (sorter.records.size() + size > sorter.records.capacity())
+        {
+            size_t capacity = std::max(std::max(2 * sorter.records.capacity(), MIN_SORT_BUFFER), sorter.records.size() + size);
+            sorter.records.reserve(std::min(capacity, std::max(recordBudget, sorter.records.size() + size)));
+        }
+        if (sorter.keys.size() == sorter.keys.capacity())
+        {
+            size_t capacity = std::max(2 * sorter.keys.capacity(), MIN_SORT_BUFFER / 8 / sizeof(sorter.keys[0]));
+            sorter.keys.reserve(std::min(capacity, keyBudget));
+        }
+
+        sorter.keys.push_back(std::make_pair(key, (uint64_t)sorter.records.size()));
+        sorter.records.insert(sorter.records.end(), record, record + size);
+        ++sorter.numRecords;
+        pos += size;
+    }
+}
+
+// Prepares iterating the records in sorted order. Records stay in memory if they fit into a single run.
+void finish_sort(BarcodeSorter & sorter)
+{
+    if (sorter.runs.empty())
+    {
+        sort_keys(sorter);
+        sorter.next = 0;
+        return;
+    }
+
+    write_run(sorter);
+    std::vector<char>().swap(sorter.records);
+    std::vector<std::pair<uint64_t, uint64_t> >().swap(sorter.keys);
+
+    std::ostringstream msg;
+    msg << "Merging " << sorter.runs.size() << " sorted runs of " << sorter.numRecords << " read pairs.";
+    printInfo(msg);
+
+    // Share the memory budget among the read buffers of the runs.
+    size_t bufferSize = std::min(std::max(sorter.maxMemory / sorter.runs.size(), (size_t)1 << 16), (size_t)1 << 24);
+    for (unsigned i = 0; i < sorter.runs.size(); ++i)
+    {
+        SortedRun & run = sorter.runs[i];
+        if (lseek(run.fd, 0, SEEK_SET) < 0)
+            SEQAN_THROW(IOError("Rewinding temporary file failed."));
+        run.buffer.resize(bufferSize);
+        if (fill_run(run, SORT_RECORD_HEADER))
+            sorter.heap.push(std::make_pair(peek_key(run), i));
+    }
+}
+
+// Returns the next read pair in sorted order or false if all read pairs have been returned.
+bool next_sorted(BarcodeSorter & sorter, ReadRecord & read1, ReadRecord & read2, std::vector<BarcodeCode> & barcodes)
+{
+    // All records in memory.
+    if (sorter.runs.empty())
+    {
+        if (sorter.next == sorter.keys.size())
+            return false;
+        char const * record = &sorter.records[sorter.keys[sorter.next++].second];
+        decode_sort_record(read1, read2, barcodes, record + SORT_RECORD_HEADER);
+        return true;
+    }
+
+    // K-way merge of the runs. Ties are broken by the run index, which keeps the input order.
+    if (sorter.heap.empty())
+        return false;
+    unsigned i = sorter.heap.top().second;
+    sorter.heap.pop();
+
+    SortedRun & run = sorter.runs[i];
+    uint32_t length;
+    std::memcpy(&length, &run.buffer[run.begin + sizeof(uint64_t)], sizeof(length));
+    if (!fill_run(run, SORT_RECORD_HEADER + length))
+        SEQAN_THROW(IOError("Temporary file is truncated."));
+    decode_sort_record(read1, read2, barcodes, &run.buffer[run.begin + SORT_RECORD_HEADER]);
+    run.begin += SORT_RECORD_HEADER + length;
+
+    if (fill_run(run, SORT_RECORD_HEADER))
+        sorter.heap.push(std::make_pair(peek_key(run), i));
+    return true;
+}
@@ -0,0 +1,70 @@
+#ifndef BARCODE_SORT_H_
+#define BARCODE_SORT_H_
+
+#include <cstdint>
+#include <queue>
+#include <string>
+#include <vector>
+#include <seqan/sequence.h>
+
+#include "barcode_index.h"
+#include "correct.h"
+#include "output_buffer.h"
+
+// -----------------------------------------------------------------------------
+// External merge sort of read pairs by corrected barcode
+// -----------------------------------------------------------------------------
+
+// Read pairs are sorted by the whitelist rank of their first corrected barcode (see
+// barcode_rank()), which is the lexicographical order of the barcodes. Read
+// pairs without a corrected barcode come first. Read pairs with the same key keep their
+// input order.
+//
+// A sort record is a 64 bit key and a 32 bit length followed by the number of corrected
+// barcodes, their 128-bit codes, the lengths of the five strings and the read name, sequences
+// and qualities. Records are collected in memory and written as sorted runs to unlinked
+// temporary files whenever the memory budget is exhausted. The runs are then merged.
+
+// Reader of a sorted run file.
+struct SortedRun
+{
+    int fd;
+    std::vector<char> buffer;
+    size_t begin;
+    size_t end;
+
+    SortedRun() : fd(-1), begin(0), end(0) {}
+};
+
+struct BarcodeSorter
+{
+    unsigned bcLength;
+    size_t maxMemory;
+    std::string tmpDir;
+
+    // Records of the current run and (key, offset) pairs to sort them by.
+    std::vector<char> records;
+    std::vector<std::pair<uint64_t, uint64_t> > keys;
+    uint64_t numRecords;
+
+    // State for merging the runs or for iterating a single run in memory.
+    std::vector<SortedRun> runs;
+    std::priority_queue<std::pair<uint64_t, unsigned>,
+                        std::vector<std::pair<uint64_t, unsigned> >,
+                        std::greater<std::pair<uint64_t, unsigned> > > heap;
+    size_t next;
+
+    BarcodeSorter(unsigned bcLength, size_t maxMemory, std::string const & tmpDir);
+    ~BarcodeSorter();
+};
+
+uint64_t sort_key(BarcodeIndex & sbi, std::vector<BarcodeCode> const & barcodes);
+void append_sort_record(OutputBuffer & out, uint64_t key, ReadRecord const & read1, ReadRecord const & read2, std::vector<BarcodeCode> const & barcodes);
+
+int open_tmp_file(std::string const & tmpDir);
+
+void add_sort_records(BarcodeSorter & sorter, OutputBuffer const & in);
+void finish_sort(BarcodeSorter & sorter);
+bool next_sorted(BarcodeSorter & sorter, ReadRecord & read1, ReadRecord & read2, std::vector<BarcodeCode> & barcodes);
+
+#endif  // BARCODE_SORT_H_
@@ -8,6 +8,11 @@
 #include "barcode_index.h"
 #include "stats.h"
 #include "deduplicate.h"
+#include "correct.h"
+#include "count_table.h"
+#include "index_file.h"
+#include "benchmark.h"
+#include "numa.h"
 
 using namespace seqan;
 
@@ -25,6 +30,7 @@ void printHelp(char const * name)
     std::cerr << "    \033[1mcorrect\033[0m   Cuts off the barcodes in a pair of FASTQ files and corrects them using a barcode whitelist." << std::endl;
     std::cerr << "    \033[1mstats\033[0m     Computes barcode statistics for the given TSV/FASTQ/SAM/BAM file." << std::endl;
     std::cerr << "    \033[1mdedup\033[0m     Marks optical and/or PCR duplicates within sets of reads labeled with the same barcode." << std::endl;
+    std::cerr << "    \033[1mbench\033[0m     Measures the barcode lookup throughput of the barcode index." << std::endl;
     std::cerr << std::endl;
     std::cerr << "\033[1mVERSION\033[0m" << std::endl;
     std::cerr << "    " << name << " version: " << VERSION << std::endl;
@@ -34,164 +40,200 @@ void printHelp(char const * name)
     std::cerr << std::endl;
 }
 
-void count_corrected_pair(BarcodeStatus s, unsigned & match, unsigned & one_error, unsigned & unrecognized, unsigned & invalid)
+inline void append_string(OutputBuffer & out, Dna5String const & str)
 {
-    switch (s)
-    {
-        case BarcodeStatus::MATCH:
-            ++match; return;
-        case BarcodeStatus::ONE_ERROR:
-            ++one_error; return;
-        case BarcodeStatus::UNRECOGNIZED:
-            ++unrecognized; return;
-        case BarcodeStatus::INVALID:
-            ++invalid; return;
-    }
+    for (unsigned i = 0; i < length(str); ++i)
+        out.append("ACGTN"[ordValue(str[i])]);
 }
 
-void print_correction_stats(unsigned match, unsigned one_error, unsigned unrecognized, unsigned invalid)
+inline void append_string(OutputBuffer & out, CharString const & str)
 {
-    std::cerr << "Stats:" << std::endl;
-    std::cerr << "  Whitelisted barcodes:    " << match << std::endl;
-    std::cerr << "  Corrected barcodes:  " << one_error << std::endl;
-    std::cerr << "  Unrecognized barcodes:   " << unrecognized << std::endl;
-    if (invalid > 0)
-        std::cerr << "  Barcodes invalid:       " << invalid << std::endl;
+    if (length(str) > 0)
+        out.append(&str[0], length(str));
 }
 
-void write_tsv(const ReadPair & rp)
+void write_tsv(OutputBuffer & out, const ReadPair & rp)
 {
     // Field 1: Read name (ID).
-    std::cout << rp.qname;
+    append_string(out, rp.qname);
 
     // Field 2: Corrected barcode or '*' if none.
+    out.append('\t');
     if (rp.cBarcode.size() != 0)
     {
-        std::cout << "\t" << rp.cBarcode[0];
+        append_barcode(out, rp.cBarcode[0]);
         for (unsigned i = 1; i < rp.cBarcode.size(); ++i)
-            std::cout << "," << rp.cBarcode[i];
+        {
+            out.append(',');
+            append_barcode(out, rp.cBarcode[i]);
+        }
     }
     else
-        std::cout << "\t" << "*";
+        out.append('*');
 
     // Field 3 and 4: Raw barcode and spacer sequence.
-    std::cout << "\t" << rp.rBarcode;
-    std::cout << "\t" << rp.spacer;
+    out.append('\t');
+    append_string(out, rp.rBarcode);
+    out.append('\t');
+    append_string(out, rp.spacer);
 
     // Field 5 and 6: Sequence of first and second read.
-    std::cout << "\t" << rp.read1;
-    std::cout << "\t" << rp.read2;
+    out.append('\t');
+    append_string(out, rp.read1);
+    out.append('\t');
+    append_string(out, rp.read2);
 
     // Field 7 and 8: Barcode and spacer qual.
-    std::cout << "\t" << rp.qBarcode;
-    std::cout << "\t" << rp.qSpacer;
+    out.append('\t');
+    append_string(out, rp.qBarcode);
+    out.append('\t');
+    append_string(out, rp.qSpacer);
 
     // Field 9 and 10: Quality string of first and second read.
-    std::cout << "\t" << rp.qual1;
-    std::cout << "\t" << rp.qual2;
+    out.append('\t');
+    append_string(out, rp.qual1);
+    out.append('\t');
+    append_string(out, rp.qual2);
 
     // Field 11: Duplicate status.
-    std::cout << "\t";
+    out.append('\t');
     if (rp.isDup)
-        std::cout << "dup";
+        out.append("dup", 3);
     else
-        std::cout << ".";
+        out.append('.');
 
-    std::cout << std::endl;
+    out.append('\n');
 }
 
-void write_tsv(kseq_t * seq1, kseq_t * seq2, std::vector<seqan::DnaString> & barcodeCorrected, unsigned bcLength, int spacerLength)
+// Reports where sampling stopped and how many barcodes may be misclassified.
+void report_sample(WhitelistSample const & sample)
 {
-    // Field 1: Read name (ID).
-    std::cout << seq1->name.s;
+    std::ostringstream msg;
+    if (sample.exhausted)
+        msg << "Counted all " << sample.numReads << " reads in " << sample.numSamples << " samples.";
+    else
+        msg << "Stopped after " << sample.numReads << " reads (" << sample.numSamples << " samples), cutoff per read changed by "
+            << 100 * sample.cutoffChange << "% and barcodes above the cutoff by " << 100 * sample.aboveChange << "% since the previous sample.";
+    printInfo(msg);
 
-    // Field 2: Corrected barcode or '*' if none.
-    if (barcodeCorrected.size() != 0)
+    if (!sample.exhausted)
     {
-        std::cout << "\t" << barcodeCorrected[0];
-        for (unsigned i = 1; i < barcodeCorrected.size(); ++i)
-            std::cout << "," << barcodeCorrected[i];
+        std::ostringstream error;
+        error << "Estimated error: " << sample.numBoundary << " barcodes with " << sample.boundaryFirst << " to "
+              << sample.boundaryLast << " occurrences in the sample are within the sampling noise of the cutoff.";
+        printInfo(error);
     }
-    else
-        std::cout << "\t" << "*";
-
-    // Field 3 and 4: Raw barcode and spacer sequence.
-    std::cout << "\t";
-    for (unsigned i = 0; i < bcLength; ++i)
-        std::cout << seq1->seq.s[i];
-    std::cout << "\t";
-    for (unsigned i = bcLength; i < bcLength + spacerLength; ++i)
-        std::cout << seq1->seq.s[i];
-
-    // Field 5 and 6: Sequence of first and second read.
-    std::cout << "\t";
-    for (unsigned i = bcLength + spacerLength; i < strlen(seq1->seq.s); ++i)
-        std::cout << seq1->seq.s[i];
-    std::cout << "\t" << seq2->seq.s;
-
-    // Field 7 and 8: Barcode and spacer qual.
-    std::cout << "\t";
-    for (unsigned i = 0; i < bcLength; ++i)
-        std::cout << seq1->qual.s[i];
-    std::cout << "\t";
-    for (unsigned i = bcLength; i < bcLength + spacerLength; ++i)
-        std::cout << seq1->qual.s[i];
-
-    // Field 9 and 10: Quality string of first and second read.
-    std::cout << "\t";
-    for (unsigned i = bcLength + spacerLength; i < strlen(seq1->qual.s); ++i)
-        std::cout << seq1->qual.s[i];
-    std::cout << "\t" << seq2->qual.s;
-
-    std::cout << std::endl;
 }
 
 int infer_whitelist(Options & options)
 {
-    // Open the input FASTQ file.
-    printStatus("Opening FASTQ file");
-    gzFile fp1 = gzopen(toCString(options.fastqFile1), "r");
-    kseq_t * seq1 = kseq_init(fp1);
-    printDone();
+    std::vector<std::unique_ptr<BarcodeCounter> > shards;
+    WhitelistSample sample;
+    std::vector<unsigned> allHist;
+    std::vector<unsigned> wlHist;
+    uint64_t numReads = 0;
 
-    // Initialize counts table.
-    std::vector<uint16_t> count_per_barcode;
-    resize(count_per_barcode, (uint64_t)1 << (2*options.bcLength), 0);
+    bool countTable = is_count_table(options.fastqFile1);
+    if (countTable)
+    {
+        if (options.sampleWhitelist)
+        {
+            std::cerr << "ERROR: Sampling (--sample) requires a FASTQ file, not a count table." << std::endl;
+            return 1;
+        }
+
+        // Merge the records of the count table like a sorted run of a single shard.
+        printStatus("Opening barcode count table");
+        CountTableHeader header;
+        shards.emplace_back(new BarcodeCounter(options.bcLength, options.maxMemory, toCString(options.tmpDir)));
+        add_count_table(*shards[0], header, toCString(options.fastqFile1));
+        printDone();
+
+        options.bcLength = header.bcLength;
+        numReads = header.numReads;
+        std::ostringstream msg;
+        msg << "Count table has " << header.numBarcodes << " distinct barcodes of length " << header.bcLength << " in "
+            << header.numReads << (header.sampled ? " sampled" : "") << " reads.";
+        printInfo(msg);
+    }
+
+    // Load the given whitelist once for the histograms and the intersection.
+    std::vector<uint64_t> whitelist;
+    if (options.whitelistFile != "")
+    {
+        bool fromIndex = load_whitelist_codes(whitelist, options.whitelistFile, options.bcLength);
+        std::ostringstream msg;
+        msg << "Whitelist has " << whitelist.size() << " barcodes of length " << options.bcLength
+            << (fromIndex ? " (taken from its index file)." : ".");
+        printInfo(msg);
+    }
 
-    // Iterate the FASTQ records and count barcodes.
-    printStatus("Counting barcodes");
-    while (kseq_read(seq1) >= 0)
+    if (!countTable)
     {
-        Dna5String rx = prefix(seq1->seq.s, options.bcLength);
-        typename Iterator<Dna5String, Rooted>::Type it = begin(rx);
-        typename Iterator<Dna5String, Rooted>::Type itEnd = end(rx);
-        bool hasN = false;
-        for (; it != itEnd; ++it)
+        // Open the input FASTQ file.
+        printStatus("Opening FASTQ file");
+        FastqReader reader;
+        open_fastq_reader(reader, toCString(options.fastqFile1), READ_PAIRS_PER_BATCH, options.numThreads);
+        printDone();
+
+        // Initialize a counts table per thread that share the memory budget.
+        for (unsigned t = 0; t < options.numThreads; ++t)
+            shards.emplace_back(new BarcodeCounter(options.bcLength, options.maxMemory / options.numThreads, toCString(options.tmpDir)));
+
+        // Iterate the FASTQ records and count barcodes, or only a prefix of them until the
+        // inferred cutoff is stable.
+        if (options.sampleWhitelist)
         {
-            if (*it == 'N')
+            printInfo("Counting barcodes of growing samples until the cutoff is stable.");
+            sample_barcodes(sample, allHist, wlHist, shards, reader, whitelist, options.bcLength, options.numThreads,
+                            options.sampleTolerance);
+            report_sample(sample);
+            numReads = sample.numReads;
+            if (options.refineBoundary && !sample.exhausted && sample.numBoundary != 0)
             {
-                hasN = true;
-                break;
+                printStatus("Counting boundary barcodes in the rest of the input");
+                refine_boundary(sample, shards, reader, options.bcLength, options.numThreads);
+                printDone();
+
+                std::ostringstream msg;
+                msg << "Input has " << sample.totalReads << " reads, cutoff for the " << sample.boundary.size()
+                    << " boundary barcodes scaled to " << sample.fullCutoff << ".";
+                printInfo(msg);
             }
         }
-        if (hasN == false)
+        else
         {
-            DnaString rrx = rx;
-            uint64_t h = hash(rrx);
-            if (count_per_barcode[h] != maxValue<uint16_t>())
-                ++count_per_barcode[h];
+            printStatus("Counting barcodes");
+            numReads = count_barcodes(shards, reader, options.bcLength);
+            printDone();
         }
+
+        // Cleanup and close all files.
+        close_fastq_reader(reader);
     }
-    printDone();
 
-    // Cleanup and close all files.
-    kseq_destroy(seq1);
-    gzclose(fp1);
+    // Write the counts for later runs of the whitelist, correct and stats commands.
+    if (options.countTableFile != "")
+    {
+        printStatus("Writing barcode count table");
+        write_count_table(toCString(options.countTableFile), shards, options.bcLength, numReads, options.sampleWhitelist,
+                          options.numThreads);
+        printDone();
+    }
+
+    size_t numRuns = 0;
+    for (auto const & shard : shards)
+        numRuns += shard->runs.size();
+    if (numRuns != 0)
+    {
+        std::ostringstream msg;
+        msg << "Merging " << numRuns << " sorted runs of barcode counts.";
+        printInfo(msg);
+    }
 
     // Make histogram of all barcode counts and, optionally, of whitelisted barcode counts.
-    std::vector<unsigned> allHist;
-    std::vector<unsigned> wlHist;
-    make_histograms(allHist, wlHist, count_per_barcode, options.whitelistFile, options.bcLength);
+    if (!options.sampleWhitelist)
+        make_histograms(allHist, wlHist, shards, whitelist, options.bcLength, options.numThreads);
 
     // Write the histograms to file.
     printStatus("Writing histograms of barcodes");
@@ -207,29 +249,43 @@ int infer_whitelist(Options & options)
     printDone();
 
     // Infer cutoff for whitelisting a barcode.
-    if (options.whitelistCutoff == 0)
+    if (options.sampleWhitelist)
+        options.whitelistCutoff = sample.cutoff;
+    else if (options.whitelistCutoff == 0)
         options.whitelistCutoff = infer_cutoff(allHist, wlHist);
 
     std::ostringstream msg;
     msg << "Minimum number of barcode occurences set to '" << options.whitelistCutoff << "'.";
     printInfo(msg);
 
-    // Write the whitelist to file.
+    // Write the whitelist to file, optionally only the inferred barcodes that are in the given
+    // whitelist.
     printStatus("Writing whitelist of barcodes");
+    std::function<bool(uint64_t, uint32_t)> inferred;
+    if (options.sampleWhitelist)
+        inferred = [&](uint64_t code, uint32_t count) { return whitelisted_in_sample(sample, code, count); };
+    else
+        inferred = [&](uint64_t, uint32_t count) { return count >= options.whitelistCutoff; };
     std::ofstream outFile(toCString(options.outFile));
-    for (uint64_t i = 0; i < count_per_barcode.size(); ++i)
+    uint64_t numWhitelisted;
+    if (options.intersectWhitelist)
     {
-        if (count_per_barcode[i] >= options.whitelistCutoff)
-        {
-            DnaString bc = unhash(i, options.bcLength);
-            double e = entropy(bc);
-            if (e >= options.minEntropy)
-                outFile << bc << std::endl;
-        }
+        numWhitelisted = write_whitelist(outFile, shards, options.bcLength, [&](uint64_t code, uint32_t count) {
+            return inferred(code, count) && std::binary_search(whitelist.begin(), whitelist.end(), code);
+        }, options.minEntropy, options.numThreads);
+    }
+    else
+    {
+        numWhitelisted = write_whitelist(outFile, shards, options.bcLength, inferred, options.minEntropy, options.numThreads);
     }
     outFile.close();
     printDone();
 
+    msg.str("");
+    msg << "Wrote " << numWhitelisted << " barcodes" << (options.intersectWhitelist ? " that are in the given whitelist" : "")
+        << " to '" << options.outFile << "'.";
+    printInfo(msg);
+
     return 0;
 }
 
@@ -238,74 +294,180 @@ int index(Options & options)
     BarcodeIndex sbi(options.whitelistFile);
 
     // Build the barcode index.
-    buildIndex(sbi, options.whitelistFile, options.numAlts);
+    if (options.benchBuild)
+    {
+        if (!benchmark_build(sbi, options.whitelistFile, options.numAlts, options.numThreads, options.lowMemory))
+        {
+            std::cerr << "ERROR: Index builds with different numbers of threads differ." << std::endl;
+            return 1;
+        }
+    }
+    else
+    {
+        buildIndex(sbi, options.whitelistFile, options.numAlts, options.numThreads, options.lowMemory);
+    }
 
-    // Write the index to files.
-    writeBarcodeTable(options.whitelistFile, sbi);
-    writeMatchTable(options.whitelistFile, sbi);
-    writeSubstitutionTable(options.whitelistFile, sbi);
+    // Write the index to a single file.
+    write_index_file(index_filename(options.whitelistFile), sbi);
 
     return 0;
 }
 
-int correct(Options & options)
+void load_or_build_index(BarcodeIndex & sbi, Options & options, bool privateMemory = false)
 {
-    BarcodeIndex sbi(options.whitelistFile);
-
+    std::string indexFilename = index_filename(options.whitelistFile);
     CharString bcFilename = options.whitelistFile;
     bcFilename += ".bc";
-    if (!fileExists(bcFilename))
+    if (fileExists(indexFilename.c_str()))
     {
-        // Build the barcode index.
-        buildIndex(sbi, options.whitelistFile, options.numAlts);
+        // Map the barcode index file.
+        map_index_file(sbi, indexFilename, options.hugePages || privateMemory);
+        if (options.verifyIndex)
+            verify_index_file(sbi);
     }
-    else
+    else if (fileExists(bcFilename))
     {
-        // Load the barcode index.
+        // Load the barcode index files written by earlier versions.
         if (load(sbi, options.whitelistFile) != 0)
         {
             std::ostringstream what;
             what << "Some barcode index files for " << options.whitelistFile << "' do not exist. Use the 'index' command to create them.";
             SEQAN_THROW(ParseError(what.str()));
         }
-        std::ostringstream msg;
-        msg << "Maximum number of alternative corrections stored in index is " << sbi.numAlts << ".";
-        printInfo(msg);
+    }
+    else
+    {
+        // Build the barcode index.
+        buildIndex(sbi, options.whitelistFile, options.numAlts, options.numThreads, options.lowMemory);
+        return;
+    }
+
+    std::ostringstream msg;
+    msg << "Maximum number of alternative corrections stored in index is " << sbi.numAlts << ".";
+    printInfo(msg);
+}
+
+// Loads or builds the index with the lookup tables selected by the options.
+void prepare_index(BarcodeIndex & sbi, Options & options, bool privateMemory)
+{
+    load_or_build_index(sbi, options, privateMemory);
+    select_barcode_table(sbi, options.barcodeTable);
+    release_plain_barcode_table(sbi);
+    if (options.twoErrors)
+    {
+        if (sbi.bcLength <= 32)
+            build_two_error_index(sbi.two_errors, options.whitelistFile, sbi.bcLength);
+        else
+            printWarning("Barcodes with two substitutions are only corrected for barcodes of up to 32 bases.");
+    }
+}
+
+// Prepares the index of the worker threads with the requested NUMA placement. The index is
+// read into private memory to place its pages, since pages of the page cache may already be
+// on any node. Replicas are loaded one node at a time with a memory policy that prefers the node.
+void place_index(IndexPlacement & index, Options & options)
+{
+    read_numa_topology(index.topology);
+    index.placement = options.numaPlacement;
+    unsigned numNodes = index.topology.nodes.size();
+    if (index.placement != NumaPlacement::NONE && numNodes < 2)
+    {
+        printInfo("Found a single NUMA node, the index is not placed.");
+        index.placement = NumaPlacement::NONE;
+    }
+    if (index.placement == NumaPlacement::REPLICATE && !fileExists(index_filename(options.whitelistFile).c_str()))
+    {
+        printWarning("Replicating the index needs an index file written by the 'index' command. Interleaving the index instead.");
+        index.placement = NumaPlacement::INTERLEAVE;
+    }
+    if ((index.placement == NumaPlacement::INTERLEAVE && !interleave_memory_policy(index.topology)) ||
+        (index.placement == NumaPlacement::REPLICATE && !preferred_node_memory_policy(index.topology.nodes[0])))
+    {
+        printWarning("Cannot set the NUMA memory policy, the index is not placed.");
+        index.placement = NumaPlacement::NONE;
+    }
+
+    unsigned numReplicas = index.placement == NumaPlacement::REPLICATE ? std::min(numNodes, std::max(options.numThreads, 1u)) : 1;
+    for (unsigned k = 0; k < numReplicas; ++k)
+    {
+        if (k > 0)
+            preferred_node_memory_policy(index.topology.nodes[k]);
+        index.replicas.emplace_back(new BarcodeIndex(options.whitelistFile));
+        prepare_index(*index.replicas.back(), options, index.placement != NumaPlacement::NONE);
+    }
+    reset_memory_policy();
+
+    std::ostringstream msg;
+    msg << "Index placement is '" << numa_placement_name(index.placement) << "' with " << numReplicas
+        << " cop" << (numReplicas == 1 ? "y" : "ies") << " of the index on " << std::max(numNodes, 1u) << " NUMA node(s).";
+    printInfo(msg);
+}
+
+int correct(Options & options)
+{
+    IndexPlacement index;
+    place_index(index, options);
+
+    // Map the barcode counts for ordering alternative corrections.
+    CountTable counts;
+    if (options.countTableFile != "")
+    {
+        map_count_table(counts, toCString(options.countTableFile));
+        if (counts.header.bcLength != index.replicas[0]->bcLength)
+        {
+            std::cerr << "ERROR: The count table has barcodes of length " << counts.header.bcLength
+                      << " but the whitelist has barcodes of length " << index.replicas[0]->bcLength << "." << std::endl;
+            return 1;
+        }
     }
 
     // Open the input and output files.
     printStatus("Opening FASTQ files");
-    gzFile fp1 = gzopen(toCString(options.fastqFile1), "r");
-    gzFile fp2 = gzopen(toCString(options.fastqFile2), "r");
-    kseq_t * seq1 = kseq_init(fp1);
-    kseq_t * seq2 = kseq_init(fp2);
+    unsigned numLanes = options.lanes.size();
+    LaneInput input(numLanes);
+    input.perLane = options.perLane;
+    input.numThreads = options.numThreads;
+    for (unsigned i = 0; i < numLanes; ++i)
+    {
+        input.files1[i] = toCString(options.lanes[i].fastqFile1);
+        input.files2[i] = toCString(options.lanes[i].fastqFile2);
+    }
+    open_lanes(input);
     printDone();
 
-    // Initialize counts on barcode correction.
-    unsigned match, one_error, unrecognized, invalid;
-    match = one_error = unrecognized = invalid = 0;
-
-    // Iterate the FASTQ records and retrieve the corrected barcodes.
-    printInfo("Retrieving whitelist barcodes.");
-    while (kseq_read(seq1) >= 0 && kseq_read(seq2) >=0)
+    std::vector<CorrectionOutput> outputs(options.perLane ? numLanes : 1);
+    if (options.perLane)
     {
-        Dna5String rx = prefix(seq1->seq.s, sbi.bcLength);
-        CharString qx = prefix(seq1->qual.s, sbi.bcLength);
-        std::vector<seqan::DnaString> barcodeCorrected;
-        BarcodeStatus s = retrieve(barcodeCorrected, sbi, rx, qx);
-        count_corrected_pair(s, match, one_error, unrecognized, invalid);
-        write_tsv(seq1, seq2, barcodeCorrected, sbi.bcLength, options.spacerLength);
+        for (unsigned i = 0; i < numLanes; ++i)
+            open_output(outputs[i], options, toCString(options.outPrefix) + ("." + options.lanes[i].name));
     }
+    else
+    {
+        open_output(outputs[0], options, toCString(options.outPrefix));
+    }
+
+    // Iterate the FASTQ records of all lanes and retrieve the corrected barcodes.
+    std::ostringstream msg;
+    msg << "Retrieving whitelist barcodes of " << numLanes << " lane(s) using " << options.numThreads << " thread(s).";
+    printInfo(msg);
+    CorrectionStats stats;
+    correct_read_pairs(stats, index, counts, input, outputs, options);
 
     // Cleanup and close all files.
-    kseq_destroy(seq1);
-    kseq_destroy(seq2);
-    gzclose(fp1);
-    gzclose(fp2);
+    close_lanes(input);
+    for (CorrectionOutput & output : outputs)
+    {
+        close_output(output);
+        for (unsigned i = 0; i < output.filenames.size(); ++i)
+        {
+            msg << "Output written to '" << output.filenames[i] << "'.";
+            printInfo(msg);
+        }
+    }
 
     // Print counts on barcode correction.
     std::cerr << std::endl;
-    print_correction_stats(match, one_error, unrecognized, invalid);
+    print_correction_stats(stats);
     std::cerr << std::endl;
 
     return 0;
@@ -329,6 +491,14 @@ int stats(Options & options)
              suffix(lowcaseFilename, length(lowcaseFilename) - 3) == "bam")
         stats_bam(stats, options.inputFile);
 
+    // Add the counts of the uncorrected barcodes.
+    if (options.countTableFile != "")
+    {
+        CountTable counts;
+        map_count_table(counts, toCString(options.countTableFile));
+        stats_count_table(stats, counts);
+    }
+
     // Write output.
     printStatus("Writing stats to output file");
     write_stats(options.outFile, stats);
@@ -345,6 +515,7 @@ int dedup(Options & options)
     if (options.inputFile == "-" || suffix(lowcaseFilename, length(lowcaseFilename) - 3) == "tsv")
     {
         Tsv_iterator tsv_it(options.inputFile);
+        OutputBuffer out(STDOUT_FILENO);
 
         // Read all reads with the next barcode.
         while(goNext(tsv_it))
@@ -365,9 +536,10 @@ int dedup(Options & options)
             // Write output for this barcode.
             for (const auto & rp: tsv_it.readPairs)
             {
-                write_tsv(rp);
+                write_tsv(out, rp);
             }
         }
+        out.flush();
     }
     else
     {
@@ -378,6 +550,25 @@ int dedup(Options & options)
     return 0;
 }
 
+int bench(Options & options)
+{
+    BarcodeIndex sbi(options.whitelistFile);
+    load_or_build_index(sbi, options);
+
+    // Benchmark samples hold 64-bit codes.
+    if (sbi.bcLength > 32)
+    {
+        std::cerr << "ERROR: The bench command supports barcodes of up to 32 bases." << std::endl;
+        return 1;
+    }
+
+    BarcodeSample sample;
+    read_barcode_sample(sample, options.fastqFile1, sbi.bcLength, options.benchReads);
+    benchmark_retrieve(sbi, sample);
+
+    return 0;
+}
+
 // =============================================================================
 // Function main()
 // =============================================================================
@@ -418,6 +609,8 @@ int main(int argc, const char ** argv)
             ret = stats(options);
         else if (options.cmd == Command::BC_DEDUP)
             ret = dedup(options);
+        else if (options.cmd == Command::BC_BENCH)
+            ret = bench(options);
 
         if (ret == 0)
             printInfo("Finished successfully.");
@@ -0,0 +1,287 @@
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <unistd.h>
+#include <zlib.h>
+#include <htslib/kseq.h>
+#include <seqan/sequence.h>
+
+#include "benchmark.h"
+#include "utils.h"
+
+#ifndef KSEQ_GZ
+#define KSEQ_GZ
+KSEQ_INIT(gzFile, gzread)
+#endif  // KSEQ_GZ
+
+using namespace seqan;
+
+// Number of heap allocations of this thread. Only counted in the bcctools-bench build (make
+// bench), which replaces the global operator new to show how many allocations the lookups
+// make. The bcctools binary keeps the allocator of the C++ library.
+#ifdef COUNT_ALLOCATIONS
+static thread_local uint64_t numAllocations = 0;
+
+void * operator new(std::size_t size)
+{
+    ++numAllocations;
+    if (size == 0)
+        size = 1;
+    while (true)
+    {
+        void * p = std::malloc(size);
+        if (p != NULL)
+            return p;
+        std::new_handler handler = std::get_new_handler();
+        if (handler == NULL)
+            throw std::bad_alloc();
+        handler();
+    }
+}
+
+void operator delete(void * p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void * p, std::size_t /*size*/) noexcept
+{
+    std::free(p);
+}
+#else
+static const uint64_t numAllocations = 0;
+#endif
+
+void read_barcode_sample(BarcodeSample & sample, CharString & fastqFile, unsigned bcLength, uint64_t maxReads)
+{
+    printStatus("Reading barcodes from FASTQ file");
+
+    gzFile fp = gzopen(toCString(fastqFile), "r");
+    kseq_t * seq = kseq_init(fp);
+    while (sample.codes.size() < maxReads && kseq_read(seq) >= 0)
+    {
+        if (seq->seq.l < bcLength || seq->qual.l < bcLength)
+            continue;
+
+        // Only barcodes without N are used, since only those can be looked up in batches.
+        uint64_t h;
+        unsigned posN;
+        if (hash(h, posN, seq->seq.s, bcLength) != 0)
+            continue;
+
+        sample.codes.push_back(h);
+        sample.quals.push_back(std::string(seq->qual.s, bcLength));
+    }
+    kseq_destroy(seq);
+    gzclose(fp);
+
+    printDone();
+}
+
+// Resident set size of the process.
+uint64_t resident_bytes()
+{
+    std::ifstream statm("/proc/self/statm");
+    uint64_t size = 0, resident = 0;
+    statm >> size >> resident;
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+inline void print_benchmark(BarcodeIndex & sbi, const char * method, uint64_t reads, double seconds, uint64_t allocations)
+{
+    const char * table = sbi.engine == IndexEngine::SPARSE ? "sparse" : barcode_table_name(sbi.tableType);
+    std::cout << table << "\t" << method << "\t" << reads << "\t" << seconds << "\t"
+              << (uint64_t)(reads / seconds) << "\t" << barcode_table_bytes(sbi) << "\t" << resident_bytes()
+              << "\t";
+#ifdef COUNT_ALLOCATIONS
+    std::cout << allocations << std::endl;
+#else
+    (void)allocations;
+    std::cout << "NA" << std::endl;
+#endif
+}
+
+// Looks up the barcodes of the sample with retrieveBatch(). Returns the time taken.
+double benchmark_batch(uint64_t & corrected, uint64_t & allocations, BarcodeIndex & sbi, BarcodeSample & sample,
+                       std::vector<char const *> & qualPtrs)
+{
+    uint64_t n = sample.codes.size();
+    const unsigned batchSize = 4096;
+    std::vector<CorrectedBarcodes> bxs(batchSize);
+    std::vector<BarcodeStatus> status(batchSize);
+    allocations = numAllocations;
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t k = 0; k < n; k += batchSize)
+    {
+        unsigned m = std::min((uint64_t)batchSize, n - k);
+        for (unsigned j = 0; j < m; ++j)
+            bxs[j].size = 0;
+        retrieveBatch(&bxs[0], &status[0], sbi, &sample.codes[k], &qualPtrs[k], m);
+        for (unsigned j = 0; j < m; ++j)
+            corrected += bxs[j].size;
+    }
+    std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+    allocations = numAllocations - allocations;
+    return seconds.count();
+}
+
+// Compares the throughput of one retrieve() call per read into a list of barcodes and into a
+// buffer of fixed capacity with retrieveBatch() on a single thread.
+void benchmark_table(BarcodeIndex & sbi, BarcodeSample & sample, std::vector<DnaString> & barcodes,
+                     std::vector<CharString> & quals, std::vector<char const *> & qualPtrs)
+{
+    uint64_t n = sample.codes.size();
+
+    printStatus("Benchmarking scalar barcode retrieval");
+    uint64_t scalarCorrected = 0;
+    std::vector<DnaString> bx;
+    uint64_t scalarAllocations = numAllocations;
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t k = 0; k < n; ++k)
+    {
+        bx.clear();
+        retrieve(bx, sbi, barcodes[k], quals[k]);
+        scalarCorrected += bx.size();
+    }
+    std::chrono::duration<double> scalarTime = std::chrono::steady_clock::now() - start;
+    scalarAllocations = numAllocations - scalarAllocations;
+    printDone();
+
+    printStatus("Benchmarking scalar barcode retrieval into a buffer");
+    uint64_t bufferCorrected = 0;
+    CorrectedBarcodes corrected;
+    uint64_t bufferAllocations = numAllocations;
+    start = std::chrono::steady_clock::now();
+    for (uint64_t k = 0; k < n; ++k)
+    {
+        corrected.size = 0;
+        retrieve(corrected, sbi, sample.codes[k], 0, 0, qualPtrs[k]);
+        bufferCorrected += corrected.size;
+    }
+    std::chrono::duration<double> bufferTime = std::chrono::steady_clock::now() - start;
+    bufferAllocations = numAllocations - bufferAllocations;
+    printDone();
+
+    printStatus("Benchmarking batched barcode retrieval");
+    uint64_t batchCorrected = 0;
+    uint64_t batchAllocations = 0;
+    double batchTime = benchmark_batch(batchCorrected, batchAllocations, sbi, sample, qualPtrs);
+    printDone();
+
+    if (scalarCorrected != bufferCorrected || scalarCorrected != batchCorrected)
+        printWarning("Scalar and batched retrieval returned different numbers of barcodes.");
+
+    print_benchmark(sbi, "retrieve", n, scalarTime.count(), scalarAllocations);
+    print_benchmark(sbi, "retrieveBuffer", n, bufferTime.count(), bufferAllocations);
+    print_benchmark(sbi, "retrieveBatch", n, batchTime, batchAllocations);
+
+    // Compare the kernels for the barcode length with the kernels for any barcode length.
+    if (sbi.engine == IndexEngine::DENSE && is_specialized_length(sbi.bcLength))
+    {
+        printStatus("Benchmarking batched barcode retrieval for any barcode length");
+        uint64_t genericCorrected = 0;
+        uint64_t genericAllocations = 0;
+        sbi.specializedKernels = false;
+        double genericTime = benchmark_batch(genericCorrected, genericAllocations, sbi, sample, qualPtrs);
+        sbi.specializedKernels = true;
+        printDone();
+
+        if (genericCorrected != batchCorrected)
+            printWarning("Retrieval for any barcode length returned a different number of barcodes.");
+        print_benchmark(sbi, "retrieveBatchGeneric", n, genericTime, genericAllocations);
+    }
+}
+
+// Benchmarks the lookups with each representation of the barcode table of a dense index. The
+// resident set size includes the plain barcode table, which is kept for building the others.
+void benchmark_retrieve(BarcodeIndex & sbi, BarcodeSample & sample)
+{
+    uint64_t n = sample.codes.size();
+
+    // Convert the barcodes to strings before timing the scalar lookup.
+    std::vector<DnaString> barcodes(n);
+    std::vector<CharString> quals(n);
+    std::vector<char const *> qualPtrs(n);
+    for (uint64_t k = 0; k < n; ++k)
+    {
+        barcodes[k] = unhash(sample.codes[k], sbi.bcLength);
+        quals[k] = sample.quals[k];
+        qualPtrs[k] = sample.quals[k].c_str();
+    }
+
+    std::cout << "TABLE" << "\t" << "METHOD" << "\t" << "READS" << "\t" << "SECONDS" << "\t" << "READS_PER_SECOND"
+              << "\t" << "TABLE_BYTES" << "\t" << "RESIDENT_BYTES" << "\t" << "ALLOCATIONS" << std::endl;
+    if (sbi.engine == IndexEngine::SPARSE)
+    {
+        benchmark_table(sbi, sample, barcodes, quals, qualPtrs);
+        return;
+    }
+
+    BarcodeTableType types[] = {BarcodeTableType::PLAIN, BarcodeTableType::SD, BarcodeTableType::RRR, BarcodeTableType::HYB,
+                                BarcodeTableType::INTERLEAVED};
+    for (BarcodeTableType type : types)
+    {
+        select_barcode_table(sbi, type);
+        benchmark_table(sbi, sample, barcodes, quals, qualPtrs);
+    }
+    select_barcode_table(sbi, BarcodeTableType::PLAIN);
+}
+
+// Checksum of the tables of an index.
+uint32_t index_checksum(BarcodeIndex const & sbi)
+{
+    uLong crc = crc32(0, Z_NULL, 0);
+    auto add = [&](void const * data, uint64_t bytes) {
+        for (uint64_t pos = 0; pos < bytes; pos += (uint64_t)1 << 30)
+            crc = crc32(crc, static_cast<Bytef const *>(data) + pos, std::min(bytes - pos, (uint64_t)1 << 30));
+    };
+
+    if (sbi.engine == IndexEngine::SPARSE)
+    {
+        add(sbi.sparse.keys, 2 * sbi.sparse.numSlots * sizeof(uint64_t));
+        add(sbi.sparse.values, sbi.sparse.numSlots * sizeof(uint64_t));
+        add(sbi.sparse.positions, sbi.sparse.numPositions);
+        return crc;
+    }
+    add(sbi.barcode_table.data(), ((sbi.barcode_table.size() >> 6) + 1) * sizeof(uint64_t));
+    add(sbi.match_table.data(), ((sbi.match_table.size() >> 6) + 1) * sizeof(uint64_t));
+    add(sbi.substitution_table.data(), ((sbi.substitution_table.size() * sbi.substitution_table.width() >> 6) + 1) * sizeof(uint64_t));
+    return crc;
+}
+
+// Builds the index with 1, 2, 4, ... and maxThreads threads, the last build into sbi. Returns
+// false if the builds differ.
+bool benchmark_build(BarcodeIndex & sbi, CharString & whitelistFile, unsigned numAlts, unsigned maxThreads, bool lowMemory)
+{
+    std::vector<unsigned> threadCounts;
+    for (unsigned t = 1; t < maxThreads; t *= 2)
+        threadCounts.push_back(t);
+    threadCounts.push_back(maxThreads);
+
+    std::cout << "THREADS" << "\t" << "SECONDS" << "\t" << "SPEEDUP" << "\t" << "CHECKSUM" << std::endl;
+    bool identical = true;
+    uint32_t firstChecksum = 0;
+    double firstSeconds = 0;
+    for (unsigned k = 0; k < threadCounts.size(); ++k)
+    {
+        BarcodeIndex local(whitelistFile);
+        BarcodeIndex & index = k + 1 == threadCounts.size() ? sbi : local;
+
+        auto start = std::chrono::steady_clock::now();
+        buildIndex(index, whitelistFile, numAlts, threadCounts[k], lowMemory);
+        std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+
+        uint32_t checksum = index_checksum(index);
+        if (k == 0)
+        {
+            firstChecksum = checksum;
+            firstSeconds = seconds.count();
+        }
+        identical = identical && checksum == firstChecksum;
+        std::cout << threadCounts[k] << "\t" << seconds.count() << "\t" << firstSeconds / seconds.count() << "\t"
+                  << std::hex << checksum << std::dec << std::endl;
+    }
+    return identical;
+}
@@ -0,0 +1,24 @@
+#ifndef BENCHMARK_H_
+#define BENCHMARK_H_
+
+#include <string>
+#include <vector>
+#include <seqan/sequence.h>
+
+#include "barcode_index.h"
+
+// -----------------------------------------------------------------------------
+// Barcodes of a FASTQ prefix for benchmarking barcode lookups
+// -----------------------------------------------------------------------------
+
+struct BarcodeSample
+{
+    std::vector<uint64_t> codes;
+    std::vector<std::string> quals;
+};
+
+void read_barcode_sample(BarcodeSample & sample, seqan::CharString & fastqFile, unsigned bcLength, uint64_t maxReads);
+void benchmark_retrieve(BarcodeIndex & sbi, BarcodeSample & sample);
+bool benchmark_build(BarcodeIndex & sbi, seqan::CharString & whitelistFile, unsigned numAlts, unsigned maxThreads, bool lowMemory);
+
+#endif  // BENCHMARK_H_
@@ -1,3 +1,6 @@
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
 #include <string>
 #include <seqan/arg_parse.h>
 
@@ -26,6 +29,67 @@ bool dirExists(CharString const & filename)
     return true;
 }
 
+// Parses a memory size with an optional suffix K, M or G, e.g. '4G'. Returns 0 if the size is invalid.
+uint64_t parseMemorySize(std::string const & size)
+{
+    char * end;
+    uint64_t value = strtoull(size.c_str(), &end, 10);
+    if (end == size.c_str())
+        return 0;
+
+    std::string suffix(end);
+    if (suffix == "K" || suffix == "k")
+        value <<= 10;
+    else if (suffix == "M" || suffix == "m")
+        value <<= 20;
+    else if (suffix == "G" || suffix == "g")
+        value <<= 30;
+    else if (suffix != "")
+        return 0;
+    return value;
+}
+
+// Reads the lanes from a manifest file with the two FASTQ files and optionally a name per line.
+void readManifest(std::vector<InputLane> & lanes, CharString const & filename)
+{
+    std::ifstream in(toCString(filename));
+    if (!in.good())
+    {
+        std::ostringstream what;
+        what << "The manifest file '" << filename << "' does not exist.";
+        SEQAN_THROW(ParseError(what.str()));
+    }
+
+    std::string line;
+    while (std::getline(in, line))
+    {
+        std::istringstream fields(line);
+        std::string fastqFile1, fastqFile2;
+        if (!(fields >> fastqFile1) || fastqFile1[0] == '#')
+            continue;
+
+        InputLane lane;
+        if (!(fields >> fastqFile2))
+        {
+            std::ostringstream what;
+            what << "The manifest file '" << filename << "' lists no second FASTQ file for '" << fastqFile1 << "'.";
+            SEQAN_THROW(ParseError(what.str()));
+        }
+        if (!(fields >> lane.name))
+            lane.name = "lane" + std::to_string(lanes.size() + 1);
+        lane.fastqFile1 = fastqFile1;
+        lane.fastqFile2 = fastqFile2;
+        lanes.push_back(lane);
+    }
+
+    if (lanes.empty())
+    {
+        std::ostringstream what;
+        what << "The manifest file '" << filename << "' lists no FASTQ files.";
+        SEQAN_THROW(ParseError(what.str()));
+    }
+}
+
 void addOptionsWhitelist(ArgumentParser & parser, Options & options)
 {
     addOption(parser, ArgParseOption("c", "cutoff", "Minimum number of occurences for including barcode in whitelist. Default: Inferred.", ArgParseArgument::INTEGER));
@@ -34,20 +98,52 @@ void addOptionsWhitelist(ArgumentParser & parser, Options & options)
     setMinValue(parser, "entropy", "0.0");
     setMaxValue(parser, "entropy", "1.0");
 
-    addOption(parser, ArgParseOption("w", "whitelist", "Whitelist file for making a detailed barcode counts histogram.", ArgParseArgument::INPUT_FILE));
+    addOption(parser, ArgParseOption("w", "whitelist", "Whitelist file for making a detailed barcode counts histogram. "
+        "The barcodes are taken from its index file if the index command has written one.", ArgParseArgument::INPUT_FILE));
+    addOption(parser, ArgParseOption("i", "intersect", "Write only the inferred barcodes that are in the whitelist given "
+        "with --whitelist."));
     addOption(parser, ArgParseOption("o", "out", "Name of whitelist output file.", ArgParseArgument::OUTPUT_FILE));
     setDefaultValue(parser, "out", "barcode_whitelist.txt");
 
+    addOption(parser, ArgParseOption("t", "threads", "Number of threads for counting barcodes and writing the whitelist. "
+        "The output does not depend on the number of threads.", ArgParseArgument::INTEGER));
+    setDefaultValue(parser, "threads", options.numThreads);
+    setMinValue(parser, "threads", "1");
+
     addOption(parser, ArgParseOption("b", "bc-len", "Length of barcode sequence.", ArgParseArgument::INTEGER));
     setDefaultValue(parser, "bc-len", options.bcLength);
     setMinValue(parser, "bc-len", "1");
+    setMaxValue(parser, "bc-len", "32");
     setAdvanced(parser, "bc-len");
+
+    addOption(parser, ArgParseOption("m", "max-memory", "Memory for counting barcodes, e.g. '4G'. Sorted runs of counts "
+        "are written to temporary files if the distinct barcodes do not fit.", ArgParseArgument::STRING));
+    setDefaultValue(parser, "max-memory", "4G");
+
+    if (getenv("TMPDIR") != NULL)
+        options.tmpDir = getenv("TMPDIR");
+    addOption(parser, ArgParseOption("T", "tmp-dir", "Directory for temporary files of counting.", ArgParseArgument::STRING));
+    setDefaultValue(parser, "tmp-dir", options.tmpDir);
+
+    addOption(parser, ArgParseOption("k", "count-table", "Write the counts of all barcodes to a binary count table that "
+        "can be given instead of FASTQ1 to infer the whitelist again and to the correct and stats commands.", ArgParseArgument::OUTPUT_FILE));
 }
 
-void addAdvancedOptionsWhitelist(ArgumentParser & /*parser*/, Options & /*options*/)
+void addAdvancedOptionsWhitelist(ArgumentParser & parser, Options & options)
 {
-    // addOption(parser, ArgParseOption("l", "long", "Description", ArgParseArgument::INTEGER));
-    // setAdvanced(parser, "long");
+    addOption(parser, ArgParseOption("s", "sample", "Count the barcodes of the first 2^20, 2^21, ... reads and stop as soon "
+        "as the inferred cutoff is stable. The histogram and the whitelist are made from the counts of the sample."));
+    setAdvanced(parser, "sample");
+
+    addOption(parser, ArgParseOption("r", "tolerance", "Maximum relative change of the cutoff per read and of the number "
+        "of barcodes above the cutoff between two samples for stopping.", ArgParseArgument::DOUBLE));
+    setDefaultValue(parser, "tolerance", options.sampleTolerance);
+    setMinValue(parser, "tolerance", "0.0");
+    setAdvanced(parser, "tolerance");
+
+    addOption(parser, ArgParseOption("R", "refine", "After sampling, count the barcodes whose count is close to the "
+        "cutoff in the rest of the input and decide on them with their full counts."));
+    setAdvanced(parser, "refine");
 }
 
 void setupParserWhitelist(ArgumentParser & parser, Options & options)
@@ -64,8 +160,8 @@ void setupParserWhitelist(ArgumentParser & parser, Options & options)
 
     // Define the required arguments.
     ArgParseArgument arg1(ArgParseArgument::INPUT_FILE, "FASTQ1", false);
-    setHelpText(arg1, "File in FASTQ format containing the first reads in pairs.");
-    setValidValues(arg1, "fq fastq FQ FASTQ fq.gz fastq.gz FQ.gz FASTQ.gz");
+    setHelpText(arg1, "File in FASTQ format containing the first reads in pairs or a count table written with --count-table.");
+    setValidValues(arg1, "fq fastq FQ FASTQ fq.gz fastq.gz FQ.gz FASTQ.gz bcc");
     addArgument(parser, arg1);
 
     // Add options and advanced options. The latter are only visible in the full help.
@@ -79,12 +175,22 @@ void addOptionsIndex(ArgumentParser & parser, Options & options)
     setDefaultValue(parser, "alts", options.numAlts);
     setMinValue(parser, "alts", "1");
     setMaxValue(parser, "alts", "48");
+
+    addOption(parser, ArgParseOption("t", "threads", "Number of threads for index construction. The index does not "
+        "depend on the number of threads.", ArgParseArgument::INTEGER));
+    setDefaultValue(parser, "threads", options.numThreads);
+    setMinValue(parser, "threads", "1");
 }
 
-void addAdvancedOptionsIndex(ArgumentParser & /*parser*/, Options & /*options*/)
+void addAdvancedOptionsIndex(ArgumentParser & parser, Options & /*options*/)
 {
-    // addOption(parser, ArgParseOption("l", "long", "Description", ArgParseArgument::INTEGER));
-    // setAdvanced(parser, "long");
+    addOption(parser, ArgParseOption("L", "low-memory", "Build the index without tables over all barcodes besides the "
+        "barcode table. Takes longer but needs little more memory than the index."));
+    setAdvanced(parser, "low-memory");
+
+    addOption(parser, ArgParseOption("B", "benchmark", "Build the index with 1, 2, 4, ... and --threads threads, write the "
+        "build times to standard output as a tab-separated table and check that all builds are identical."));
+    setAdvanced(parser, "benchmark");
 }
 
 void setupParserIndex(ArgumentParser & parser, Options & options)
@@ -98,7 +204,7 @@ void setupParserIndex(ArgumentParser & parser, Options & options)
         "ouput index in the 'correct' command. Any barcode that has more alternative corrections with the same "
         "number of substitutions will not be corrected. The value specified with the --alts option will be rounded to "
         "the next larger power of 2. With larger values, index construction takes longer and the index takes up more "
-        "space.");
+        "space. The index is written to WHITELIST.bci and memory-mapped by the other commands.");
 
     // Define the required arguments.
     ArgParseArgument arg1(ArgParseArgument::INPUT_FILE, "WHITELIST", false);
@@ -119,12 +225,72 @@ void addOptionsCorrect(ArgumentParser & parser, Options & options)
 
     addOption(parser, ArgParseOption("s", "spacer", "Length of spacer between barcode and read sequence.", ArgParseArgument::INTEGER));
     setDefaultValue(parser, "spacer", options.spacerLength);
+
+    addOption(parser, ArgParseOption("t", "threads", "Number of threads for barcode correction and compression.", ArgParseArgument::INTEGER));
+    setDefaultValue(parser, "threads", options.numThreads);
+    setMinValue(parser, "threads", "1");
+
+    addOption(parser, ArgParseOption("f", "format", "Output format.", ArgParseArgument::STRING));
+    setValidValues(parser, "format", "tsv fastq fastq.gz bam");
+    setDefaultValue(parser, "format", "tsv");
+
+    addOption(parser, ArgParseOption("o", "out", "Prefix of output files. Output is written to standard output if not specified. "
+        "FASTQ output to standard output is interleaved.", ArgParseArgument::OUTPUT_PREFIX));
+
+    addOption(parser, ArgParseOption("i", "interleaved", "Write both reads of a pair to a single FASTQ file."));
+
+    addOption(parser, ArgParseOption("l", "per-lane", "Write the read pairs of each lane to separate output files "
+        "named PREFIX.LANE. Requires --out."));
+
+    addOption(parser, ArgParseOption("S", "sort", "Sort the output by the first corrected barcode."));
+
+    addOption(parser, ArgParseOption("m", "max-memory", "Memory for sorting, e.g. '4G'. Sorted runs are written to "
+        "temporary files if the read pairs do not fit.", ArgParseArgument::STRING));
+    setDefaultValue(parser, "max-memory", "4G");
+
+    if (getenv("TMPDIR") != NULL)
+        options.tmpDir = getenv("TMPDIR");
+    addOption(parser, ArgParseOption("T", "tmp-dir", "Directory for temporary files of sorting.", ArgParseArgument::STRING));
+    setDefaultValue(parser, "tmp-dir", options.tmpDir);
+
+    addOption(parser, ArgParseOption("k", "count-table", "Count table written by 'whitelist --count-table'. Alternative "
+        "corrections of a barcode are ordered by the counts of the whitelisted barcodes instead of the qualities of "
+        "the corrected bases alone.", ArgParseArgument::INPUT_FILE));
 }
 
-void addAdvancedOptionsCorrect(ArgumentParser & /*parser*/, Options & /*options*/)
+void addAdvancedOptionsCorrect(ArgumentParser & parser, Options & /*options*/)
 {
-    // addOption(parser, ArgParseOption("l", "long", "Description", ArgParseArgument::INTEGER));
-    // setAdvanced(parser, "long");
+    addOption(parser, ArgParseOption("u", "unordered", "Write read pairs in the order their correction finishes instead of the input order. Only has an effect with more than one thread."));
+    setAdvanced(parser, "unordered");
+
+    addOption(parser, ArgParseOption("H", "huge-pages", "Read the index file into memory backed by huge pages instead of "
+        "mapping it. Saves TLB misses but does not share the index with other processes."));
+    setAdvanced(parser, "huge-pages");
+
+    addOption(parser, ArgParseOption("V", "verify-index", "Verify the checksums of the index file before correction."));
+    setAdvanced(parser, "verify-index");
+
+    addOption(parser, ArgParseOption("b", "barcode-table", "Representation of the barcode table of the dense index. "
+        "The compressed bit vectors 'sd', 'rrr' and 'hyb' take less memory than 'plain' but are slower. 'il' interleaves "
+        "the barcode and match tables with their rank support for one cache miss per lookup but takes more memory.", ArgParseArgument::STRING));
+    setValidValues(parser, "barcode-table", "plain sd rrr hyb il");
+    setDefaultValue(parser, "barcode-table", "plain");
+    setAdvanced(parser, "barcode-table");
+
+    addOption(parser, ArgParseOption("E", "two-errors", "Correct unrecognized barcodes of up to 32 bases with two "
+        "substitutions if there are at most --alts such barcodes in the whitelist and none with fewer substitutions."));
+    setAdvanced(parser, "two-errors");
+
+    addOption(parser, ArgParseOption("N", "numa", "Placement of the index on NUMA systems. 'interleave' spreads the "
+        "pages of the index over all nodes, 'replicate' loads one copy of the index per node and runs each thread on "
+        "the node of its copy. Has no effect on systems with a single node.", ArgParseArgument::STRING));
+    setValidValues(parser, "numa", "none interleave replicate");
+    setDefaultValue(parser, "numa", "none");
+    setAdvanced(parser, "numa");
+
+    addOption(parser, ArgParseOption("L", "low-memory", "Build the index on-the-fly without tables over all barcodes "
+        "besides the barcode table. Takes longer but needs little more memory than the index."));
+    setAdvanced(parser, "low-memory");
 }
 
 void setupParserCorrect(ArgumentParser & parser, Options & options)
@@ -132,6 +298,8 @@ void setupParserCorrect(ArgumentParser & parser, Options & options)
     setVersion(parser, VERSION);
     setDate(parser, DATE);
     addUsageLine(parser, "[\\fIOPTIONS\\fP] \\fIWHITELIST\\fP \\fIFASTQ1\\fP \\fIFASTQ2\\fP");
+    addUsageLine(parser, "[\\fIOPTIONS\\fP] \\fIWHITELIST\\fP \\fIFASTQ1\\fP... \\fIFASTQ2\\fP...");
+    addUsageLine(parser, "[\\fIOPTIONS\\fP] \\fIWHITELIST\\fP \\fIMANIFEST\\fP");
 
     addDescription(parser, "Extracts barcodes from reads and corrects them using an index of a barcode whitelist. "
         "An index of the barcode whitelist is created for correction on-the-fly unless it has been precomputed with "
@@ -143,14 +311,12 @@ void setupParserCorrect(ArgumentParser & parser, Options & options)
     ArgParseArgument arg1(ArgParseArgument::INPUT_FILE, "WHITELIST", false);
     setHelpText(arg1, "File containing barcode whitelist.");
     addArgument(parser, arg1);
-    ArgParseArgument arg2(ArgParseArgument::INPUT_FILE, "FASTQ1", false);
-    setHelpText(arg2, "File in FASTQ format containing the first reads in pairs.");
-    setValidValues(arg2, "fq fastq FQ FASTQ fq.gz fastq.gz FQ.gz FASTQ.gz");
+    ArgParseArgument arg2(ArgParseArgument::INPUT_FILE, "FASTQ", true);
+    setHelpText(arg2, "Files in FASTQ format, first the files containing the first reads in pairs of each lane, then "
+        "the files containing the second reads in the same order. Alternatively, a manifest file with one lane per "
+        "line: FASTQ1, FASTQ2 and optionally a lane name separated by whitespace.");
+    setValidValues(arg2, "fq fastq FQ FASTQ fq.gz fastq.gz FQ.gz FASTQ.gz tsv txt");
     addArgument(parser, arg2);
-    ArgParseArgument arg3(ArgParseArgument::INPUT_FILE, "FASTQ2", false);
-    setHelpText(arg3, "File in FASTQ format containing the second reads in pairs.");
-    setValidValues(arg3, "fq fastq FQ FASTQ fq.gz fastq.gz FQ.gz FASTQ.gz");
-    addArgument(parser, arg3);
 
     // Add options and advanced options. The latter are only visible in the full help.
     addOptionsCorrect(parser, options);
@@ -164,10 +330,11 @@ void addOptionsStats(ArgumentParser & parser, Options & options)
     setDefaultValue(parser, "out", options.outFile);
 }
 
-void addAdvancedOptionsStats(ArgumentParser & /*parser*/, Options & /*options*/)
+void addAdvancedOptionsStats(ArgumentParser & parser, Options & /*options*/)
 {
-    // addOption(parser, ArgParseOption("l", "long", "Description", ArgParseArgument::INTEGER));
-    // setAdvanced(parser, "long");
+    addOption(parser, ArgParseOption("k", "count-table", "Count table written by 'whitelist --count-table'. Adds the "
+        "number of reads, the number of distinct barcodes and the count histogram of the uncorrected barcodes.", ArgParseArgument::INPUT_FILE));
+    setAdvanced(parser, "count-table");
 }
 
 void setupParserStats(ArgumentParser & parser, Options & options)
@@ -240,6 +407,48 @@ void setupParserDedup(ArgumentParser & parser, Options & options)
     addAdvancedOptionsDedup(parser, options);
 }
 
+void addOptionsBench(ArgumentParser & parser, Options & options)
+{
+    addOption(parser, ArgParseOption("a", "alts", "Maximum number of alternative corrections if the index is built on-the-fly.", ArgParseArgument::INTEGER));
+    setDefaultValue(parser, "alts", options.numAlts);
+    setMinValue(parser, "alts", "1");
+    setMaxValue(parser, "alts", "48");
+
+    addOption(parser, ArgParseOption("n", "reads", "Number of reads from the FASTQ file to look up.", ArgParseArgument::INTEGER));
+    setDefaultValue(parser, "reads", options.benchReads);
+    setMinValue(parser, "reads", "1");
+}
+
+void addAdvancedOptionsBench(ArgumentParser & /*parser*/, Options & /*options*/)
+{
+    // addOption(parser, ArgParseOption("l", "long", "Description", ArgParseArgument::INTEGER));
+    // setAdvanced(parser, "long");
+}
+
+void setupParserBench(ArgumentParser & parser, Options & options)
+{
+    setVersion(parser, VERSION);
+    setDate(parser, DATE);
+    addUsageLine(parser, "[\\fIOPTIONS\\fP] \\fIWHITELIST\\fP \\fIFASTQ1\\fP");
+
+    addDescription(parser, "Measures the number of barcode lookups per second on a single thread for the barcodes of "
+        "the first reads in the given FASTQ file. Reads with N in the barcode are skipped. The results are written "
+        "to standard output as a tab-separated table.");
+
+    // Define the required arguments.
+    ArgParseArgument arg1(ArgParseArgument::INPUT_FILE, "WHITELIST", false);
+    setHelpText(arg1, "File containing barcode whitelist.");
+    addArgument(parser, arg1);
+    ArgParseArgument arg2(ArgParseArgument::INPUT_FILE, "FASTQ1", false);
+    setHelpText(arg2, "File in FASTQ format containing the first reads in pairs.");
+    setValidValues(arg2, "fq fastq FQ FASTQ fq.gz fastq.gz FQ.gz FASTQ.gz");
+    addArgument(parser, arg2);
+
+    // Add options and advanced options. The latter are only visible in the full help.
+    addOptionsBench(parser, options);
+    addAdvancedOptionsBench(parser, options);
+}
+
 void getArgumentValuesWhitelist(Options & options, ArgumentParser & parser)
 {
     getArgumentValue(options.fastqFile1, parser, 0);
@@ -253,8 +462,9 @@ void getArgumentValuesIndex(Options & options, ArgumentParser & parser)
 void getArgumentValuesCorrect(Options & options, ArgumentParser & parser)
 {
     getArgumentValue(options.whitelistFile, parser, 0);
-    getArgumentValue(options.fastqFile1, parser, 1);
-    getArgumentValue(options.fastqFile2, parser, 2);
+    options.inputFiles.resize(getArgumentValueCount(parser, 1));
+    for (unsigned i = 0; i < options.inputFiles.size(); ++i)
+        getArgumentValue(options.inputFiles[i], parser, 1, i);
 }
 
 void getArgumentValuesStats(Options & options, ArgumentParser & parser)
@@ -267,28 +477,98 @@ void getArgumentValuesDedup(Options & options, ArgumentParser & parser)
     getArgumentValue(options.inputFile, parser, 0);
 }
 
+void getArgumentValuesBench(Options & options, ArgumentParser & parser)
+{
+    getArgumentValue(options.whitelistFile, parser, 0);
+    getArgumentValue(options.fastqFile1, parser, 1);
+}
+
 void getOptionValuesWhitelist(Options & options, ArgumentParser & parser)
 {
     getOptionValue(options.whitelistCutoff, parser, "cutoff");
     getOptionValue(options.whitelistFile, parser, "whitelist");
     getOptionValue(options.outFile, parser, "out");
     getOptionValue(options.bcLength, parser, "bc-len");
+    getOptionValue(options.numThreads, parser, "threads");
+    getOptionValue(options.tmpDir, parser, "tmp-dir");
+    getOptionValue(options.countTableFile, parser, "count-table");
+    options.sampleWhitelist = isSet(parser, "sample");
+    getOptionValue(options.sampleTolerance, parser, "tolerance");
+    options.refineBoundary = isSet(parser, "refine");
+    options.intersectWhitelist = isSet(parser, "intersect");
+
+    std::string maxMemory;
+    getOptionValue(maxMemory, parser, "max-memory");
+    options.maxMemory = parseMemorySize(maxMemory);
 }
 
 void getOptionValuesIndex(Options & options, ArgumentParser & parser)
 {
     getOptionValue(options.numAlts, parser, "alts");
+    getOptionValue(options.numThreads, parser, "threads");
+    options.benchBuild = isSet(parser, "benchmark");
+    options.lowMemory = isSet(parser, "low-memory");
 }
 
 void getOptionValuesCorrect(Options & options, ArgumentParser & parser)
 {
     getOptionValue(options.numAlts, parser, "alts");
     getOptionValue(options.spacerLength, parser, "spacer");
+    getOptionValue(options.numThreads, parser, "threads");
+    options.unordered = isSet(parser, "unordered");
+    options.hugePages = isSet(parser, "huge-pages");
+    options.verifyIndex = isSet(parser, "verify-index");
+    options.lowMemory = isSet(parser, "low-memory");
+    options.twoErrors = isSet(parser, "two-errors");
+    options.sort = isSet(parser, "sort");
+    getOptionValue(options.countTableFile, parser, "count-table");
+
+    std::string barcodeTable;
+    getOptionValue(barcodeTable, parser, "barcode-table");
+    if (barcodeTable == "sd")
+        options.barcodeTable = BarcodeTableType::SD;
+    else if (barcodeTable == "rrr")
+        options.barcodeTable = BarcodeTableType::RRR;
+    else if (barcodeTable == "hyb")
+        options.barcodeTable = BarcodeTableType::HYB;
+    else if (barcodeTable == "il")
+        options.barcodeTable = BarcodeTableType::INTERLEAVED;
+    else
+        options.barcodeTable = BarcodeTableType::PLAIN;
+
+    std::string numaPlacement;
+    getOptionValue(numaPlacement, parser, "numa");
+    if (numaPlacement == "interleave")
+        options.numaPlacement = NumaPlacement::INTERLEAVE;
+    else if (numaPlacement == "replicate")
+        options.numaPlacement = NumaPlacement::REPLICATE;
+    else
+        options.numaPlacement = NumaPlacement::NONE;
+    getOptionValue(options.tmpDir, parser, "tmp-dir");
+
+    std::string maxMemory;
+    getOptionValue(maxMemory, parser, "max-memory");
+    options.maxMemory = parseMemorySize(maxMemory);
+
+    std::string format;
+    getOptionValue(format, parser, "format");
+    if (format == "fastq")
+        options.outFormat = OutputFormat::FASTQ;
+    else if (format == "fastq.gz")
+        options.outFormat = OutputFormat::FASTQ_GZ;
+    else if (format == "bam")
+        options.outFormat = OutputFormat::BAM;
+    else
+        options.outFormat = OutputFormat::TSV;
+    getOptionValue(options.outPrefix, parser, "out");
+    options.interleaved = isSet(parser, "interleaved") || options.outPrefix == "";
+    options.perLane = isSet(parser, "per-lane");
 }
 
 void getOptionValuesStats(Options & options, ArgumentParser & parser)
 {
     getOptionValue(options.outFile, parser, "out");
+    getOptionValue(options.countTableFile, parser, "count-table");
 }
 
 void getOptionValuesDedup(Options & options, ArgumentParser & parser)
@@ -305,6 +585,12 @@ void getOptionValuesDedup(Options & options, ArgumentParser & parser)
         options.seqDups = false;
 }
 
+void getOptionValuesBench(Options & options, ArgumentParser & parser)
+{
+    getOptionValue(options.numAlts, parser, "alts");
+    getOptionValue(options.benchReads, parser, "reads");
+}
+
 ArgumentParser::ParseResult checkOptionValuesWhitelist(Options & options)
 {
     SEQAN_TRY
@@ -323,11 +609,41 @@ ArgumentParser::ParseResult checkOptionValuesWhitelist(Options & options)
             SEQAN_THROW(ParseError(what.str()));
         }
 
+        if (options.maxMemory == 0)
+        {
+            what << "Invalid memory size given with --max-memory.";
+            SEQAN_THROW(ParseError(what.str()));
+        }
+
         if (options.whitelistFile != "" && !fileExists(options.whitelistFile))
         {
             what << "The given barcode whitelist file '" << options.whitelistFile << "' does not exist.";
             SEQAN_THROW(ParseError(what.str()));
         }
+
+        if (options.sampleWhitelist && options.whitelistCutoff != 0)
+        {
+            what << "The cutoff is inferred from samples with --sample and cannot be given with --cutoff.";
+            SEQAN_THROW(ParseError(what.str()));
+        }
+
+        if (options.refineBoundary && !options.sampleWhitelist)
+        {
+            what << "Refining the boundary barcodes (--refine) requires --sample.";
+            SEQAN_THROW(ParseError(what.str()));
+        }
+
+        if (options.intersectWhitelist && options.whitelistFile == "")
+        {
+            what << "Writing the intersection with a whitelist (--intersect) requires --whitelist.";
+            SEQAN_THROW(ParseError(what.str()));
+        }
+
+        if (options.countTableFile != "" && !dirExists(options.countTableFile))
+        {
+            what << "The path to the count table '" << options.countTableFile << "' does not exist.";
+            SEQAN_THROW(ParseError(what.str()));
+        }
     }
     SEQAN_CATCH(ParseError & ex)
     {
@@ -391,15 +707,75 @@ ArgumentParser::ParseResult checkOptionValuesCorrect(Options & options)
             SEQAN_THROW(ParseError(what.str()));
         }
 
-        if (!fileExists(options.fastqFile1))
+        // Pair the first and second FASTQ files, or read the pairs from a manifest file.
+        if (options.inputFiles.size() == 1)
         {
-            what << "The first input FASTQ file '" << options.fastqFile1 << "' does not exist.";
+            readManifest(options.lanes, options.inputFiles[0]);
+        }
+        else if (options.inputFiles.size() % 2 == 0)
+        {
+            unsigned numLanes = options.inputFiles.size() / 2;
+            options.lanes.resize(numLanes);
+            for (unsigned i = 0; i < numLanes; ++i)
+            {
+                options.lanes[i].name = "lane" + std::to_string(i + 1);
+                options.lanes[i].fastqFile1 = options.inputFiles[i];
+                options.lanes[i].fastqFile2 = options.inputFiles[numLanes + i];
+            }
+        }
+        else
+        {
+            what << "Expected the same number of first and second FASTQ files or a single manifest file.";
+            SEQAN_THROW(ParseError(what.str()));
+        }
+
+        for (InputLane const & lane : options.lanes)
+        {
+            if (!fileExists(lane.fastqFile1))
+            {
+                what << "The first input FASTQ file '" << lane.fastqFile1 << "' does not exist.";
+                SEQAN_THROW(ParseError(what.str()));
+            }
+
+            if (!fileExists(lane.fastqFile2))
+            {
+                what << "The second input FASTQ file '" << lane.fastqFile2 << "' does not exist.";
+                SEQAN_THROW(ParseError(what.str()));
+            }
+
+            for (InputLane const & other : options.lanes)
+            {
+                if (&other != &lane && other.name == lane.name)
+                {
+                    what << "The lane name '" << lane.name << "' is not unique.";
+                    SEQAN_THROW(ParseError(what.str()));
+                }
+            }
+        }
+        options.fastqFile1 = options.lanes[0].fastqFile1;
+        options.fastqFile2 = options.lanes[0].fastqFile2;
+
+        if (options.perLane && options.outPrefix == "")
+        {
+            what << "Writing separate output files per lane requires an output prefix (--out).";
+            SEQAN_THROW(ParseError(what.str()));
+        }
+
+        if (options.outPrefix != "" && !dirExists(options.outPrefix))
+        {
+            what << "The path to the output prefix '" << options.outPrefix << "' does not exist.";
+            SEQAN_THROW(ParseError(what.str()));
+        }
+
+        if (options.maxMemory == 0)
+        {
+            what << "Invalid memory size given with --max-memory.";
             SEQAN_THROW(ParseError(what.str()));
         }
 
-        if (!fileExists(options.fastqFile2))
+        if (options.countTableFile != "" && !fileExists(options.countTableFile))
         {
-            what << "The second input FASTQ file '" << options.fastqFile2 << "' does not exist.";
+            what << "The given count table '" << options.countTableFile << "' does not exist.";
             SEQAN_THROW(ParseError(what.str()));
         }
     }
@@ -427,6 +803,12 @@ ArgumentParser::ParseResult checkOptionValuesStats(Options & options)
             what << "The directory of the given output file '" << options.outFile << "' does not exist.";
             SEQAN_THROW(ParseError(what.str()));
         }
+
+        if (options.countTableFile != "" && !fileExists(options.countTableFile))
+        {
+            what << "The given count table '" << options.countTableFile << "' does not exist.";
+            SEQAN_THROW(ParseError(what.str()));
+        }
     }
     SEQAN_CATCH(ParseError & ex)
     {
@@ -461,6 +843,35 @@ ArgumentParser::ParseResult checkOptionValuesDedup(Options & options)
     return ArgumentParser::PARSE_OK;
 }
 
+ArgumentParser::ParseResult checkOptionValuesBench(Options & options)
+{
+    SEQAN_TRY
+    {
+        std::stringstream what;
+        unsigned numAltsBase = std::ceil(std::log(options.numAlts)/std::log(2));
+        if (options.numAlts != 1u << numAltsBase)
+            options.numAlts = 1u << numAltsBase;
+
+        if (!fileExists(options.whitelistFile))
+        {
+            what << "The given barcode whitelist file '" << options.whitelistFile << "' does not exist.";
+            SEQAN_THROW(ParseError(what.str()));
+        }
+
+        if (!fileExists(options.fastqFile1))
+        {
+            what << "The input FASTQ file '" << options.fastqFile1 << "' does not exist.";
+            SEQAN_THROW(ParseError(what.str()));
+        }
+    }
+    SEQAN_CATCH(ParseError & ex)
+    {
+        std::cerr << "ERROR: " << ex.what() << std::endl;
+        return ArgumentParser::PARSE_ERROR;
+    }
+    return ArgumentParser::PARSE_OK;
+}
+
 void printHeader(ArgumentParser & parser, std::ostringstream & cmd)
 {
     std::ostream_iterator<char> out(std::cerr);
@@ -488,10 +899,10 @@ ArgumentParser::ParseResult parseCommandLine(Options & options, int argc, char c
     typedef ArgumentParser::ParseResult (*CheckValuesFunctionType)(Options &);
 
     // Initialize function arrays.
-    SetupParserFunctionType setupParser[5] = {&setupParserWhitelist, &setupParserIndex, &setupParserCorrect, &setupParserStats, &setupParserDedup};
-    GetValuesFunctionType getArgumentValues[5] = {&getArgumentValuesWhitelist, &getArgumentValuesIndex, &getArgumentValuesCorrect, &getArgumentValuesStats, &getArgumentValuesDedup};
-    GetValuesFunctionType getOptionValues[5] = {& getOptionValuesWhitelist, &getOptionValuesIndex, &getOptionValuesCorrect, &getOptionValuesStats, &getOptionValuesDedup};
-    CheckValuesFunctionType checkOptionValues[5] = {&checkOptionValuesWhitelist, &checkOptionValuesIndex, &checkOptionValuesCorrect, &checkOptionValuesStats, &checkOptionValuesDedup};
+    SetupParserFunctionType setupParser[6] = {&setupParserWhitelist, &setupParserIndex, &setupParserCorrect, &setupParserStats, &setupParserDedup, &setupParserBench};
+    GetValuesFunctionType getArgumentValues[6] = {&getArgumentValuesWhitelist, &getArgumentValuesIndex, &getArgumentValuesCorrect, &getArgumentValuesStats, &getArgumentValuesDedup, &getArgumentValuesBench};
+    GetValuesFunctionType getOptionValues[6] = {& getOptionValuesWhitelist, &getOptionValuesIndex, &getOptionValuesCorrect, &getOptionValuesStats, &getOptionValuesDedup, &getOptionValuesBench};
+    CheckValuesFunctionType checkOptionValues[6] = {&checkOptionValuesWhitelist, &checkOptionValuesIndex, &checkOptionValuesCorrect, &checkOptionValuesStats, &checkOptionValuesDedup, &checkOptionValuesBench};
 
     // Retrieve the command line.
     std::ostringstream command_line;
@@ -511,6 +922,8 @@ ArgumentParser::ParseResult parseCommandLine(Options & options, int argc, char c
         options.cmd = Command::BC_STATS;
     else if (strcmp(command, "dedup") == 0)
         options.cmd = Command::BC_DEDUP;
+    else if (strcmp(command, "bench") == 0)
+        options.cmd = Command::BC_BENCH;
     else
     {
         std::cerr << "ERROR: Unknown command '" << command << "'." << std::endl;
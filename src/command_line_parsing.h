@@ -1,6 +1,9 @@
 #ifndef COMMAND_LINE_PARSING_H_
 #define COMMAND_LINE_PARSING_H_
 
+#include <cstdint>
+#include <string>
+#include <vector>
 #include <seqan/arg_parse.h>
 
 enum Command
@@ -9,7 +12,42 @@ enum Command
     BC_INDEX = 1,
     BC_CORRECT = 2,
     BC_STATS = 3,
-    BC_DEDUP = 4
+    BC_DEDUP = 4,
+    BC_BENCH = 5
+};
+
+enum class OutputFormat
+{
+    TSV,
+    FASTQ,
+    FASTQ_GZ,
+    BAM
+};
+
+// Representation of the barcode table of the dense index.
+enum class BarcodeTableType
+{
+    PLAIN,
+    SD,
+    RRR,
+    HYB,
+    INTERLEAVED
+};
+
+// Placement of the barcode index on the nodes of NUMA systems.
+enum class NumaPlacement
+{
+    NONE,
+    INTERLEAVE,
+    REPLICATE
+};
+
+// A pair of FASTQ files, e.g. of one sequencing lane.
+struct InputLane
+{
+    std::string name;
+    seqan::CharString fastqFile1;
+    seqan::CharString fastqFile2;
 };
 
 struct Options
@@ -19,14 +57,36 @@ struct Options
     seqan::CharString whitelistFile;
     seqan::CharString fastqFile1;
     seqan::CharString fastqFile2;
+    std::vector<seqan::CharString> inputFiles;
+    std::vector<InputLane> lanes;
     seqan::CharString inputFile;
     seqan::CharString outFile;
+    seqan::CharString outPrefix;
+    OutputFormat outFormat;
+    bool interleaved;
+    bool perLane;
 
     int bcLength;
     int spacerLength;
     unsigned whitelistCutoff;
     double minEntropy;
+    bool sampleWhitelist;
+    double sampleTolerance;
+    bool refineBoundary;
+    bool intersectWhitelist;
     unsigned numAlts;
+    unsigned numThreads;
+    bool lowMemory;
+    bool unordered;
+    bool hugePages;
+    NumaPlacement numaPlacement;
+    bool verifyIndex;
+    BarcodeTableType barcodeTable;
+    bool twoErrors;
+    bool sort;
+    uint64_t maxMemory;
+    seqan::CharString tmpDir;
+    seqan::CharString countTableFile;
 
     unsigned minMatches;
     unsigned maxOffset;
@@ -35,13 +95,20 @@ struct Options
     bool nameDups;
     bool seqDups;
 
+    unsigned benchReads;
+    bool benchBuild;
+
     Options() :
-        bcLength(16), spacerLength(7), whitelistCutoff(0), minEntropy(0.5), numAlts(16),
-        minMatches(5), maxOffset(5000), maxDiffRate(0.1), minQual(15), nameDups(true), seqDups(true)
+        outFormat(OutputFormat::TSV), interleaved(false), perLane(false),
+        bcLength(16), spacerLength(7), whitelistCutoff(0), minEntropy(0.5), sampleWhitelist(false), sampleTolerance(0.05), refineBoundary(false), intersectWhitelist(false), numAlts(16), numThreads(1), lowMemory(false), unordered(false),
+        hugePages(false), numaPlacement(NumaPlacement::NONE), verifyIndex(false), barcodeTable(BarcodeTableType::PLAIN), twoErrors(false), sort(false), maxMemory((uint64_t)4 << 30), tmpDir("/tmp"),
+        minMatches(5), maxOffset(5000), maxDiffRate(0.1), minQual(15), nameDups(true), seqDups(true),
+        benchReads(1000000), benchBuild(false)
     {}
 };
 
 bool fileExists(seqan::CharString const & filename);
+uint64_t parseMemorySize(std::string const & size);
 seqan::ArgumentParser::ParseResult parseCommandLine(Options & options, int argc, char const ** argv);
 
 #endif  // COMMAND_LINE_PARSING_H_
@@ -0,0 +1,91 @@
+#include <algorithm>
+#include <cstdint>
+#include <zlib.h>
+#include <seqan/stream.h>
+
+#include "compression.h"
+
+// Deflates data into out without header and trailer. Returns the number of compressed
+// bytes or 0 if they do not fit into 'capacity' bytes.
+size_t deflate_raw(unsigned char * out, size_t capacity, char const * data, size_t size, int level)
+{
+    z_stream strm;
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+    if (deflateInit2(&strm, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        SEQAN_THROW(seqan::IOError("Initializing BGZF compression failed."));
+
+    strm.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+    strm.avail_in = size;
+    strm.next_out = out;
+    strm.avail_out = capacity;
+    int ret = deflate(&strm, Z_FINISH);
+    size_t compressed = capacity - strm.avail_out;
+    deflateEnd(&strm);
+
+    return (ret == Z_STREAM_END) ? compressed : 0;
+}
+
+inline void store_uint16(unsigned char * p, uint16_t value)
+{
+    p[0] = value & 0xff;
+    p[1] = value >> 8;
+}
+
+inline void store_uint32(unsigned char * p, uint32_t value)
+{
+    store_uint16(p, value & 0xffff);
+    store_uint16(p + 2, value >> 16);
+}
+
+// Appends a single BGZF block of at most BGZF_BLOCK_SIZE uncompressed bytes.
+void compress_bgzf_block(OutputBuffer & out, char const * data, size_t size)
+{
+    const size_t BGZF_MAX_BLOCK = 1 << 16;
+    const size_t HEADER_SIZE = 18;
+    const size_t FOOTER_SIZE = 8;
+
+    if (out.size + BGZF_MAX_BLOCK > out.data.size())
+        out.data.resize(out.size + BGZF_MAX_BLOCK);
+    unsigned char * block = reinterpret_cast<unsigned char *>(&out.data[out.size]);
+
+    // Incompressible data is stored, which always fits into a block.
+    size_t capacity = BGZF_MAX_BLOCK - HEADER_SIZE - FOOTER_SIZE;
+    size_t compressed = deflate_raw(block + HEADER_SIZE, capacity, data, size, Z_DEFAULT_COMPRESSION);
+    if (compressed == 0)
+        compressed = deflate_raw(block + HEADER_SIZE, capacity, data, size, Z_NO_COMPRESSION);
+    if (compressed == 0)
+        SEQAN_THROW(seqan::IOError("BGZF compression failed."));
+
+    // Gzip header with the 'BC' extra field holding the block size minus one.
+    size_t blockSize = HEADER_SIZE + compressed + FOOTER_SIZE;
+    const unsigned char header[16] = {31, 139, 8, 4, 0, 0, 0, 0, 0, 255, 6, 0, 'B', 'C', 2, 0};
+    std::memcpy(block, header, 16);
+    store_uint16(block + 16, blockSize - 1);
+
+    // Gzip footer with CRC32 and uncompressed size.
+    uint32_t crc = crc32(crc32(0L, Z_NULL, 0), reinterpret_cast<Bytef const *>(data), size);
+    store_uint32(block + HEADER_SIZE + compressed, crc);
+    store_uint32(block + HEADER_SIZE + compressed + 4, size);
+
+    out.size += blockSize;
+}
+
+void compress_bgzf(OutputBuffer & out, char const * data, size_t size)
+{
+    for (size_t pos = 0; pos < size; pos += BGZF_BLOCK_SIZE)
+        compress_bgzf_block(out, data + pos, std::min(BGZF_BLOCK_SIZE, size - pos));
+}
+
+void compress_bgzf(OutputBuffer & out, OutputBuffer const & in)
+{
+    if (in.size > 0)
+        compress_bgzf(out, &in.data[0], in.size);
+}
+
+void append_bgzf_eof(OutputBuffer & out)
+{
+    const char eof[28] = {31, (char)139, 8, 4, 0, 0, 0, 0, 0, (char)255, 6, 0, 'B', 'C', 2, 0, 27, 0, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    out.append(eof, 28);
+}
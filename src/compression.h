@@ -0,0 +1,23 @@
+#ifndef COMPRESSION_H_
+#define COMPRESSION_H_
+
+#include "output_buffer.h"
+
+// -----------------------------------------------------------------------------
+// BGZF compression
+// -----------------------------------------------------------------------------
+
+// BGZF files are gzip files of independent blocks, used for BAM and gzipped FASTQ
+// output. Blocks are compressed and decompressed in parallel.
+
+// Maximal number of uncompressed bytes per BGZF block, as used by htslib.
+const size_t BGZF_BLOCK_SIZE = 0xff00;
+
+// Appends data as a sequence of BGZF blocks to out.
+void compress_bgzf(OutputBuffer & out, char const * data, size_t size);
+void compress_bgzf(OutputBuffer & out, OutputBuffer const & in);
+
+// Appends the empty BGZF block that marks the end of a BAM file.
+void append_bgzf_eof(OutputBuffer & out);
+
+#endif  // COMPRESSION_H_
@@ -0,0 +1,759 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <memory>
+#include <unistd.h>
+#include <seqan/sequence.h>
+#include <seqan/stream.h>
+
+#include "barcode_sort.h"
+#include "compression.h"
+#include "correct.h"
+#include "pipeline.h"
+#include "utils.h"
+
+using namespace seqan;
+
+void count_corrected_pair(BarcodeStatus s, CorrectionStats & stats)
+{
+    switch (s)
+    {
+        case BarcodeStatus::MATCH:
+            ++stats.match; return;
+        case BarcodeStatus::ONE_ERROR:
+            ++stats.one_error; return;
+        case BarcodeStatus::TWO_ERRORS:
+            ++stats.two_errors; return;
+        case BarcodeStatus::UNRECOGNIZED:
+            ++stats.unrecognized; return;
+        case BarcodeStatus::INVALID:
+            ++stats.invalid; return;
+    }
+}
+
+void add_correction_stats(CorrectionStats & total, CorrectionStats const & stats)
+{
+    total.match += stats.match;
+    total.one_error += stats.one_error;
+    total.two_errors += stats.two_errors;
+    total.unrecognized += stats.unrecognized;
+    total.invalid += stats.invalid;
+}
+
+void print_correction_stats(CorrectionStats const & stats)
+{
+    std::cerr << "Stats:" << std::endl;
+    std::cerr << "  Whitelisted barcodes:    " << stats.match << std::endl;
+    std::cerr << "  Corrected barcodes:  " << stats.one_error << std::endl;
+    if (stats.two_errors > 0)
+        std::cerr << "  Corrected with two substitutions: " << stats.two_errors << std::endl;
+    std::cerr << "  Unrecognized barcodes:   " << stats.unrecognized << std::endl;
+    if (stats.invalid > 0)
+        std::cerr << "  Barcodes invalid:       " << stats.invalid << std::endl;
+}
+
+void append_barcode(OutputBuffer & out, seqan::DnaString const & barcode)
+{
+    for (unsigned i = 0; i < length(barcode); ++i)
+        out.append("ACGT"[ordValue(barcode[i])]);
+}
+
+void append_barcode(OutputBuffer & out, BarcodeCode const & code, unsigned bcLength)
+{
+    for (unsigned i = bcLength; i-- > 0; )
+        out.append("ACGT"[(i < 32 ? code.lo >> 2*i : code.hi >> 2*(i - 32)) & 3]);
+}
+
+// Appends a comma-separated list of barcodes or '*' if the list is empty.
+void append_barcodes(OutputBuffer & out, std::vector<BarcodeCode> const & barcodes, unsigned bcLength)
+{
+    if (barcodes.size() == 0)
+    {
+        out.append('*');
+        return;
+    }
+    append_barcode(out, barcodes[0], bcLength);
+    for (unsigned i = 1; i < barcodes.size(); ++i)
+    {
+        out.append(',');
+        append_barcode(out, barcodes[i], bcLength);
+    }
+}
+
+// Appends the characters [begin, end) of s, clipped to the length of s.
+inline void append_slice(OutputBuffer & out, std::string const & s, size_t begin, size_t end)
+{
+    end = std::min(end, s.size());
+    if (begin < end)
+        out.append(s.data() + begin, end - begin);
+}
+
+void write_tsv(OutputBuffer & out, ReadRecord const & read1, ReadRecord const & read2, std::vector<BarcodeCode> const & barcodeCorrected, unsigned bcLength, int spacerLength)
+{
+    size_t trimmed = bcLength + spacerLength;
+
+    // Field 1: Read name (ID).
+    out.append(read1.name);
+
+    // Field 2: Corrected barcode or '*' if none.
+    out.append('\t');
+    append_barcodes(out, barcodeCorrected, bcLength);
+
+    // Field 3 and 4: Raw barcode and spacer sequence.
+    out.append('\t');
+    append_slice(out, read1.seq, 0, bcLength);
+    out.append('\t');
+    append_slice(out, read1.seq, bcLength, trimmed);
+
+    // Field 5 and 6: Sequence of first and second read.
+    out.append('\t');
+    append_slice(out, read1.seq, trimmed, read1.seq.size());
+    out.append('\t');
+    out.append(read2.seq);
+
+    // Field 7 and 8: Barcode and spacer qual.
+    out.append('\t');
+    append_slice(out, read1.qual, 0, bcLength);
+    out.append('\t');
+    append_slice(out, read1.qual, bcLength, trimmed);
+
+    // Field 9 and 10: Quality string of first and second read.
+    out.append('\t');
+    append_slice(out, read1.qual, trimmed, read1.qual.size());
+    out.append('\t');
+    out.append(read2.qual);
+
+    out.append('\n');
+}
+
+void write_fastq(OutputBuffer & out1, OutputBuffer & out2, ReadRecord const & read1, ReadRecord const & read2, std::vector<BarcodeCode> const & barcodeCorrected, unsigned bcLength, int spacerLength)
+{
+    size_t trimmed = bcLength + spacerLength;
+
+    // First read with the barcode and spacer information as SAM tags in the comment.
+    out1.append('@');
+    out1.append(read1.name);
+    out1.append(" BX:Z:", 6);
+    append_barcodes(out1, barcodeCorrected, bcLength);
+    out1.append(" RX:Z:", 6);
+    append_slice(out1, read1.seq, 0, bcLength);
+    out1.append(" QX:Z:", 6);
+    append_slice(out1, read1.qual, 0, bcLength);
+    out1.append(" TR:Z:", 6);
+    append_slice(out1, read1.seq, bcLength, trimmed);
+    out1.append(" TQ:Z:", 6);
+    append_slice(out1, read1.qual, bcLength, trimmed);
+    out1.append('\n');
+    append_slice(out1, read1.seq, trimmed, read1.seq.size());
+    out1.append("\n+\n", 3);
+    append_slice(out1, read1.qual, trimmed, read1.qual.size());
+    out1.append('\n');
+
+    // Second read.
+    out2.append('@');
+    out2.append(read1.name);
+    out2.append('\n');
+    out2.append(read2.seq);
+    out2.append("\n+\n", 3);
+    out2.append(read2.qual);
+    out2.append('\n');
+}
+
+// -----------------------------------------------------------------------------
+// Unaligned BAM records
+// -----------------------------------------------------------------------------
+
+inline void append_uint8(OutputBuffer & out, uint8_t value)
+{
+    out.append(static_cast<char>(value));
+}
+
+inline void append_uint16(OutputBuffer & out, uint16_t value)
+{
+    char bytes[2] = {static_cast<char>(value & 0xff), static_cast<char>(value >> 8)};
+    out.append(bytes, 2);
+}
+
+inline void append_int32(OutputBuffer & out, int32_t value)
+{
+    uint32_t v = static_cast<uint32_t>(value);
+    char bytes[4] = {static_cast<char>(v & 0xff), static_cast<char>((v >> 8) & 0xff),
+                     static_cast<char>((v >> 16) & 0xff), static_cast<char>(v >> 24)};
+    out.append(bytes, 4);
+}
+
+// Appends a tag of type 'Z' with the characters [begin, end) of s as value.
+inline void append_bam_tag(OutputBuffer & out, char const * key, std::string const & s, size_t begin, size_t end)
+{
+    out.append(key, 2);
+    out.append('Z');
+    append_slice(out, s, begin, end);
+    out.append('\0');
+}
+
+// Appends the BX tag with the 10X-style '-1' suffix on each barcode. Omitted if there is no barcode.
+inline void append_bam_barcodes(OutputBuffer & out, std::vector<BarcodeCode> const & barcodes, unsigned bcLength)
+{
+    if (barcodes.size() == 0)
+        return;
+    out.append("BXZ", 3);
+    for (unsigned i = 0; i < barcodes.size(); ++i)
+    {
+        if (i > 0)
+            out.append(',');
+        append_barcode(out, barcodes[i], bcLength);
+        out.append("-1", 2);
+    }
+    out.append('\0');
+}
+
+// 4-bit BAM encoding of a base from the alphabet '=ACMGRSVTWYHKDBN'.
+inline uint8_t bam_base(char c)
+{
+    switch (c)
+    {
+        case 'A': case 'a': return 1;
+        case 'C': case 'c': return 2;
+        case 'G': case 'g': return 4;
+        case 'T': case 't': return 8;
+        default: return 15;
+    }
+}
+
+// Appends the fixed fields, read name, sequence and qualities of an unmapped record with
+// characters [begin, end) of seq and qual and leaves the block size to be patched.
+// Returns the position of the block size field.
+size_t append_bam_core(OutputBuffer & out, std::string const & name, uint16_t flag,
+                       std::string const & seq, std::string const & qual, size_t begin)
+{
+    size_t start = out.size;
+    size_t len = (begin < seq.size()) ? seq.size() - begin : 0;
+    size_t nameLength = std::min(name.size(), (size_t)254);
+
+    append_int32(out, 0);                   // block_size, patched later
+    append_int32(out, -1);                  // refID
+    append_int32(out, -1);                  // pos
+    append_uint8(out, nameLength + 1);      // l_read_name
+    append_uint8(out, 0);                   // mapq
+    append_uint16(out, 4680);               // bin of an unmapped read
+    append_uint16(out, 0);                  // n_cigar_op
+    append_uint16(out, flag);
+    append_int32(out, len);                 // l_seq
+    append_int32(out, -1);                  // next_refID
+    append_int32(out, -1);                  // next_pos
+    append_int32(out, 0);                   // tlen
+
+    out.append(name.data(), nameLength);
+    out.append('\0');
+
+    for (size_t i = 0; i < len; i += 2)
+    {
+        uint8_t packed = bam_base(seq[begin + i]) << 4;
+        if (i + 1 < len)
+            packed |= bam_base(seq[begin + i + 1]);
+        append_uint8(out, packed);
+    }
+
+    bool hasQual = qual.size() == seq.size();
+    for (size_t i = 0; i < len; ++i)
+        append_uint8(out, hasQual ? qual[begin + i] - 33 : 0xff);
+
+    return start;
+}
+
+inline void patch_block_size(OutputBuffer & out, size_t start)
+{
+    uint32_t blockSize = out.size - start - 4;
+    for (unsigned i = 0; i < 4; ++i)
+        out.data[start + i] = static_cast<char>((blockSize >> (8 * i)) & 0xff);
+}
+
+void write_bam_header(OutputBuffer & out, std::string const & readGroup)
+{
+    std::string text = "@HD\tVN:1.3\tSO:unknown\n@RG\tID:" + readGroup + "\tSM:" + readGroup +
+                       "\tLB:" + readGroup + "\tPU:1\tPL:ILLUMINA\n";
+    out.append("BAM\1", 4);
+    append_int32(out, text.size());
+    out.append(text);
+    append_int32(out, 0);   // n_ref
+}
+
+void write_bam(OutputBuffer & out, ReadRecord const & read1, ReadRecord const & read2, std::vector<BarcodeCode> const & barcodeCorrected, unsigned bcLength, int spacerLength, std::string const & readGroup)
+{
+    size_t trimmed = bcLength + spacerLength;
+
+    // First read (flags: unmapped, first in pair) without barcode and spacer.
+    size_t start = append_bam_core(out, read1.name, 68, read1.seq, read1.qual, trimmed);
+    append_bam_tag(out, "RG", readGroup, 0, readGroup.size());
+    append_bam_tag(out, "TR", read1.seq, bcLength, trimmed);
+    append_bam_tag(out, "TQ", read1.qual, bcLength, trimmed);
+    append_bam_barcodes(out, barcodeCorrected, bcLength);
+    append_bam_tag(out, "RX", read1.seq, 0, bcLength);
+    append_bam_tag(out, "QX", read1.qual, 0, bcLength);
+    patch_block_size(out, start);
+
+    // Second read (flags: unmapped, second in pair).
+    start = append_bam_core(out, read1.name, 132, read2.seq, read2.qual, 0);
+    append_bam_tag(out, "RG", readGroup, 0, readGroup.size());
+    append_bam_barcodes(out, barcodeCorrected, bcLength);
+    append_bam_tag(out, "RX", read1.seq, 0, bcLength);
+    append_bam_tag(out, "QX", read1.qual, 0, bcLength);
+    patch_block_size(out, start);
+}
+
+// -----------------------------------------------------------------------------
+// Output files
+// -----------------------------------------------------------------------------
+
+// FASTQ.gz and BAM output is compressed in BGZF blocks.
+inline bool is_compressed(OutputFormat format)
+{
+    return format == OutputFormat::FASTQ_GZ || format == OutputFormat::BAM;
+}
+
+int open_output_file(std::string const & filename)
+{
+    int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        std::ostringstream what;
+        what << "Cannot open output file '" << filename << "'.";
+        SEQAN_THROW(IOError(what.str()));
+    }
+    return fd;
+}
+
+// Writes the BAM header as its own BGZF block.
+void write_bam_start(CorrectionOutput const & output)
+{
+    OutputBuffer header(-1, 0);
+    OutputBuffer compressed(-1, 0);
+    write_bam_header(header, output.readGroup);
+    compress_bgzf(compressed, header);
+    write_all(output.fd[0], compressed);
+}
+
+void open_output(CorrectionOutput & output, Options const & options, std::string const & prefix)
+{
+    output.format = options.outFormat;
+    output.numFiles = (output.format == OutputFormat::TSV || output.format == OutputFormat::BAM || options.interleaved) ? 1 : 2;
+
+    // The read group is named after the output prefix without directories.
+    output.readGroup = prefix.substr(prefix.find_last_of('/') + 1);
+    if (output.readGroup == "")
+        output.readGroup = "bcctools";
+
+    if (prefix == "")
+    {
+        output.numFiles = 1;
+        output.fd[0] = output.fd[1] = STDOUT_FILENO;
+    }
+    else
+    {
+        std::string suffix;
+        switch (output.format)
+        {
+            case OutputFormat::TSV:
+                suffix = ".tsv"; break;
+            case OutputFormat::FASTQ:
+                suffix = ".fastq"; break;
+            case OutputFormat::FASTQ_GZ:
+                suffix = ".fastq.gz"; break;
+            case OutputFormat::BAM:
+                suffix = ".bam"; break;
+        }
+
+        if (output.numFiles == 1)
+        {
+            output.filenames.push_back(prefix + suffix);
+        }
+        else
+        {
+            output.filenames.push_back(prefix + ".1" + suffix);
+            output.filenames.push_back(prefix + ".2" + suffix);
+        }
+        for (unsigned i = 0; i < output.filenames.size(); ++i)
+            output.fd[i] = open_output_file(output.filenames[i]);
+    }
+
+    if (output.format == OutputFormat::BAM)
+        write_bam_start(output);
+}
+
+void close_output(CorrectionOutput & output)
+{
+    if (is_compressed(output.format))
+    {
+        OutputBuffer eof(-1, 0);
+        append_bgzf_eof(eof);
+        for (unsigned i = 0; i < output.numFiles; ++i)
+            write_all(output.fd[i], eof);
+    }
+
+    // Delayed write errors, e.g. of NFS or a full quota, are only reported by close().
+    for (unsigned i = 0; i < output.filenames.size(); ++i)
+    {
+        if (close(output.fd[i]) != 0)
+        {
+            std::ostringstream what;
+            what << "Writing output file '" << output.filenames[i] << "' failed: " << std::strerror(errno);
+            SEQAN_THROW(IOError(what.str()));
+        }
+    }
+}
+
+bool read_batch(ReadPairBatch & batch, FastqReader & reader1, FastqReader & reader2)
+{
+    batch.size = 0;
+    FastqBatch * batch1 = next_fastq_batch(reader1);
+    FastqBatch * batch2 = next_fastq_batch(reader2);
+    if (batch1 != NULL && batch2 != NULL)
+    {
+        // Exchange the records with the readers instead of copying them.
+        batch.reads1.swap(batch1->records);
+        batch.reads2.swap(batch2->records);
+        batch.size = std::min(batch1->size, batch2->size);
+    }
+    if (batch1 != NULL)
+        release_fastq_batch(reader1, batch1);
+    if (batch2 != NULL)
+        release_fastq_batch(reader2, batch2);
+    return batch.size > 0;
+}
+
+void open_lane(LaneInput & input, unsigned lane, unsigned numThreads)
+{
+    if (input.opened[lane])
+        return;
+    open_fastq_reader(input.readers1[lane], input.files1[lane], READ_PAIRS_PER_BATCH, numThreads);
+    open_fastq_reader(input.readers2[lane], input.files2[lane], READ_PAIRS_PER_BATCH, numThreads);
+    input.opened[lane] = true;
+}
+
+// Opens the readers of all lanes that are read in turns, otherwise of the first two lanes.
+void open_lanes(LaneInput & input)
+{
+    unsigned numLanes = input.readers1.size();
+    if (input.perLane)
+    {
+        for (unsigned lane = 0; lane < numLanes; ++lane)
+            open_lane(input, lane, std::max(input.numThreads / numLanes, 1u));
+        return;
+    }
+    for (unsigned lane = 0; lane < std::min(numLanes, 2u); ++lane)
+        open_lane(input, lane, input.numThreads);
+}
+
+void close_lanes(LaneInput & input)
+{
+    for (unsigned lane = 0; lane < input.readers1.size(); ++lane)
+    {
+        close_fastq_reader(input.readers1[lane]);
+        close_fastq_reader(input.readers2[lane]);
+    }
+}
+
+// Reads the next batch of any lane. Batches of one lane are returned in input order.
+bool read_lane_batch(ReadPairBatch & batch, LaneInput & input)
+{
+    unsigned numLanes = input.readers1.size();
+    while (input.numActive > 0)
+    {
+        unsigned lane = input.current;
+        if (!input.done[lane])
+        {
+            if (read_batch(batch, input.readers1[lane], input.readers2[lane]))
+            {
+                batch.output = input.perLane ? lane : 0;
+                if (input.perLane)
+                    input.current = (lane + 1) % numLanes;
+                return true;
+            }
+            input.done[lane] = true;
+            --input.numActive;
+
+            // Free the decompression threads of a finished lane for the lane after the next one.
+            if (!input.perLane)
+            {
+                close_fastq_reader(input.readers1[lane]);
+                close_fastq_reader(input.readers2[lane]);
+                if (lane + 2 < numLanes)
+                    open_lane(input, lane + 2, input.numThreads);
+            }
+        }
+        input.current = (lane + 1) % numLanes;
+    }
+    return false;
+}
+
+// Number of read pairs whose barcodes are looked up in the index together.
+const unsigned LOOKUP_BLOCK_SIZE = 32;
+
+// Retrieves the corrected barcodes of all read pairs in the batch. Lookups fill buffers of fixed
+// capacity and the codes are copied to the barcode lists of the batch, which keep their capacity
+// from batch to batch, so that no memory is allocated per read pair.
+void correct_batch(ReadPairBatch & batch, CorrectionStats & stats, BarcodeIndex & sbi)
+{
+    unsigned numN[LOOKUP_BLOCK_SIZE];
+    unsigned posN[LOOKUP_BLOCK_SIZE];
+    uint64_t h[LOOKUP_BLOCK_SIZE];
+    uint64_t codes[LOOKUP_BLOCK_SIZE];
+    char const * quals[LOOKUP_BLOCK_SIZE];
+    CorrectedBarcodes batchCorrected[LOOKUP_BLOCK_SIZE];
+    BarcodeStatus batchStatus[LOOKUP_BLOCK_SIZE];
+    CorrectedBarcodes single;
+
+    // Barcodes longer than 32 bases do not fit into 64-bit codes and are looked up one by one.
+    if (sbi.bcLength > 32)
+    {
+        for (unsigned k = 0; k < batch.size; ++k)
+        {
+            ReadRecord const & read1 = batch.reads1[k];
+            single.size = 0;
+            BarcodeStatus s = BarcodeStatus::UNRECOGNIZED;
+            if (read1.seq.size() >= sbi.bcLength && read1.qual.size() >= sbi.bcLength)
+            {
+                BarcodeCode code;
+                unsigned posN;
+                unsigned numN = hash_long(code, posN, read1.seq.c_str(), sbi.bcLength);
+                s = retrieve(single, sbi, code, numN, posN, read1.qual.c_str());
+            }
+            batch.barcodes[k].assign(single.codes, single.codes + single.size);
+            count_corrected_pair(s, stats);
+        }
+        return;
+    }
+
+    // The barcodes are encoded by the kernel for the barcode length.
+    with_barcode_length(sbi.bcLength, sbi.specializedKernels, [&](auto bcLength) {
+        for (unsigned first = 0; first < batch.size; first += LOOKUP_BLOCK_SIZE)
+        {
+            unsigned n = std::min(LOOKUP_BLOCK_SIZE, batch.size - first);
+
+            // Encode the barcodes and collect those without N for a batched lookup.
+            unsigned m = 0;
+            for (unsigned k = 0; k < n; ++k)
+            {
+                ReadRecord const & read1 = batch.reads1[first + k];
+                if (read1.seq.size() < sbi.bcLength || read1.qual.size() < sbi.bcLength)
+                {
+                    // Too short to hold a barcode.
+                    numN[k] = sbi.bcLength;
+                    continue;
+                }
+                numN[k] = encode_barcode(h[k], posN[k], read1.seq.c_str(), bcLength);
+                if (numN[k] == 0)
+                {
+                    codes[m] = h[k];
+                    quals[m] = read1.qual.c_str();
+                    batchCorrected[m].size = 0;
+                    ++m;
+                }
+            }
+            retrieveBatch(batchCorrected, batchStatus, sbi, codes, quals, m);
+
+            // Retrieve barcodes with N one by one.
+            m = 0;
+            for (unsigned k = 0; k < n; ++k)
+            {
+                CorrectedBarcodes * corrected = &single;
+                BarcodeStatus s;
+                if (numN[k] != 0)
+                {
+                    single.size = 0;
+                    if (numN[k] < sbi.bcLength)
+                        s = retrieve(single, sbi, h[k], numN[k], posN[k], batch.reads1[first + k].qual.c_str());
+                    else
+                        s = BarcodeStatus::UNRECOGNIZED;
+                }
+                else
+                {
+                    corrected = &batchCorrected[m];
+                    s = batchStatus[m];
+                    ++m;
+                }
+
+                // Look up unrecognized barcodes in the index for barcodes with two substitutions.
+                if (s == BarcodeStatus::UNRECOGNIZED && numN[k] < sbi.bcLength && two_error_index_built(sbi.two_errors))
+                {
+                    ReadRecord const & read1 = batch.reads1[first + k];
+                    if (retrieve_two_errors(*corrected, sbi.two_errors, read1.seq.c_str(), read1.qual.c_str(), sbi.numAlts))
+                        s = BarcodeStatus::TWO_ERRORS;
+                }
+                batch.barcodes[first + k].assign(corrected->codes, corrected->codes + corrected->size);
+                count_corrected_pair(s, stats);
+            }
+        }
+    });
+}
+
+// Orders the alternative corrections of each read pair by decreasing count of the barcode in the
+// count table. Barcodes with equal counts keep their order by the base qualities.
+void rank_by_counts(ReadPairBatch & batch, CountTable const & counts)
+{
+    uint32_t c[MAX_CORRECTIONS];
+    for (unsigned k = 0; k < batch.size; ++k)
+    {
+        std::vector<BarcodeCode> & barcodes = batch.barcodes[k];
+        if (barcodes.size() < 2)
+            continue;
+        for (unsigned i = 0; i < barcodes.size(); ++i)
+        {
+            c[i] = barcode_count(counts, barcodes[i].lo);
+            for (unsigned j = i; j > 0 && c[j - 1] < c[j]; --j)
+            {
+                std::swap(c[j - 1], c[j]);
+                std::swap(barcodes[j - 1], barcodes[j]);
+            }
+        }
+    }
+}
+
+// Formats the corrected read pairs of the batch and compresses them on this worker thread.
+void format_batch(ReadPairBatch & batch, CorrectionOutput const & output, unsigned bcLength, int spacerLength)
+{
+    OutputBuffer & out1 = batch.out[0];
+    OutputBuffer & out2 = batch.out[output.numFiles - 1];
+    out1.clear();
+    out2.clear();
+
+    for (unsigned k = 0; k < batch.size; ++k)
+    {
+        ReadRecord const & read1 = batch.reads1[k];
+        ReadRecord const & read2 = batch.reads2[k];
+        if (output.format == OutputFormat::TSV)
+            write_tsv(out1, read1, read2, batch.barcodes[k], bcLength, spacerLength);
+        else if (output.format == OutputFormat::BAM)
+            write_bam(out1, read1, read2, batch.barcodes[k], bcLength, spacerLength, output.readGroup);
+        else
+            write_fastq(out1, out2, read1, read2, batch.barcodes[k], bcLength, spacerLength);
+    }
+
+    for (unsigned i = 0; i < output.numFiles; ++i)
+    {
+        batch.compressed[i].clear();
+        if (is_compressed(output.format))
+            compress_bgzf(batch.compressed[i], batch.out[i]);
+    }
+}
+
+void write_batch(ReadPairBatch & batch, CorrectionOutput const & output)
+{
+    for (unsigned i = 0; i < output.numFiles; ++i)
+    {
+        if (is_compressed(output.format))
+            write_all(output.fd[i], batch.compressed[i]);
+        else
+            write_all(output.fd[i], batch.out[i]);
+    }
+}
+
+// Encodes the corrected read pairs of the batch as sort records.
+void encode_sort_batch(ReadPairBatch & batch, BarcodeIndex & sbi)
+{
+    batch.out[0].clear();
+    for (unsigned k = 0; k < batch.size; ++k)
+        append_sort_record(batch.out[0], sort_key(sbi, batch.barcodes[k]), batch.reads1[k], batch.reads2[k], batch.barcodes[k]);
+}
+
+// Reads the next batch in sorted order. The outputs are written one after the other.
+bool read_sorted_batch(ReadPairBatch & batch, std::vector<std::unique_ptr<BarcodeSorter> > & sorters, unsigned & current)
+{
+    batch.size = 0;
+    for (; current < sorters.size(); ++current)
+    {
+        BarcodeSorter & sorter = *sorters[current];
+        while (batch.size < batch.reads1.size() &&
+               next_sorted(sorter, batch.reads1[batch.size], batch.reads2[batch.size], batch.barcodes[batch.size]))
+            ++batch.size;
+        if (batch.size > 0)
+        {
+            batch.output = current;
+            return true;
+        }
+    }
+    return false;
+}
+
+void correct_read_pairs(CorrectionStats & stats, IndexPlacement & index, CountTable const & counts, LaneInput & input,
+                        std::vector<CorrectionOutput> & outputs, Options & options)
+{
+    unsigned bcLength = index.replicas[0]->bcLength;
+
+    // Keep enough batches in flight to not stall the workers while the writer waits for the next batch in order.
+    std::vector<ReadPairBatch> batches(options.numThreads <= 1 ? 1 : 4 * options.numThreads);
+    for (ReadPairBatch & batch : batches)
+    {
+        batch.reads1.resize(READ_PAIRS_PER_BATCH);
+        batch.reads2.resize(READ_PAIRS_PER_BATCH);
+        batch.barcodes.resize(READ_PAIRS_PER_BATCH);
+    }
+
+    // Counts are kept per worker thread and merged at the end.
+    std::vector<CorrectionStats> threadStats(std::max(options.numThreads, 1u));
+
+    if (!options.sort)
+    {
+        runPipeline(batches,
+            [&](ReadPairBatch & batch) {
+                return read_lane_batch(batch, input);
+            },
+            [&](ReadPairBatch & batch, unsigned threadId) {
+                correct_batch(batch, threadStats[threadId], worker_index(index, threadId));
+                if (count_table_loaded(counts))
+                    rank_by_counts(batch, counts);
+                format_batch(batch, outputs[batch.output], bcLength, options.spacerLength);
+            },
+            [&](ReadPairBatch & batch) {
+                write_batch(batch, outputs[batch.output]);
+            },
+            options.numThreads,
+            !options.unordered);
+    }
+    else
+    {
+        // Collect the corrected read pairs as sort records in sorted runs, one sorter per
+        // output sharing the memory budget. The input order is kept to make the sort stable.
+        std::vector<std::unique_ptr<BarcodeSorter> > sorters;
+        for (unsigned i = 0; i < outputs.size(); ++i)
+            sorters.emplace_back(new BarcodeSorter(bcLength, options.maxMemory / outputs.size(), toCString(options.tmpDir)));
+        runPipeline(batches,
+            [&](ReadPairBatch & batch) {
+                return read_lane_batch(batch, input);
+            },
+            [&](ReadPairBatch & batch, unsigned threadId) {
+                BarcodeIndex & sbi = worker_index(index, threadId);
+                correct_batch(batch, threadStats[threadId], sbi);
+                if (count_table_loaded(counts))
+                    rank_by_counts(batch, counts);
+                encode_sort_batch(batch, sbi);
+            },
+            [&](ReadPairBatch & batch) {
+                add_sort_records(*sorters[batch.output], batch.out[0]);
+            },
+            options.numThreads,
+            true);
+
+        // Merge the runs and write the read pairs in sorted order.
+        for (auto & sorter : sorters)
+            finish_sort(*sorter);
+        unsigned current = 0;
+        runPipeline(batches,
+            [&](ReadPairBatch & batch) {
+                return read_sorted_batch(batch, sorters, current);
+            },
+            [&](ReadPairBatch & batch, unsigned /*threadId*/) {
+                format_batch(batch, outputs[batch.output], bcLength, options.spacerLength);
+            },
+            [&](ReadPairBatch & batch) {
+                write_batch(batch, outputs[batch.output]);
+            },
+            options.numThreads,
+            true);
+    }
+
+    for (CorrectionStats const & s : threadStats)
+        add_correction_stats(stats, s);
+}
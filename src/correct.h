@@ -0,0 +1,114 @@
+#ifndef CORRECT_H_
+#define CORRECT_H_
+
+#include <string>
+#include <vector>
+
+#include "barcode_index.h"
+#include "command_line_parsing.h"
+#include "count_table.h"
+#include "fastq_reader.h"
+#include "numa.h"
+#include "output_buffer.h"
+
+// -----------------------------------------------------------------------------
+// Batches of read pairs for barcode correction
+// -----------------------------------------------------------------------------
+
+// Number of read pairs that are read, corrected and written together.
+const unsigned READ_PAIRS_PER_BATCH = 4096;
+
+struct CorrectionStats
+{
+    uint64_t match;
+    uint64_t one_error;
+    uint64_t two_errors;
+    uint64_t unrecognized;
+    uint64_t invalid;
+
+    CorrectionStats() :
+        match(0), one_error(0), two_errors(0), unrecognized(0), invalid(0)
+    {}
+};
+
+struct ReadPairBatch
+{
+    uint64_t id;
+    unsigned size;
+    unsigned output;
+    std::vector<ReadRecord> reads1;
+    std::vector<ReadRecord> reads2;
+    std::vector<std::vector<BarcodeCode> > barcodes;
+    OutputBuffer out[2];
+    OutputBuffer compressed[2];
+
+    ReadPairBatch() :
+        id(0), size(0), output(0),
+        out{OutputBuffer(-1, 1 << 20), OutputBuffer(-1, 1 << 20)},
+        compressed{OutputBuffer(-1, 0), OutputBuffer(-1, 0)}
+    {}
+};
+
+// Output files of the correct command. TSV, BAM and interleaved FASTQ output uses
+// one file, otherwise the first and second reads are written to separate files.
+struct CorrectionOutput
+{
+    OutputFormat format;
+    unsigned numFiles;
+    int fd[2];
+    std::vector<std::string> filenames;
+    std::string readGroup;
+
+    CorrectionOutput() : format(OutputFormat::TSV), numFiles(1), fd{-1, -1} {}
+};
+
+// FASTQ readers of all input lanes. If each lane is written to its own output, the lanes are
+// read in turns and all readers are opened up front with a share of the decompression threads.
+// Otherwise the lanes are read one after the other, and a lane is opened with all decompression
+// threads when the lane before it is read, so that it reads ahead while the other one finishes.
+struct LaneInput
+{
+    std::vector<std::string> files1;
+    std::vector<std::string> files2;
+    std::vector<FastqReader> readers1;
+    std::vector<FastqReader> readers2;
+    std::vector<bool> opened;
+    std::vector<bool> done;
+    unsigned current;
+    unsigned numActive;
+    unsigned numThreads;
+    bool perLane;
+
+    explicit LaneInput(unsigned numLanes) :
+        files1(numLanes), files2(numLanes), readers1(numLanes), readers2(numLanes), opened(numLanes, false),
+        done(numLanes, false), current(0), numActive(numLanes), numThreads(1), perLane(false)
+    {}
+};
+
+void open_lanes(LaneInput & input);
+void close_lanes(LaneInput & input);
+
+void count_corrected_pair(BarcodeStatus s, CorrectionStats & stats);
+void add_correction_stats(CorrectionStats & total, CorrectionStats const & stats);
+void print_correction_stats(CorrectionStats const & stats);
+
+void append_barcode(OutputBuffer & out, seqan::DnaString const & barcode);
+void append_barcode(OutputBuffer & out, BarcodeCode const & code, unsigned bcLength);
+void write_tsv(OutputBuffer & out, ReadRecord const & read1, ReadRecord const & read2, std::vector<BarcodeCode> const & barcodeCorrected, unsigned bcLength, int spacerLength);
+void write_fastq(OutputBuffer & out1, OutputBuffer & out2, ReadRecord const & read1, ReadRecord const & read2, std::vector<BarcodeCode> const & barcodeCorrected, unsigned bcLength, int spacerLength);
+void write_bam_header(OutputBuffer & out, std::string const & readGroup);
+void write_bam(OutputBuffer & out, ReadRecord const & read1, ReadRecord const & read2, std::vector<BarcodeCode> const & barcodeCorrected, unsigned bcLength, int spacerLength, std::string const & readGroup);
+
+void open_output(CorrectionOutput & output, Options const & options, std::string const & prefix);
+void close_output(CorrectionOutput & output);
+
+bool read_batch(ReadPairBatch & batch, FastqReader & reader1, FastqReader & reader2);
+bool read_lane_batch(ReadPairBatch & batch, LaneInput & input);
+void correct_batch(ReadPairBatch & batch, CorrectionStats & stats, BarcodeIndex & sbi);
+void format_batch(ReadPairBatch & batch, CorrectionOutput const & output, unsigned bcLength, int spacerLength);
+void write_batch(ReadPairBatch & batch, CorrectionOutput const & output);
+void rank_by_counts(ReadPairBatch & batch, CountTable const & counts);
+void correct_read_pairs(CorrectionStats & stats, IndexPlacement & index, CountTable const & counts, LaneInput & input,
+                        std::vector<CorrectionOutput> & outputs, Options & options);
+
+#endif  // CORRECT_H_
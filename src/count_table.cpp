@@ -0,0 +1,252 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <seqan/stream.h>
+
+#include "count_table.h"
+#include "index_file.h"
+#include "output_buffer.h"
+#include "pipeline.h"
+#include "utils.h"
+
+using namespace seqan;
+
+const char COUNT_TABLE_MAGIC[8] = {'B', 'C', 'C', 'C', 'N', 'T', '\0', '\0'};
+const uint32_t COUNT_TABLE_BYTE_ORDER = 0x01020304;
+
+CountTable::~CountTable()
+{
+    if (mapping != NULL)
+        munmap(mapping, mappingSize);
+}
+
+uint32_t count_table_header_checksum(CountTableHeader header)
+{
+    header.headerChecksum = 0;
+    return update_checksum(crc32(0, Z_NULL, 0), &header, sizeof(header));
+}
+
+// Returns true if the file starts with the magic bytes of a count table.
+bool is_count_table(CharString const & filename)
+{
+    char magic[sizeof(COUNT_TABLE_MAGIC)];
+    std::ifstream in(toCString(filename), std::ios::binary);
+    return in.read(magic, sizeof(magic)) && std::memcmp(magic, COUNT_TABLE_MAGIC, sizeof(magic)) == 0;
+}
+
+// ---------------------------------------------------------------------------------------
+// Function write_count_table()
+// ---------------------------------------------------------------------------------------
+
+// Partition of the codes and its records.
+struct CountTableBatch
+{
+    uint64_t id;
+    unsigned part;
+    OutputBuffer records;
+};
+
+// Writes the counts of all shards to a temporary file that replaces the count table once it is
+// complete. Partitions are merged in parallel and written in their order.
+void write_count_table(std::string const & filename, std::vector<std::unique_ptr<BarcodeCounter> > & shards, unsigned bcLength,
+                       uint64_t numReads, bool sampled, unsigned numThreads)
+{
+    std::string tmpFilename = filename + ".tmp";
+    int fd = open(tmpFilename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        std::ostringstream what;
+        what << "Cannot open count table '" << tmpFilename << "': " << std::strerror(errno);
+        SEQAN_THROW(IOError(what.str()));
+    }
+
+    CountTableHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, COUNT_TABLE_MAGIC, sizeof(header.magic));
+    header.version = COUNT_TABLE_VERSION;
+    header.byteOrder = COUNT_TABLE_BYTE_ORDER;
+    header.bcLength = bcLength;
+    header.sampled = sampled ? 1 : 0;
+    header.numReads = numReads;
+    header.checksum = crc32(0, Z_NULL, 0);
+    write_all(fd, reinterpret_cast<char const *>(&header), sizeof(header));
+
+    unsigned numParts = count_partitions(bcLength, numThreads);
+    std::vector<CountTableBatch> batches(2 * numThreads);
+    unsigned nextPart = 0;
+    runPipeline(batches,
+        [&](CountTableBatch & batch) {
+            if (nextPart == numParts)
+                return false;
+            batch.part = nextPart++;
+            return true;
+        },
+        [&](CountTableBatch & batch, unsigned /*threadId*/) {
+            batch.records.clear();
+            for_each_barcode_count(shards, batch.part, numParts, [&](uint64_t code, uint32_t count) {
+                batch.records.append(reinterpret_cast<char const *>(&code), sizeof(code));
+                batch.records.append(reinterpret_cast<char const *>(&count), sizeof(count));
+            });
+        },
+        [&](CountTableBatch & batch) {
+            write_all(fd, batch.records);
+            header.checksum = update_checksum(header.checksum, &batch.records.data[0], batch.records.size);
+            header.numBarcodes += batch.records.size / COUNT_RECORD_SIZE;
+        },
+        numThreads, true);
+
+    header.headerChecksum = count_table_header_checksum(header);
+    if (pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) || close(fd) != 0)
+    {
+        std::ostringstream what;
+        what << "Writing count table '" << tmpFilename << "' failed: " << std::strerror(errno);
+        SEQAN_THROW(IOError(what.str()));
+    }
+
+    if (std::rename(tmpFilename.c_str(), filename.c_str()) != 0)
+    {
+        std::ostringstream what;
+        what << "Cannot rename '" << tmpFilename << "' to '" << filename << "': " << std::strerror(errno);
+        SEQAN_THROW(IOError(what.str()));
+    }
+}
+
+// ---------------------------------------------------------------------------------------
+// Loading
+// ---------------------------------------------------------------------------------------
+
+void throw_invalid_count_table(std::string const & filename, char const * reason)
+{
+    std::ostringstream what;
+    what << "Count table '" << filename << "' " << reason << " Use 'whitelist --count-table' to rewrite it.";
+    SEQAN_THROW(ParseError(what.str()));
+}
+
+// Opens a count table and checks its header. Returns the file descriptor.
+int open_count_table(CountTableHeader & header, std::string const & filename)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        std::ostringstream what;
+        what << "Cannot open count table '" << filename << "': " << std::strerror(errno);
+        SEQAN_THROW(IOError(what.str()));
+    }
+
+    struct stat st;
+    bool complete = fstat(fd, &st) == 0 && pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header);
+    char const * reason = NULL;
+    if (!complete)
+        reason = "is truncated.";
+    else if (std::memcmp(header.magic, COUNT_TABLE_MAGIC, sizeof(header.magic)) != 0)
+        reason = "is not a barcode count table.";
+    else if (header.byteOrder != COUNT_TABLE_BYTE_ORDER)
+        reason = "was written on a machine with a different byte order.";
+    else if (header.version != COUNT_TABLE_VERSION)
+        reason = "was written by an incompatible version of bcctools.";
+    else if (header.headerChecksum != count_table_header_checksum(header))
+        reason = "has a corrupt header.";
+    else if ((uint64_t)st.st_size != sizeof(header) + header.numBarcodes * COUNT_RECORD_SIZE)
+        reason = "is truncated.";
+    if (reason != NULL)
+    {
+        close(fd);
+        throw_invalid_count_table(filename, reason);
+    }
+    return fd;
+}
+
+// Adds the counts of a count table to a counter as a sorted run. The counter must not hold
+// counts. The records are checked against their checksum but not loaded.
+void add_count_table(BarcodeCounter & counter, CountTableHeader & header, std::string const & filename)
+{
+    int fd = open_count_table(header, filename);
+
+    std::vector<char> buffer(1 << 24);
+    uint32_t checksum = crc32(0, Z_NULL, 0);
+    uint64_t size = header.numBarcodes * COUNT_RECORD_SIZE;
+    for (uint64_t offset = 0; offset < size; )
+    {
+        ssize_t bytes = pread(fd, &buffer[0], std::min<uint64_t>(buffer.size(), size - offset), sizeof(header) + offset);
+        if (bytes < 0 && errno == EINTR)
+            continue;
+        if (bytes <= 0)
+        {
+            close(fd);
+            throw_invalid_count_table(filename, "is truncated.");
+        }
+        checksum = update_checksum(checksum, &buffer[0], bytes);
+        offset += bytes;
+    }
+    if (checksum != header.checksum)
+    {
+        close(fd);
+        throw_invalid_count_table(filename, "has corrupt counts.");
+    }
+
+    std::vector<BarcodeCountEntry>().swap(counter.table);
+    counter.numEntries = 0;
+    counter.numSorted = 0;
+    counter.bcLength = header.bcLength;
+    counter.runs.push_back(CountRun{fd, sizeof(header), header.numBarcodes});
+}
+
+// Maps a count table for looking up counts.
+void map_count_table(CountTable & table, std::string const & filename)
+{
+    printStatus("Loading barcode count table");
+
+    int fd = open_count_table(table.header, filename);
+    size_t size = sizeof(table.header) + table.header.numBarcodes * COUNT_RECORD_SIZE;
+    void * mapping = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        std::ostringstream what;
+        what << "Cannot map count table '" << filename << "': " << std::strerror(errno);
+        SEQAN_THROW(IOError(what.str()));
+    }
+    table.mapping = mapping;
+    table.mappingSize = size;
+    table.records = static_cast<char const *>(mapping) + sizeof(table.header);
+
+    uint64_t recordBytes = table.header.numBarcodes * COUNT_RECORD_SIZE;
+    if (update_checksum(crc32(0, Z_NULL, 0), table.records, recordBytes) != table.header.checksum)
+        throw_invalid_count_table(filename, "has corrupt counts.");
+
+    printDone();
+}
+
+inline uint64_t record_code(CountTable const & table, uint64_t i)
+{
+    uint64_t code;
+    std::memcpy(&code, table.records + i * COUNT_RECORD_SIZE, sizeof(code));
+    return code;
+}
+
+// Returns the count of a barcode in the table, 0 if it has not been observed.
+uint32_t barcode_count(CountTable const & table, uint64_t code)
+{
+    uint64_t lo = 0;
+    uint64_t hi = table.header.numBarcodes;
+    while (lo < hi)
+    {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (record_code(table, mid) < code)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == table.header.numBarcodes || record_code(table, lo) != code)
+        return 0;
+    uint32_t count;
+    std::memcpy(&count, table.records + lo * COUNT_RECORD_SIZE + sizeof(uint64_t), sizeof(count));
+    return count;
+}
@@ -0,0 +1,60 @@
+#ifndef COUNT_TABLE_H_
+#define COUNT_TABLE_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <seqan/sequence.h>
+
+#include "barcode_counts.h"
+
+// -----------------------------------------------------------------------------
+// Binary barcode count table
+// -----------------------------------------------------------------------------
+
+// Counts of all observed barcodes written by 'whitelist --count-table'. A header is followed
+// by the (code, count) records of the barcodes sorted by code, 12 bytes each in the byte
+// order of the host. These are the records of the sorted runs of a BarcodeCounter, thus the
+// whitelist command merges the table like a run without loading it. The correct and stats
+// commands memory-map it and look up counts by binary search.
+
+const uint32_t COUNT_TABLE_VERSION = 1;
+
+struct CountTableHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t bcLength;
+    uint32_t sampled;         // 1 if the counts are of a sample of the reads (whitelist --sample).
+    uint64_t numReads;        // Reads the barcodes were counted in.
+    uint64_t numBarcodes;     // Number of records.
+    uint32_t checksum;        // CRC32 of the records.
+    uint32_t headerChecksum;  // CRC32 of the header with this field set to zero.
+};
+
+struct CountTable
+{
+    CountTableHeader header;
+    void * mapping;
+    size_t mappingSize;
+    char const * records;
+
+    CountTable() : mapping(NULL), mappingSize(0), records(NULL) {}
+    ~CountTable();
+};
+
+inline bool count_table_loaded(CountTable const & table)
+{
+    return table.mapping != NULL;
+}
+
+bool is_count_table(seqan::CharString const & filename);
+void write_count_table(std::string const & filename, std::vector<std::unique_ptr<BarcodeCounter> > & shards, unsigned bcLength,
+                       uint64_t numReads, bool sampled, unsigned numThreads);
+void add_count_table(BarcodeCounter & counter, CountTableHeader & header, std::string const & filename);
+void map_count_table(CountTable & table, std::string const & filename);
+uint32_t barcode_count(CountTable const & table, uint64_t code);
+
+#endif  // COUNT_TABLE_H_
@@ -0,0 +1,541 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <seqan/stream.h>
+
+#include "fastq_reader.h"
+#include "utils.h"
+
+using namespace seqan;
+
+// Number of batches a reader fills ahead of the consumer.
+const unsigned FASTQ_BATCHES_AHEAD = 8;
+
+// Size of reads from compressed or non-regular input files.
+const size_t READ_BUFFER_SIZE = 1 << 20;
+
+// Number of BGZF blocks that are decompressed together by one thread.
+const unsigned BGZF_BLOCKS_PER_CHUNK = 64;
+
+// Thrown on the reader thread if the reader is closed before the end of the file.
+struct ReaderStopped {};
+
+FastqReader::~FastqReader()
+{
+    close_fastq_reader(*this);
+}
+
+// ---------------------------------------------------------------------------------------
+// Buffered input from a file descriptor
+// ---------------------------------------------------------------------------------------
+
+struct InputStream
+{
+    int fd;
+    std::vector<char> buffer;
+    size_t begin;
+    size_t end;
+
+    explicit InputStream(int fd) : fd(fd), buffer(READ_BUFFER_SIZE), begin(0), end(0) {}
+};
+
+// Makes sure that the next n bytes are in the buffer. Returns false if the file ends before.
+bool fill(InputStream & in, size_t n)
+{
+    if (in.end - in.begin >= n)
+        return true;
+
+    std::memmove(&in.buffer[0], &in.buffer[in.begin], in.end - in.begin);
+    in.end -= in.begin;
+    in.begin = 0;
+    if (in.buffer.size() < n)
+        in.buffer.resize(n);
+
+    while (in.end < n)
+    {
+        ssize_t bytes = ::read(in.fd, &in.buffer[in.end], in.buffer.size() - in.end);
+        if (bytes < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            SEQAN_THROW(IOError("Reading input file failed."));
+        }
+        if (bytes == 0)
+            return false;
+        in.end += bytes;
+    }
+    return true;
+}
+
+// Reads more data into the buffer. Returns false at the end of the file.
+inline bool fill_more(InputStream & in)
+{
+    return fill(in, in.end - in.begin + 1);
+}
+
+// ---------------------------------------------------------------------------------------
+// FASTQ parsing
+// ---------------------------------------------------------------------------------------
+
+inline ReadRecord & next_record(FastqReader & reader)
+{
+    if (reader.current == NULL)
+    {
+        if (!reader.emptyBatches.pop(reader.current))
+            throw ReaderStopped();
+        reader.current->size = 0;
+    }
+    return reader.current->records[reader.current->size];
+}
+
+// Passes the current batch on when it is full.
+inline void commit_record(FastqReader & reader)
+{
+    ++reader.numRecords;
+    if (++reader.current->size == reader.current->records.size())
+    {
+        reader.fullBatches.push(reader.current);
+        reader.current = NULL;
+    }
+}
+
+inline void assign_line(std::string & s, char const * begin, char const * end)
+{
+    if (end > begin && end[-1] == '\r')
+        --end;
+    s.assign(begin, end - begin);
+}
+
+void throw_malformed(FastqReader const & reader)
+{
+    std::ostringstream what;
+    what << "Malformed FASTQ record " << reader.numRecords + 1 << " in '" << reader.filename << "'.";
+    SEQAN_THROW(IOError(what.str()));
+}
+
+// Parses the complete records in [begin, end) and returns the number of bytes parsed.
+// If 'last' is true, the data ends with the file and the last line break may be missing.
+size_t parse_records(FastqReader & reader, char const * begin, char const * end, bool last)
+{
+    char const * p = begin;
+    while (p < end)
+    {
+        // Skip empty lines between records.
+        if (*p == '\n' || *p == '\r')
+        {
+            ++p;
+            continue;
+        }
+
+        // Find the ends of the four lines of the record.
+        char const * lineEnd[4];
+        char const * next = p;
+        unsigned numLines = 0;
+        for (; numLines < 4; ++numLines)
+        {
+            char const * eol = static_cast<char const *>(std::memchr(next, '\n', end - next));
+            if (eol == NULL)
+                break;
+            lineEnd[numLines] = eol;
+            next = eol + 1;
+        }
+        if (numLines < 4)
+        {
+            if (!last)
+                break;
+            if (numLines < 3)
+                throw_malformed(reader);
+            lineEnd[3] = end;
+            next = end;
+        }
+        if (*p != '@' || lineEnd[1][1] != '+')
+            throw_malformed(reader);
+
+        // The name ends at the first whitespace, the comment is ignored.
+        ReadRecord & record = next_record(reader);
+        char const * nameEnd = p + 1;
+        while (nameEnd < lineEnd[0] && *nameEnd != ' ' && *nameEnd != '\t' && *nameEnd != '\r')
+            ++nameEnd;
+        record.name.assign(p + 1, nameEnd - p - 1);
+        assign_line(record.seq, lineEnd[0] + 1, lineEnd[1]);
+        assign_line(record.qual, lineEnd[2] + 1, lineEnd[3]);
+        if (record.seq.size() != record.qual.size())
+            throw_malformed(reader);
+        commit_record(reader);
+
+        p = next;
+    }
+    return p - begin;
+}
+
+// Parses a chunk of the file. An incomplete record at its end is kept for the next chunk.
+void parse_chunk(FastqReader & reader, char const * data, size_t size)
+{
+    if (reader.pending.empty())
+    {
+        size_t parsed = parse_records(reader, data, data + size, false);
+        reader.pending.assign(data + parsed, data + size);
+        return;
+    }
+
+    reader.pending.insert(reader.pending.end(), data, data + size);
+    size_t parsed = parse_records(reader, &reader.pending[0], &reader.pending[0] + reader.pending.size(), false);
+    reader.pending.erase(reader.pending.begin(), reader.pending.begin() + parsed);
+}
+
+void parse_end(FastqReader & reader)
+{
+    if (!reader.pending.empty())
+        parse_records(reader, &reader.pending[0], &reader.pending[0] + reader.pending.size(), true);
+    reader.pending.clear();
+
+    if (reader.current != NULL)
+    {
+        if (reader.current->size > 0)
+            reader.fullBatches.push(reader.current);
+        else
+            reader.emptyBatches.push(reader.current);
+        reader.current = NULL;
+    }
+}
+
+// ---------------------------------------------------------------------------------------
+// Uncompressed input
+// ---------------------------------------------------------------------------------------
+
+// Parses a regular file in place without copying it.
+void read_mapped(FastqReader & reader, int fd, size_t fileSize)
+{
+    if (fileSize == 0)
+        return;
+
+    void * map = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+        SEQAN_THROW(IOError("Memory-mapping the input file failed."));
+    madvise(map, fileSize, MADV_SEQUENTIAL);
+
+    char const * data = static_cast<char const *>(map);
+    try
+    {
+        parse_records(reader, data, data + fileSize, true);
+    }
+    catch (...)
+    {
+        munmap(map, fileSize);
+        throw;
+    }
+    munmap(map, fileSize);
+}
+
+void read_plain(FastqReader & reader, InputStream & in)
+{
+    do
+    {
+        parse_chunk(reader, &in.buffer[in.begin], in.end - in.begin);
+        in.begin = in.end;
+    }
+    while (fill_more(in));
+}
+
+// ---------------------------------------------------------------------------------------
+// Gzip input
+// ---------------------------------------------------------------------------------------
+
+// Decompresses a gzip file with any number of members as a stream.
+void read_gzip(FastqReader & reader, InputStream & in)
+{
+    z_stream strm;
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+    strm.next_in = Z_NULL;
+    strm.avail_in = 0;
+    if (inflateInit2(&strm, 15 + 16) != Z_OK)
+        SEQAN_THROW(IOError("Initializing gzip decompression failed."));
+
+    std::vector<char> out(4 * READ_BUFFER_SIZE);
+    bool inMember = true;
+    bool outputFull = false;
+    while (outputFull || in.end > in.begin || fill_more(in))
+    {
+        strm.next_in = reinterpret_cast<Bytef *>(&in.buffer[in.begin]);
+        strm.avail_in = in.end - in.begin;
+        strm.next_out = reinterpret_cast<Bytef *>(&out[0]);
+        strm.avail_out = out.size();
+
+        // Input that follows a complete member and does not start like a gzip member is
+        // trailing data. Any other error is a corrupt member.
+        bool memberStart = !inMember && strm.total_in == 0;
+        bool gzipMagic = strm.avail_in >= 2 && strm.next_in[0] == 0x1f && strm.next_in[1] == 0x8b;
+        int ret = inflate(&strm, Z_NO_FLUSH);
+        in.begin = in.end - strm.avail_in;
+        if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+        {
+            std::string reason = strm.msg != NULL ? strm.msg : "";
+            inflateEnd(&strm);
+            std::ostringstream what;
+            if (memberStart && !gzipMagic && ret == Z_DATA_ERROR)
+            {
+                what << "Ignoring trailing data after the last member of the gzip file '" << reader.filename << "'.";
+                printWarning(what);
+                return;
+            }
+            what << "The gzip file '" << reader.filename << "' is corrupt";
+            if (!reason.empty())
+                what << " (" << reason << ")";
+            what << ".";
+            SEQAN_THROW(IOError(what.str()));
+        }
+        inMember = (ret != Z_STREAM_END);
+        if (ret == Z_STREAM_END)
+            inflateReset(&strm);
+
+        outputFull = (strm.avail_out == 0);
+        parse_chunk(reader, &out[0], out.size() - strm.avail_out);
+    }
+    inflateEnd(&strm);
+
+    if (inMember)
+    {
+        std::ostringstream what;
+        what << "The gzip file '" << reader.filename << "' is corrupt or truncated.";
+        SEQAN_THROW(IOError(what.str()));
+    }
+}
+
+// ---------------------------------------------------------------------------------------
+// BGZF input
+// ---------------------------------------------------------------------------------------
+
+const size_t BGZF_HEADER_SIZE = 18;
+const size_t BGZF_FOOTER_SIZE = 8;
+const size_t BGZF_MAX_BLOCK_SIZE = 65536;
+
+inline bool is_bgzf_header(char const * p)
+{
+    unsigned char const * h = reinterpret_cast<unsigned char const *>(p);
+    return h[0] == 31 && h[1] == 139 && h[2] == 8 && (h[3] & 4) &&
+           h[10] == 6 && h[11] == 0 && h[12] == 'B' && h[13] == 'C' && h[14] == 2 && h[15] == 0;
+}
+
+inline uint32_t load_uint32(char const * p)
+{
+    unsigned char const * b = reinterpret_cast<unsigned char const *>(p);
+    return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+struct BgzfChunk
+{
+    uint64_t id;
+    std::vector<char> compressed;
+    std::vector<size_t> blockEnds;
+    std::vector<char> data;
+
+    BgzfChunk() : id(0) {}
+};
+
+// Reads the next BGZF blocks of the file. Returns false at the end of the file.
+bool read_bgzf_chunk(BgzfChunk & chunk, InputStream & in, std::string const & filename)
+{
+    chunk.compressed.clear();
+    chunk.blockEnds.clear();
+    while (chunk.blockEnds.size() < BGZF_BLOCKS_PER_CHUNK && fill(in, BGZF_HEADER_SIZE))
+    {
+        char const * header = &in.buffer[in.begin];
+        size_t blockSize = (unsigned char)header[16] + ((unsigned char)header[17] << 8) + 1;
+        if (!is_bgzf_header(header) || blockSize < BGZF_HEADER_SIZE + BGZF_FOOTER_SIZE || !fill(in, blockSize))
+        {
+            std::ostringstream what;
+            what << "The BGZF file '" << filename << "' is corrupt or truncated.";
+            SEQAN_THROW(IOError(what.str()));
+        }
+        chunk.compressed.insert(chunk.compressed.end(), &in.buffer[in.begin], &in.buffer[in.begin] + blockSize);
+        chunk.blockEnds.push_back(chunk.compressed.size());
+        in.begin += blockSize;
+    }
+    return !chunk.blockEnds.empty();
+}
+
+void inflate_bgzf_chunk(BgzfChunk & chunk, std::string const & filename)
+{
+    // The uncompressed size of each block is stored in its footer. Sizes above the BGZF maximum
+    // are rejected before allocating memory for them.
+    size_t size = 0;
+    for (size_t end : chunk.blockEnds)
+    {
+        uint32_t blockSize = load_uint32(&chunk.compressed[end - 4]);
+        if (blockSize > BGZF_MAX_BLOCK_SIZE)
+        {
+            std::ostringstream what;
+            what << "The BGZF file '" << filename << "' is corrupt.";
+            SEQAN_THROW(IOError(what.str()));
+        }
+        size += blockSize;
+    }
+    chunk.data.resize(size);
+
+    z_stream strm;
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+    strm.next_in = Z_NULL;
+    strm.avail_in = 0;
+    if (inflateInit2(&strm, -15) != Z_OK)
+        SEQAN_THROW(IOError("Initializing BGZF decompression failed."));
+
+    size_t begin = 0;
+    size_t pos = 0;
+    bool ok = true;
+    for (size_t end : chunk.blockEnds)
+    {
+        char * block = &chunk.compressed[begin];
+        uint32_t blockSize = load_uint32(&chunk.compressed[end - 4]);
+        uint32_t crc = load_uint32(&chunk.compressed[end - 8]);
+
+        inflateReset(&strm);
+        strm.next_in = reinterpret_cast<Bytef *>(block + BGZF_HEADER_SIZE);
+        strm.avail_in = end - begin - BGZF_HEADER_SIZE - BGZF_FOOTER_SIZE;
+        strm.next_out = reinterpret_cast<Bytef *>(chunk.data.data() + pos);
+        strm.avail_out = blockSize;
+        int ret = inflate(&strm, Z_FINISH);
+        Bytef const * data = reinterpret_cast<Bytef const *>(chunk.data.data() + pos);
+        if ((ret != Z_STREAM_END && blockSize > 0) || strm.avail_out != 0 ||
+            crc32(crc32(0L, Z_NULL, 0), data, blockSize) != crc)
+        {
+            ok = false;
+            break;
+        }
+        pos += blockSize;
+        begin = end;
+    }
+    inflateEnd(&strm);
+
+    if (!ok)
+    {
+        std::ostringstream what;
+        what << "The BGZF file '" << filename << "' is corrupt.";
+        SEQAN_THROW(IOError(what.str()));
+    }
+}
+
+// Decompresses the blocks of a BGZF file in parallel and parses them in order.
+void read_bgzf(FastqReader & reader, InputStream & in)
+{
+    std::vector<BgzfChunk> chunks(reader.numThreads <= 1 ? 1 : 4 * reader.numThreads);
+    runPipeline(chunks,
+        [&](BgzfChunk & chunk) {
+            return read_bgzf_chunk(chunk, in, reader.filename);
+        },
+        [&](BgzfChunk & chunk, unsigned /*threadId*/) {
+            inflate_bgzf_chunk(chunk, reader.filename);
+        },
+        [&](BgzfChunk & chunk) {
+            parse_chunk(reader, chunk.data.data(), chunk.data.size());
+        },
+        reader.numThreads,
+        true);
+}
+
+// ---------------------------------------------------------------------------------------
+// Reader thread
+// ---------------------------------------------------------------------------------------
+
+void read_fastq_file(FastqReader & reader)
+{
+    int fd = open(reader.filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        std::ostringstream what;
+        what << "Cannot open FASTQ file '" << reader.filename << "'.";
+        SEQAN_THROW(IOError(what.str()));
+    }
+
+    try
+    {
+        InputStream in(fd);
+        bool gzip = fill(in, 2) && (unsigned char)in.buffer[0] == 31 && (unsigned char)in.buffer[1] == 139;
+        if (gzip && fill(in, BGZF_HEADER_SIZE) && is_bgzf_header(&in.buffer[0]))
+        {
+            read_bgzf(reader, in);
+        }
+        else if (gzip)
+        {
+            read_gzip(reader, in);
+        }
+        else
+        {
+            struct stat st;
+            if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+                read_mapped(reader, fd, st.st_size);
+            else
+                read_plain(reader, in);
+        }
+        parse_end(reader);
+    }
+    catch (...)
+    {
+        close(fd);
+        throw;
+    }
+    close(fd);
+}
+
+void open_fastq_reader(FastqReader & reader, std::string const & filename, unsigned batchSize, unsigned numThreads)
+{
+    reader.filename = filename;
+    reader.numThreads = numThreads;
+    reader.batches.resize(FASTQ_BATCHES_AHEAD);
+    for (FastqBatch & batch : reader.batches)
+    {
+        batch.records.resize(batchSize);
+        reader.emptyBatches.push(&batch);
+    }
+
+    reader.thread = std::thread([&reader]() {
+        try
+        {
+            read_fastq_file(reader);
+        }
+        catch (ReaderStopped const &)
+        {}
+        catch (...)
+        {
+            reader.error = std::current_exception();
+        }
+        reader.fullBatches.close();
+    });
+}
+
+// Returns the next batch of records or NULL at the end of the file. Rethrows errors of the reader thread.
+FastqBatch * next_fastq_batch(FastqReader & reader)
+{
+    FastqBatch * batch;
+    if (reader.fullBatches.pop(batch))
+        return batch;
+    if (reader.error)
+    {
+        std::exception_ptr error = reader.error;
+        reader.error = nullptr;
+        std::rethrow_exception(error);
+    }
+    return NULL;
+}
+
+void release_fastq_batch(FastqReader & reader, FastqBatch * batch)
+{
+    reader.emptyBatches.push(batch);
+}
+
+// Stops the reader thread, also if the file has not been read to its end.
+void close_fastq_reader(FastqReader & reader)
+{
+    if (!reader.thread.joinable())
+        return;
+    reader.emptyBatches.close();
+    reader.thread.join();
+}
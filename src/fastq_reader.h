@@ -0,0 +1,59 @@
+#ifndef FASTQ_READER_H_
+#define FASTQ_READER_H_
+
+#include <exception>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "pipeline.h"
+
+// -----------------------------------------------------------------------------
+// Read-ahead FASTQ reader
+// -----------------------------------------------------------------------------
+
+struct ReadRecord
+{
+    std::string name;
+    std::string seq;
+    std::string qual;
+};
+
+struct FastqBatch
+{
+    std::vector<ReadRecord> records;
+    unsigned size;
+
+    FastqBatch() : size(0) {}
+};
+
+// Reads a FASTQ file on its own thread and passes batches of records through a queue.
+// Uncompressed files are memory-mapped, BGZF files (e.g. written by bgzip or the correct
+// command) are decompressed block-wise by 'numThreads' threads, and other gzip files are
+// decompressed as a stream. Records must have their sequence and quality on one line each.
+struct FastqReader
+{
+    std::string filename;
+    unsigned numThreads;
+
+    std::vector<FastqBatch> batches;
+    WorkQueue<FastqBatch *> emptyBatches;
+    WorkQueue<FastqBatch *> fullBatches;
+    std::thread thread;
+    std::exception_ptr error;
+
+    // Parser state, only used by the reader thread.
+    std::vector<char> pending;
+    FastqBatch * current;
+    uint64_t numRecords;
+
+    FastqReader() : numThreads(1), current(NULL), numRecords(0) {}
+    ~FastqReader();
+};
+
+void open_fastq_reader(FastqReader & reader, std::string const & filename, unsigned batchSize, unsigned numThreads);
+FastqBatch * next_fastq_batch(FastqReader & reader);
+void release_fastq_batch(FastqReader & reader, FastqBatch * batch);
+void close_fastq_reader(FastqReader & reader);
+
+#endif  // FASTQ_READER_H_
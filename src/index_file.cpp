@@ -0,0 +1,357 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <seqan/stream.h>
+
+#include "index_file.h"
+#include "output_buffer.h"
+#include "utils.h"
+
+using namespace seqan;
+
+const char INDEX_FILE_MAGIC[8] = {'B', 'C', 'C', 'I', 'D', 'X', '\0', '\0'};
+const uint32_t INDEX_BYTE_ORDER = 0x01020304;
+
+std::string index_filename(CharString const & whitelistFile)
+{
+    return std::string(toCString(whitelistFile)) + ".bci";
+}
+
+// ---------------------------------------------------------------------------------------
+// Checksums
+// ---------------------------------------------------------------------------------------
+
+uint32_t update_checksum(uint32_t crc, void const * data, uint64_t size)
+{
+    unsigned char const * p = static_cast<unsigned char const *>(data);
+    while (size > 0)
+    {
+        uInt n = std::min(size, (uint64_t)1 << 30);
+        crc = crc32(crc, p, n);
+        p += n;
+        size -= n;
+    }
+    return crc;
+}
+
+uint32_t header_checksum(IndexFileHeader header)
+{
+    header.headerChecksum = 0;
+    return update_checksum(crc32(0, Z_NULL, 0), &header, sizeof(header));
+}
+
+// ---------------------------------------------------------------------------------------
+// Function write_index_file()
+// ---------------------------------------------------------------------------------------
+
+inline uint64_t align_section(uint64_t offset)
+{
+    return (offset + INDEX_SECTION_ALIGNMENT - 1) / INDEX_SECTION_ALIGNMENT * INDEX_SECTION_ALIGNMENT;
+}
+
+// Writes a section of numWords words of which the first numBits bits are used. The unused
+// bits are written as zeros to make the file independent of the memory they were built in.
+void write_section(int fd, IndexSectionInfo & section, uint64_t & offset, uint64_t const * words, uint64_t numWords,
+                   uint64_t numBits, uint64_t length, unsigned width)
+{
+    offset = align_section(offset);
+    section.offset = offset;
+    section.bytes = numWords * sizeof(uint64_t);
+    section.length = length;
+    section.width = width;
+
+    if (lseek(fd, offset, SEEK_SET) < 0)
+        SEQAN_THROW(IOError("Seeking in index file failed."));
+
+    uint64_t full = std::min(numBits >> 6, numWords);
+    write_all(fd, reinterpret_cast<char const *>(words), full * sizeof(uint64_t));
+    uint32_t crc = update_checksum(crc32(0, Z_NULL, 0), words, full * sizeof(uint64_t));
+
+    std::vector<uint64_t> tail(numWords - full, 0);
+    if (!tail.empty() && (numBits & 63) != 0)
+        tail[0] = words[full] & ((static_cast<uint64_t>(1) << (numBits & 63)) - 1);
+    if (!tail.empty())
+    {
+        write_all(fd, reinterpret_cast<char const *>(&tail[0]), tail.size() * sizeof(uint64_t));
+        crc = update_checksum(crc, &tail[0], tail.size() * sizeof(uint64_t));
+    }
+
+    section.checksum = crc;
+    offset += section.bytes;
+}
+
+inline void write_bit_section(int fd, IndexSectionInfo & section, uint64_t & offset, BitTable const & table)
+{
+    write_section(fd, section, offset, table.words, (table.length >> 6) + 1, table.length, table.length, 1);
+}
+
+inline void write_rank_section(int fd, IndexSectionInfo & section, uint64_t & offset, BitTable const & table, RankTable const & rank)
+{
+    uint64_t numWords = 2 * ((table.length >> 9) + 1);
+    write_section(fd, section, offset, rank.blocks, numWords, numWords * 64, numWords, 64);
+}
+
+// Writes the index to a temporary file that replaces the index file once it is complete.
+void write_index_file(std::string const & filename, BarcodeIndex & sbi)
+{
+    printStatus("Writing barcode index");
+
+    std::string tmpFilename = filename + ".tmp";
+    int fd = open(tmpFilename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        std::ostringstream what;
+        what << "Cannot open index file '" << tmpFilename << "': " << std::strerror(errno);
+        SEQAN_THROW(IOError(what.str()));
+    }
+
+    IndexFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, INDEX_FILE_MAGIC, sizeof(header.magic));
+    header.version = sbi.substitutionBases ? INDEX_FILE_VERSION : 1;
+    header.byteOrder = INDEX_BYTE_ORDER;
+    header.bcLength = sbi.bcLength;
+    header.numAlts = sbi.numAlts;
+
+    uint64_t offset = sizeof(header);
+    if (sbi.engine == IndexEngine::SPARSE)
+    {
+        SparseIndex const & sparse = sbi.sparse;
+        uint64_t positionWords = (sparse.numPositions + 7) / 8;
+        header.engine = 1;
+        write_section(fd, header.sections[SPARSE_KEYS_SECTION], offset, sparse.keys, 2 * sparse.numSlots,
+                      2 * sparse.numSlots * 64, 2 * sparse.numSlots, 64);
+        write_section(fd, header.sections[SPARSE_VALUES_SECTION], offset, sparse.values, sparse.numSlots,
+                      sparse.numSlots * 64, sparse.numSlots, 64);
+        write_section(fd, header.sections[SPARSE_POSITIONS_SECTION], offset,
+                      reinterpret_cast<uint64_t const *>(sparse.positions), positionWords, sparse.numPositions * 8,
+                      sparse.numPositions, 8);
+        for (unsigned s = SPARSE_POSITIONS_SECTION + 1; s < NUM_INDEX_SECTIONS; ++s)
+            write_section(fd, header.sections[s], offset, NULL, 0, 0, 0, 1);
+    }
+    else
+    {
+        PackedTable const & subst = sbi.substitution_table;
+        uint64_t substBits = subst.length * subst.bits;
+        write_bit_section(fd, header.sections[BARCODE_TABLE_SECTION], offset, sbi.barcode_table);
+        write_rank_section(fd, header.sections[BARCODE_RANK_SECTION], offset, sbi.barcode_table, sbi.rank_support_barcode_table);
+        write_bit_section(fd, header.sections[MATCH_TABLE_SECTION], offset, sbi.match_table);
+        write_rank_section(fd, header.sections[MATCH_RANK_SECTION], offset, sbi.match_table, sbi.rank_support_match_table);
+        write_section(fd, header.sections[SUBSTITUTION_TABLE_SECTION], offset, subst.words, (substBits >> 6) + 1, substBits,
+                      subst.length, subst.bits);
+    }
+
+    header.headerChecksum = header_checksum(header);
+    if (pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) || close(fd) != 0)
+    {
+        std::ostringstream what;
+        what << "Writing index file '" << tmpFilename << "' failed: " << std::strerror(errno);
+        SEQAN_THROW(IOError(what.str()));
+    }
+
+    if (std::rename(tmpFilename.c_str(), filename.c_str()) != 0)
+    {
+        std::ostringstream what;
+        what << "Cannot rename '" << tmpFilename << "' to '" << filename << "': " << std::strerror(errno);
+        SEQAN_THROW(IOError(what.str()));
+    }
+
+    printDone();
+}
+
+// ---------------------------------------------------------------------------------------
+// Function map_index_file()
+// ---------------------------------------------------------------------------------------
+
+void throw_invalid_index(std::string const & filename, char const * reason)
+{
+    std::ostringstream what;
+    what << "Index file '" << filename << "' " << reason << " Use the 'index' command to rebuild it.";
+    SEQAN_THROW(ParseError(what.str()));
+}
+
+void check_header(IndexFileHeader const & header, uint64_t fileSize, unsigned bcLength, std::string const & filename)
+{
+    if (std::memcmp(header.magic, INDEX_FILE_MAGIC, sizeof(header.magic)) != 0)
+        throw_invalid_index(filename, "is not a barcode index.");
+    if (header.byteOrder != INDEX_BYTE_ORDER)
+        throw_invalid_index(filename, "was written on a machine with a different byte order.");
+    if (header.version < 1 || header.version > INDEX_FILE_VERSION)
+        throw_invalid_index(filename, "was written by an incompatible version of bcctools.");
+    if (header.headerChecksum != header_checksum(header))
+        throw_invalid_index(filename, "has a corrupt header.");
+    if (header.bcLength != bcLength)
+        throw_invalid_index(filename, "does not match the barcode length of the whitelist.");
+
+    for (unsigned s = 0; s < NUM_INDEX_SECTIONS; ++s)
+    {
+        IndexSectionInfo const & section = header.sections[s];
+        if (section.offset % INDEX_SECTION_ALIGNMENT != 0 || section.offset > fileSize || section.bytes > fileSize - section.offset)
+            throw_invalid_index(filename, "is truncated.");
+        if (section.width == 0 || section.width > 64 || section.length > section.bytes * 8 / section.width)
+            throw_invalid_index(filename, "has an invalid section.");
+    }
+
+    if (header.engine == 1)
+    {
+        // The hash table has a key of two words per slot and a power of 2 slots.
+        uint64_t numSlots = header.sections[SPARSE_VALUES_SECTION].length;
+        if (numSlots < 2 || (numSlots & (numSlots - 1)) != 0 || header.sections[SPARSE_KEYS_SECTION].length != 2 * numSlots ||
+            header.sections[SPARSE_POSITIONS_SECTION].width != 8 || header.bcLength > MAX_SPARSE_BARCODE_LENGTH)
+            throw_invalid_index(filename, "has an invalid section.");
+        return;
+    }
+    if (header.engine != 0)
+        throw_invalid_index(filename, "has an unknown index type.");
+
+    // Bit tables need a word beyond their last bit and rank support for all of their superblocks.
+    for (unsigned s = BARCODE_TABLE_SECTION; s <= MATCH_TABLE_SECTION; s += 2)
+    {
+        uint64_t length = header.sections[s].length;
+        if (header.sections[s].bytes < ((length >> 6) + 1) * 8 || header.sections[s + 1].bytes < ((length >> 9) + 1) * 16)
+            throw_invalid_index(filename, "has an invalid section.");
+    }
+}
+
+// Reads the file into memory backed by transparent huge pages if the kernel supports them.
+void * read_into_huge_pages(int fd, size_t size, size_t & mappingSize)
+{
+    mappingSize = (size + INDEX_SECTION_ALIGNMENT - 1) / INDEX_SECTION_ALIGNMENT * INDEX_SECTION_ALIGNMENT;
+    void * mapping = mmap(NULL, mappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED)
+        return mapping;
+#ifdef MADV_HUGEPAGE
+    madvise(mapping, mappingSize, MADV_HUGEPAGE);
+#endif
+
+    char * p = static_cast<char *>(mapping);
+    size_t pos = 0;
+    while (pos < size)
+    {
+        ssize_t bytes = pread(fd, p + pos, size - pos, pos);
+        if (bytes < 0 && errno == EINTR)
+            continue;
+        if (bytes <= 0)
+        {
+            munmap(mapping, mappingSize);
+            SEQAN_THROW(IOError("Reading index file failed."));
+        }
+        pos += bytes;
+    }
+    mprotect(mapping, mappingSize, PROT_READ);
+    return mapping;
+}
+
+// Maps the index file and points the lookup tables into it. With 'hugePages', the index is
+// read into private memory backed by huge pages instead of sharing the page cache.
+void map_index_file(BarcodeIndex & sbi, std::string const & filename, bool hugePages)
+{
+    printStatus("Mapping barcode index");
+
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        std::ostringstream what;
+        what << "Cannot open index file '" << filename << "': " << std::strerror(errno);
+        SEQAN_THROW(IOError(what.str()));
+    }
+
+    struct stat st;
+    IndexFileHeader header;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(header) ||
+        pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header))
+    {
+        close(fd);
+        throw_invalid_index(filename, "is truncated.");
+    }
+    try
+    {
+        check_header(header, st.st_size, sbi.bcLength, filename);
+    }
+    catch (...)
+    {
+        close(fd);
+        throw;
+    }
+
+    size_t size = st.st_size;
+    size_t mappingSize = size;
+    void * mapping;
+    if (hugePages)
+        mapping = read_into_huge_pages(fd, size, mappingSize);
+    else
+        mapping = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        std::ostringstream what;
+        what << "Cannot map index file '" << filename << "': " << std::strerror(errno);
+        SEQAN_THROW(IOError(what.str()));
+    }
+
+    if (sbi.mapping != NULL)
+        munmap(sbi.mapping, sbi.mappingSize);
+    sbi.mapping = mapping;
+    sbi.mappingSize = mappingSize;
+
+    char const * base = static_cast<char const *>(mapping);
+    auto section = [&](IndexSection s) {
+        return reinterpret_cast<uint64_t const *>(base + header.sections[s].offset);
+    };
+
+    sbi.numAlts = header.numAlts;
+    sbi.numAltsBase = std::log(sbi.numAlts) / std::log(2);
+    sbi.substitutionBases = header.version >= 2;
+
+    if (header.engine == 1)
+    {
+        sbi.engine = IndexEngine::SPARSE;
+        attach_sparse_index(sbi.sparse, section(SPARSE_KEYS_SECTION), section(SPARSE_VALUES_SECTION),
+                            reinterpret_cast<uint8_t const *>(section(SPARSE_POSITIONS_SECTION)),
+                            header.sections[SPARSE_VALUES_SECTION].length, header.sections[SPARSE_POSITIONS_SECTION].length);
+        printDone();
+        return;
+    }
+    sbi.engine = IndexEngine::DENSE;
+
+    sbi.barcode_table.words = section(BARCODE_TABLE_SECTION);
+    sbi.barcode_table.length = header.sections[BARCODE_TABLE_SECTION].length;
+    sbi.rank_support_barcode_table.blocks = section(BARCODE_RANK_SECTION);
+    sbi.rank_support_barcode_table.words = sbi.barcode_table.words;
+
+    sbi.match_table.words = section(MATCH_TABLE_SECTION);
+    sbi.match_table.length = header.sections[MATCH_TABLE_SECTION].length;
+    sbi.rank_support_match_table.blocks = section(MATCH_RANK_SECTION);
+    sbi.rank_support_match_table.words = sbi.match_table.words;
+
+    PackedTable & subst = sbi.substitution_table;
+    subst.words = section(SUBSTITUTION_TABLE_SECTION);
+    subst.length = header.sections[SUBSTITUTION_TABLE_SECTION].length;
+    subst.bits = header.sections[SUBSTITUTION_TABLE_SECTION].width;
+    subst.mask = subst.bits == 64 ? ~static_cast<uint64_t>(0) : (static_cast<uint64_t>(1) << subst.bits) - 1;
+
+    printDone();
+}
+
+// Compares the checksums of all sections with the header. This reads the whole index.
+void verify_index_file(BarcodeIndex const & sbi)
+{
+    printStatus("Verifying barcode index");
+
+    IndexFileHeader const & header = *static_cast<IndexFileHeader const *>(sbi.mapping);
+    char const * base = static_cast<char const *>(sbi.mapping);
+    for (unsigned s = 0; s < NUM_INDEX_SECTIONS; ++s)
+    {
+        IndexSectionInfo const & section = header.sections[s];
+        if (update_checksum(crc32(0, Z_NULL, 0), base + section.offset, section.bytes) != section.checksum)
+            SEQAN_THROW(ParseError("The barcode index file is corrupt. Use the 'index' command to rebuild it."));
+    }
+
+    printDone();
+}
@@ -0,0 +1,66 @@
+#ifndef INDEX_FILE_H_
+#define INDEX_FILE_H_
+
+#include <cstdint>
+#include <string>
+#include <seqan/sequence.h>
+
+#include "barcode_index.h"
+
+// -----------------------------------------------------------------------------
+// Single-file barcode index
+// -----------------------------------------------------------------------------
+
+// The index file starts with a header followed by the barcode table, its rank support, the
+// match table, its rank support and the substitution table in the in-memory layout of the
+// lookup tables. A sparse index stores its keys, values and substitution positions instead.
+// Sections start at multiples of 2 MB so that they can be backed by huge pages. The file is
+// memory-mapped read-only, thus processes using the same index share its pages in the page
+// cache. Values are stored in the byte order of the host. Version 1 files hold only the
+// positions in substitution entries, version 2 files also the bases of whitelisted barcodes.
+
+const uint32_t INDEX_FILE_VERSION = 2;
+const uint64_t INDEX_SECTION_ALIGNMENT = (uint64_t)1 << 21;
+
+enum IndexSection
+{
+    BARCODE_TABLE_SECTION = 0,
+    BARCODE_RANK_SECTION = 1,
+    MATCH_TABLE_SECTION = 2,
+    MATCH_RANK_SECTION = 3,
+    SUBSTITUTION_TABLE_SECTION = 4,
+    NUM_INDEX_SECTIONS = 5,
+
+    SPARSE_KEYS_SECTION = 0,
+    SPARSE_VALUES_SECTION = 1,
+    SPARSE_POSITIONS_SECTION = 2
+};
+
+struct IndexSectionInfo
+{
+    uint64_t offset;    // Position of the section in the file.
+    uint64_t bytes;     // Size of the section.
+    uint64_t length;    // Number of bits or values.
+    uint32_t width;     // Bits per value.
+    uint32_t checksum;  // CRC32 of the section.
+};
+
+struct IndexFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t bcLength;
+    uint32_t numAlts;
+    IndexSectionInfo sections[NUM_INDEX_SECTIONS];
+    uint32_t headerChecksum;  // CRC32 of the header with this field set to zero.
+    uint32_t engine;          // 0 for the dense index, 1 for the sparse index.
+};
+
+uint32_t update_checksum(uint32_t crc, void const * data, uint64_t size);
+std::string index_filename(seqan::CharString const & whitelistFile);
+void write_index_file(std::string const & filename, BarcodeIndex & sbi);
+void map_index_file(BarcodeIndex & sbi, std::string const & filename, bool hugePages);
+void verify_index_file(BarcodeIndex const & sbi);
+
+#endif  // INDEX_FILE_H_
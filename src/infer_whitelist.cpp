@@ -1,47 +1,354 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <fstream>
+#include <mutex>
 #include <seqan/stream.h>
 #include "infer_whitelist.h"
+#include "index_file.h"
+#include "pipeline.h"
 #include "utils.h"
 
 using namespace seqan;
 
-void make_histograms(std::vector<unsigned> & allHist, std::vector<unsigned> & wlHist, std::vector<uint16_t> & count_per_barcode, CharString & whitelistFile, unsigned bcLength)
+// Length of the histograms. The last bin counts the barcodes with HISTOGRAM_SIZE - 1 or more occurrences.
+const unsigned HISTOGRAM_SIZE = 1001;
+
+// Calls f(t, code) for the barcodes without N of the next reads on numThreads threads, where t
+// is the thread. Stops after the batch that reaches maxReads reads. Returns the number of reads.
+template <typename TFunction>
+uint64_t for_each_read_barcode(FastqReader & reader, unsigned bcLength, unsigned numThreads, uint64_t maxReads, TFunction f)
 {
-    resize(allHist, 1000, 0u);
-    resize(wlHist, 1000, 0u);
-    
-    // Read the whitelist file.
-    std::vector<bool> whitelisted;
-    resize(whitelisted, (uint64_t)1 << (2*bcLength), 0);
-    
-    if (whitelistFile != "")
+    std::mutex readerMutex;
+    uint64_t numReads = 0;
+    runParallel(numThreads, [&](unsigned t) {
+        while (true)
+        {
+            FastqBatch * batch = NULL;
+            {
+                std::lock_guard<std::mutex> lock(readerMutex);
+                if (numReads < maxReads)
+                    batch = next_fastq_batch(reader);
+                if (batch != NULL)
+                    numReads += batch->size;
+            }
+            if (batch == NULL)
+                break;
+            for (unsigned i = 0; i < batch->size; ++i)
+            {
+                std::string const & seq = batch->records[i].seq;
+                if (seq.size() < bcLength)
+                    continue;
+                uint64_t h;
+                unsigned posN;
+                if (hash(h, posN, seq.c_str(), bcLength) == 0)
+                    f(t, h);
+            }
+            release_fastq_batch(reader, batch);
+        }
+    });
+    return numReads;
+}
+
+// Counts the barcodes of up to maxReads reads with one thread per shard, each adding to its own
+// shard, and prepares iterating the counts. Returns the number of reads.
+uint64_t count_barcodes(std::vector<std::unique_ptr<BarcodeCounter> > & shards, FastqReader & reader, unsigned bcLength, uint64_t maxReads)
+{
+    uint64_t numReads = for_each_read_barcode(reader, bcLength, shards.size(), maxReads, [&](unsigned t, uint64_t code) {
+        add_barcode(*shards[t], code);
+    });
+    for (auto & shard : shards)
+        finish_counts(*shard);
+    return numReads;
+}
+
+// Reads the whitelisted barcodes of the given length without N into a sorted list.
+void read_whitelist_codes(std::vector<uint64_t> & whitelist, CharString & whitelistFile, unsigned bcLength)
+{
+    std::ifstream infile(toCString(whitelistFile));
+    std::string barcode;
+    while (infile >> barcode)
     {
-        printStatus("Reading whitelist file");
-        std::ifstream infile(toCString(whitelistFile));
-        std::string barcode;
-        DnaString bc;
-        while (infile >> barcode)
+        uint64_t h;
+        unsigned posN;
+        if (barcode.size() == bcLength && hash(h, posN, barcode.c_str(), bcLength) == 0)
+            whitelist.push_back(h);
+    }
+    if (!std::is_sorted(whitelist.begin(), whitelist.end()))
+        std::sort(whitelist.begin(), whitelist.end());
+    whitelist.erase(std::unique(whitelist.begin(), whitelist.end()), whitelist.end());
+}
+
+// Loads the whitelisted barcodes of the given length into a sorted list. They are taken from
+// the index file of the whitelist if the 'index' command has written one for barcodes of this
+// length, otherwise they are read from the whitelist file. Returns true if the index was used.
+bool load_whitelist_codes(std::vector<uint64_t> & whitelist, CharString & whitelistFile, unsigned bcLength)
+{
+    std::string indexFilename = index_filename(whitelistFile);
+    if (fileExists(indexFilename.c_str()))
+    {
+        BarcodeIndex sbi(whitelistFile);
+        if (sbi.bcLength == bcLength)
         {
-            bc = barcode;
-            whitelisted[hash(bc)] = 1;
+            map_index_file(sbi, indexFilename, false);
+            printStatus("Collecting whitelisted barcodes from index");
+            whitelisted_codes(whitelist, sbi);
+            printDone();
+            return true;
         }
-        printDone();
     }
-    
-    // Count the barcodes in histograms.
-    printStatus("Making barcode histogram");
-    for (uint64_t i = 0; i < count_per_barcode.size(); ++i)
+
+    printStatus("Reading whitelist file");
+    read_whitelist_codes(whitelist, whitelistFile, bcLength);
+    printDone();
+    return false;
+}
+
+// Counts the observed barcodes of each partition in histograms of the thread. Barcodes are
+// iterated in the order of the whitelist, thus a single pointer into the whitelist finds the
+// whitelisted ones. The sums of the histograms of all threads do not depend on which thread
+// iterated which partition.
+void compute_histograms(std::vector<unsigned> & allHist, std::vector<unsigned> & wlHist, std::vector<std::unique_ptr<BarcodeCounter> > & shards,
+                        std::vector<uint64_t> const & whitelist, unsigned bcLength, unsigned numThreads)
+{
+    unsigned numParts = count_partitions(bcLength, numThreads);
+    std::vector<std::vector<unsigned> > threadAllHist(numThreads, std::vector<unsigned>(HISTOGRAM_SIZE, 0));
+    std::vector<std::vector<unsigned> > threadWlHist(numThreads, std::vector<unsigned>(HISTOGRAM_SIZE, 0));
+    std::vector<uint64_t> numDistinct(numThreads, 0);
+    std::vector<uint64_t> numWhitelisted(numThreads, 0);
+    std::atomic<unsigned> nextPart(0);
+    runParallel(numThreads, [&](unsigned t) {
+        for (unsigned part = nextPart++; part < numParts; part = nextPart++)
+        {
+            uint64_t first, last;
+            partition_codes(first, last, bcLength, part, numParts);
+            uint64_t next = std::lower_bound(whitelist.begin(), whitelist.end(), first) - whitelist.begin();
+            numDistinct[t] += for_each_barcode_count(shards, part, numParts, [&](uint64_t code, uint32_t count) {
+                unsigned cnt = std::min<uint32_t>(count, HISTOGRAM_SIZE - 1);
+                ++threadAllHist[t][cnt];
+                while (next < whitelist.size() && whitelist[next] < code)
+                    ++next;
+                if (next < whitelist.size() && whitelist[next] == code)
+                {
+                    ++threadWlHist[t][cnt];
+                    ++numWhitelisted[t];
+                }
+            });
+        }
+    });
+
+    allHist.assign(HISTOGRAM_SIZE, 0);
+    wlHist.assign(HISTOGRAM_SIZE, 0);
+    for (unsigned t = 0; t < numThreads; ++t)
+    {
+        for (unsigned i = 0; i < HISTOGRAM_SIZE; ++i)
+        {
+            allHist[i] += threadAllHist[t][i];
+            wlHist[i] += threadWlHist[t][i];
+        }
+    }
+
+    // All other barcodes occur zero times. The number of codes is taken modulo 2^64 and the
+    // bin modulo 2^32 as if each of them had been counted.
+    uint64_t numCodes = bcLength < 32 ? (uint64_t)1 << (2*bcLength) : 0;
+    uint64_t numObserved = 0;
+    uint64_t numObservedWhitelisted = 0;
+    for (unsigned t = 0; t < numThreads; ++t)
     {
-        unsigned cnt = 1000;
-        if (count_per_barcode[i] < cnt)
-            cnt = count_per_barcode[i];
-        ++allHist[cnt];
-        if (whitelistFile != "" && whitelisted[i])
-            ++wlHist[cnt];
+        numObserved += numDistinct[t];
+        numObservedWhitelisted += numWhitelisted[t];
     }
+    allHist[0] += (unsigned)(numCodes - numObserved);
+    wlHist[0] += (unsigned)(whitelist.size() - numObservedWhitelisted);
+}
+
+void make_histograms(std::vector<unsigned> & allHist, std::vector<unsigned> & wlHist, std::vector<std::unique_ptr<BarcodeCounter> > & shards,
+                     std::vector<uint64_t> const & whitelist, unsigned bcLength, unsigned numThreads)
+{
+    printStatus("Making barcode histogram");
+    compute_histograms(allHist, wlHist, shards, whitelist, bcLength, numThreads);
     printDone();
 }
 
+// ---------------------------------------------------------------------------------------
+// Sampled counting
+// ---------------------------------------------------------------------------------------
+
+// Number of reads of the first sample. Each further sample doubles the number of reads.
+const uint64_t FIRST_SAMPLE_READS = (uint64_t)1 << 20;
+
+// Half-width of the boundary band around the cutoff in standard deviations of a Poisson count.
+const double BOUNDARY_DEVIATIONS = 2.0;
+
+// Returns the number of barcodes with at least 'cutoff' occurrences according to a histogram.
+uint64_t barcodes_above(std::vector<unsigned> const & allHist, unsigned cutoff)
+{
+    uint64_t n = 0;
+    for (unsigned i = std::max(cutoff, 1u); i < allHist.size(); ++i)
+        n += allHist[i];
+    return n;
+}
+
+inline double relative_change(double previous, double current)
+{
+    return current == 0 ? (previous == 0 ? 0 : 1) : std::abs(current - previous) / current;
+}
+
+// Counts the barcodes of a growing prefix of the input and infers the cutoff after each
+// sample, i.e. after 2^20, 2^21, ... reads. Stops when the cutoff relative to the number of
+// reads and the number of barcodes above the cutoff changed by at most 'tolerance' since
+// the previous sample, or at the end of the input. The shards then hold the counts of the
+// prefix and allHist and wlHist its histograms.
+void sample_barcodes(WhitelistSample & sample, std::vector<unsigned> & allHist, std::vector<unsigned> & wlHist,
+                     std::vector<std::unique_ptr<BarcodeCounter> > & shards, FastqReader & reader,
+                     std::vector<uint64_t> const & whitelist, unsigned bcLength, unsigned numThreads, double tolerance)
+{
+    uint64_t sampleReads = FIRST_SAMPLE_READS;
+    double previousRate = 0;
+    uint64_t previousAbove = 0;
+    while (true)
+    {
+        if (sample.numSamples != 0)
+            for (auto & shard : shards)
+                resume_counts(*shard);
+        uint64_t maxReads = sampleReads - sample.numReads;
+        uint64_t numReads = count_barcodes(shards, reader, bcLength, maxReads);
+        sample.numReads += numReads;
+        sample.exhausted = numReads < maxReads;
+        ++sample.numSamples;
+
+        compute_histograms(allHist, wlHist, shards, whitelist, bcLength, numThreads);
+        sample.cutoff = infer_cutoff(allHist, wlHist);
+        double rate = (double)sample.cutoff / sample.numReads;
+        uint64_t above = barcodes_above(allHist, sample.cutoff);
+        sample.cutoffChange = relative_change(previousRate, rate);
+        sample.aboveChange = relative_change(previousAbove, above);
+
+        std::ostringstream msg;
+        msg << "Sample " << sample.numSamples << " of " << sample.numReads << " reads: cutoff " << sample.cutoff
+            << ", " << above << " barcodes above.";
+        printInfo(msg);
+
+        if (sample.exhausted)
+            break;
+        if (sample.numSamples > 1 && sample.cutoffChange <= tolerance && sample.aboveChange <= tolerance)
+            break;
+        previousRate = rate;
+        previousAbove = above;
+        sampleReads = std::max(2 * sampleReads, sample.numReads);
+    }
+
+    // Barcodes with a count within the Poisson noise of the cutoff may fall on either side of
+    // it in the full input.
+    double width = BOUNDARY_DEVIATIONS * std::sqrt((double)sample.cutoff);
+    sample.boundaryFirst = (unsigned)std::max(std::ceil(sample.cutoff - width), 1.0);
+    sample.boundaryLast = (unsigned)std::min(std::floor(sample.cutoff + width), (double)MAX_BARCODE_COUNT);
+    sample.numBoundary = 0;
+    for (unsigned i = sample.boundaryFirst; i <= sample.boundaryLast && i < allHist.size(); ++i)
+        sample.numBoundary += allHist[i];
+}
+
+// Counts the boundary barcodes of a sample in the rest of the input. Afterwards, the whitelist
+// includes a boundary barcode if its count in the full input reaches the cutoff scaled to the
+// number of reads of the full input.
+void refine_boundary(WhitelistSample & sample, std::vector<std::unique_ptr<BarcodeCounter> > & shards, FastqReader & reader,
+                     unsigned bcLength, unsigned numThreads)
+{
+    // Collect the boundary barcodes and their counts in the sample in lexicographical order.
+    unsigned numParts = count_partitions(bcLength, numThreads);
+    std::vector<std::vector<std::pair<uint64_t, uint32_t> > > partBoundary(numParts);
+    std::atomic<unsigned> nextPart(0);
+    runParallel(numThreads, [&](unsigned) {
+        for (unsigned part = nextPart++; part < numParts; part = nextPart++)
+        {
+            for_each_barcode_count(shards, part, numParts, [&](uint64_t code, uint32_t count) {
+                if (count >= sample.boundaryFirst && count <= sample.boundaryLast)
+                    partBoundary[part].push_back(std::make_pair(code, count));
+            });
+        }
+    });
+    sample.boundary.clear();
+    for (auto const & part : partBoundary)
+        sample.boundary.insert(sample.boundary.end(), part.begin(), part.end());
+
+    // Count them in the rest of the input.
+    std::vector<std::vector<uint32_t> > threadCounts(numThreads, std::vector<uint32_t>(sample.boundary.size(), 0));
+    auto lessCode = [](std::pair<uint64_t, uint32_t> const & entry, uint64_t code) { return entry.first < code; };
+    uint64_t numReads = for_each_read_barcode(reader, bcLength, numThreads, ~(uint64_t)0, [&](unsigned t, uint64_t code) {
+        auto it = std::lower_bound(sample.boundary.begin(), sample.boundary.end(), code, lessCode);
+        if (it != sample.boundary.end() && it->first == code)
+            ++threadCounts[t][it - sample.boundary.begin()];
+    });
+    for (uint64_t i = 0; i < sample.boundary.size(); ++i)
+        for (unsigned t = 0; t < numThreads; ++t)
+            sample.boundary[i].second += threadCounts[t][i];
+
+    sample.totalReads = sample.numReads + numReads;
+    sample.fullCutoff = (double)sample.cutoff * sample.totalReads / sample.numReads;
+    sample.refined = true;
+}
+
+// Whether the whitelist includes a barcode with the given count in the sample.
+bool whitelisted_in_sample(WhitelistSample const & sample, uint64_t code, uint32_t count)
+{
+    if (sample.refined && count >= sample.boundaryFirst && count <= sample.boundaryLast)
+    {
+        auto it = std::lower_bound(sample.boundary.begin(), sample.boundary.end(), std::make_pair(code, (uint32_t)0));
+        return it != sample.boundary.end() && it->first == code && it->second >= sample.fullCutoff;
+    }
+    return count >= sample.cutoff;
+}
+
+// Partition of the codes and the lines of the whitelist for its barcodes.
+struct WhitelistBatch
+{
+    uint64_t id;
+    unsigned part;
+    std::string lines;
+    uint64_t numBarcodes;
+};
+
+// Writes the barcodes for which include(code, count) holds and that have an entropy of at least
+// minEntropy in lexicographical order. Partitions are filtered in parallel and written in
+// their order, thus the whitelist does not depend on the number of threads. Returns the number
+// of barcodes written.
+uint64_t write_whitelist(std::ofstream & out, std::vector<std::unique_ptr<BarcodeCounter> > & shards, unsigned bcLength,
+                         std::function<bool(uint64_t, uint32_t)> const & include, double minEntropy, unsigned numThreads)
+{
+    unsigned numParts = count_partitions(bcLength, numThreads);
+    std::vector<WhitelistBatch> batches(2 * numThreads);
+    unsigned nextPart = 0;
+    uint64_t numBarcodes = 0;
+    runPipeline(batches,
+        [&](WhitelistBatch & batch) {
+            if (nextPart == numParts)
+                return false;
+            batch.part = nextPart++;
+            return true;
+        },
+        [&](WhitelistBatch & batch, unsigned /*threadId*/) {
+            batch.lines.clear();
+            batch.numBarcodes = 0;
+            for_each_barcode_count(shards, batch.part, numParts, [&](uint64_t code, uint32_t count) {
+                if (!include(code, count))
+                    return;
+                DnaString bc = unhash(code, bcLength);
+                if (entropy(bc) < minEntropy)
+                    return;
+                CharString chars = bc;
+                batch.lines.append(toCString(chars), length(chars));
+                batch.lines.push_back('\n');
+                ++batch.numBarcodes;
+            });
+        },
+        [&](WhitelistBatch & batch) {
+            out << batch.lines;
+            numBarcodes += batch.numBarcodes;
+        },
+        numThreads, true);
+    return numBarcodes;
+}
+
 double entropy(DnaString & bc)
 {
     // Count dinucleotide occurrences
@@ -1,16 +1,62 @@
 #ifndef INFER_WHITELIST_H_
 #define INFER_WHITELIST_H_
 
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <vector>
 #include <seqan/sequence.h>
 #include <zlib.h>
 #include <htslib/kseq.h>
 
+#include "barcode_counts.h"
+#include "fastq_reader.h"
+
 #ifndef KSEQ_GZ
 #define KSEQ_GZ
 KSEQ_INIT(gzFile, gzread)
 #endif  // KSEQ_GZ
 
-void make_histograms(std::vector<unsigned> & allHist,std::vector<unsigned> & wlHist, std::vector<uint16_t> & counts_per_barcode, seqan::CharString & whitelistFile, unsigned bcLength);
+// Result of counting a prefix of the input until the inferred cutoff is stable.
+struct WhitelistSample
+{
+    uint64_t numReads;          // Reads of the prefix.
+    unsigned numSamples;
+    bool exhausted;             // Whether the prefix is the whole input.
+    unsigned cutoff;            // Cutoff inferred from the counts of the prefix.
+    double cutoffChange;        // Relative change of cutoff / numReads since the previous sample.
+    double aboveChange;         // Relative change of the number of barcodes above the cutoff.
+
+    // Band of counts around the cutoff and the number of barcodes in it.
+    unsigned boundaryFirst;
+    unsigned boundaryLast;
+    uint64_t numBoundary;
+
+    // Counts of the boundary barcodes in the full input if it has been read to its end.
+    bool refined;
+    uint64_t totalReads;
+    double fullCutoff;
+    std::vector<std::pair<uint64_t, uint32_t> > boundary;
+
+    WhitelistSample() :
+        numReads(0), numSamples(0), exhausted(false), cutoff(1), cutoffChange(1), aboveChange(1),
+        boundaryFirst(1), boundaryLast(1), numBoundary(0), refined(false), totalReads(0), fullCutoff(0)
+    {}
+};
+
+bool load_whitelist_codes(std::vector<uint64_t> & whitelist, seqan::CharString & whitelistFile, unsigned bcLength);
+uint64_t count_barcodes(std::vector<std::unique_ptr<BarcodeCounter> > & shards, FastqReader & reader, unsigned bcLength,
+                        uint64_t maxReads = ~(uint64_t)0);
+void make_histograms(std::vector<unsigned> & allHist, std::vector<unsigned> & wlHist, std::vector<std::unique_ptr<BarcodeCounter> > & shards,
+                     std::vector<uint64_t> const & whitelist, unsigned bcLength, unsigned numThreads);
+void sample_barcodes(WhitelistSample & sample, std::vector<unsigned> & allHist, std::vector<unsigned> & wlHist,
+                     std::vector<std::unique_ptr<BarcodeCounter> > & shards, FastqReader & reader,
+                     std::vector<uint64_t> const & whitelist, unsigned bcLength, unsigned numThreads, double tolerance);
+void refine_boundary(WhitelistSample & sample, std::vector<std::unique_ptr<BarcodeCounter> > & shards, FastqReader & reader,
+                     unsigned bcLength, unsigned numThreads);
+bool whitelisted_in_sample(WhitelistSample const & sample, uint64_t code, uint32_t count);
+uint64_t write_whitelist(std::ofstream & out, std::vector<std::unique_ptr<BarcodeCounter> > & shards, unsigned bcLength,
+                         std::function<bool(uint64_t, uint32_t)> const & include, double minEntropy, unsigned numThreads);
 double entropy(seqan::DnaString & bc);
 unsigned infer_cutoff(std::vector<unsigned> & allHist, std::vector<unsigned> & wlHist);
 #endif  // INFER_WHITELIST_H_
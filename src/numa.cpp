@@ -0,0 +1,139 @@
+#include <dirent.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+
+#include "numa.h"
+
+// Memory policies of set_mempolicy(2).
+const int MEMORY_POLICY_DEFAULT = 0;
+const int MEMORY_POLICY_PREFERRED = 1;
+const int MEMORY_POLICY_INTERLEAVE = 3;
+
+// Highest node number supported by the node masks.
+const unsigned MAX_NUMA_NODES = 1024;
+
+char const * numa_placement_name(NumaPlacement placement)
+{
+    switch (placement)
+    {
+        case NumaPlacement::INTERLEAVE:
+            return "interleave";
+        case NumaPlacement::REPLICATE:
+            return "replicate";
+        default:
+            return "none";
+    }
+}
+
+// Parses a CPU list like "0-7,16-23".
+void parse_cpu_list(std::vector<unsigned> & cpus, std::string const & list)
+{
+    size_t pos = 0;
+    while (pos < list.size())
+    {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos)
+            end = list.size();
+        std::string range = list.substr(pos, end - pos);
+        size_t dash = range.find('-');
+        if (!range.empty())
+        {
+            unsigned first = std::strtoul(range.c_str(), NULL, 10);
+            unsigned last = dash == std::string::npos ? first : std::strtoul(range.c_str() + dash + 1, NULL, 10);
+            for (unsigned cpu = first; cpu <= last; ++cpu)
+                cpus.push_back(cpu);
+        }
+        pos = end + 1;
+    }
+}
+
+// Reads the nodes with CPUs. The topology is empty if the system does not expose NUMA nodes.
+void read_numa_topology(NumaTopology & topology)
+{
+    topology.nodes.clear();
+    topology.cpus.clear();
+
+    DIR * dir = opendir("/sys/devices/system/node");
+    if (dir == NULL)
+        return;
+    std::vector<unsigned> nodes;
+    while (dirent * entry = readdir(dir))
+    {
+        std::string name = entry->d_name;
+        if (name.compare(0, 4, "node") == 0 && name.size() > 4 && name.find_first_not_of("0123456789", 4) == std::string::npos)
+            nodes.push_back(std::strtoul(name.c_str() + 4, NULL, 10));
+    }
+    closedir(dir);
+    std::sort(nodes.begin(), nodes.end());
+
+    for (unsigned node : nodes)
+    {
+        std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        std::string list;
+        std::getline(file, list);
+        std::vector<unsigned> cpus;
+        parse_cpu_list(cpus, list);
+        if (cpus.empty() || node >= MAX_NUMA_NODES)
+            continue;
+        topology.nodes.push_back(node);
+        topology.cpus.push_back(cpus);
+    }
+}
+
+inline bool set_memory_policy(int mode, unsigned long const * mask)
+{
+    return syscall(SYS_set_mempolicy, mode, mask, mask == NULL ? 0 : MAX_NUMA_NODES + 1) == 0;
+}
+
+// Interleaves the pages allocated by this thread from now on over all nodes with CPUs.
+bool interleave_memory_policy(NumaTopology const & topology)
+{
+    unsigned long mask[MAX_NUMA_NODES / (8 * sizeof(unsigned long))] = {};
+    for (unsigned node : topology.nodes)
+        mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+    return set_memory_policy(MEMORY_POLICY_INTERLEAVE, mask);
+}
+
+// Allocates the pages of this thread from now on on the node if it has free memory.
+bool preferred_node_memory_policy(unsigned node)
+{
+    unsigned long mask[MAX_NUMA_NODES / (8 * sizeof(unsigned long))] = {};
+    mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+    return set_memory_policy(MEMORY_POLICY_PREFERRED, mask);
+}
+
+void reset_memory_policy()
+{
+    set_memory_policy(MEMORY_POLICY_DEFAULT, NULL);
+}
+
+// Restricts the calling thread to the CPUs of the k-th node of the topology.
+bool pin_thread_to_node(NumaTopology const & topology, unsigned k)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (unsigned cpu : topology.cpus[k])
+        if (cpu < CPU_SETSIZE)
+            CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+// Returns the index of the worker thread and pins the thread to the node of its replica when
+// it first processes a batch.
+BarcodeIndex & worker_index(IndexPlacement & index, unsigned threadId)
+{
+    static thread_local int pinnedNode = -1;
+
+    unsigned k = threadId % index.replicas.size();
+    if (index.placement == NumaPlacement::REPLICATE && pinnedNode != (int)k)
+    {
+        pin_thread_to_node(index.topology, k);
+        pinnedNode = k;
+    }
+    return *index.replicas[k];
+}
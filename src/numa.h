@@ -0,0 +1,45 @@
+#ifndef NUMA_H_
+#define NUMA_H_
+
+#include <memory>
+#include <vector>
+
+#include "barcode_index.h"
+
+// -----------------------------------------------------------------------------
+// NUMA placement of the barcode index
+// -----------------------------------------------------------------------------
+
+// Without a placement, the pages of the index end up on the node of the thread that loaded or
+// built it. INTERLEAVE spreads the pages of a single index over all nodes. REPLICATE loads one
+// copy of the index per node and pins each worker thread to the CPUs of the node whose copy it
+// uses. Memory policies and thread affinities are set with the system calls directly, thus
+// no NUMA library is needed.
+
+// NUMA nodes with CPUs and their CPUs as listed in /sys/devices/system/node.
+struct NumaTopology
+{
+    std::vector<unsigned> nodes;
+    std::vector<std::vector<unsigned> > cpus;
+};
+
+// Barcode indices of the worker threads. Worker t uses replicas[t % replicas.size()] and, if
+// the index is replicated, runs on the CPUs of node topology.nodes[t % replicas.size()].
+struct IndexPlacement
+{
+    NumaPlacement placement;
+    NumaTopology topology;
+    std::vector<std::unique_ptr<BarcodeIndex> > replicas;
+
+    IndexPlacement() : placement(NumaPlacement::NONE) {}
+};
+
+char const * numa_placement_name(NumaPlacement placement);
+void read_numa_topology(NumaTopology & topology);
+bool interleave_memory_policy(NumaTopology const & topology);
+bool preferred_node_memory_policy(unsigned node);
+void reset_memory_policy();
+bool pin_thread_to_node(NumaTopology const & topology, unsigned k);
+BarcodeIndex & worker_index(IndexPlacement & index, unsigned threadId);
+
+#endif  // NUMA_H_
@@ -0,0 +1,46 @@
+#include <algorithm>
+#include <cerrno>
+#include <unistd.h>
+#include <seqan/stream.h>
+
+#include "output_buffer.h"
+
+// Makes room for appending n more bytes by writing the buffer to its file or by growing it.
+void OutputBuffer::makeRoom(size_t n)
+{
+    if (fd >= 0)
+        flush();
+    if (size + n > data.size())
+        data.resize(std::max(2 * data.size(), size + n));
+}
+
+void OutputBuffer::flush()
+{
+    if (fd >= 0 && size > 0)
+        write_all(fd, &data[0], size);
+    size = 0;
+}
+
+void write_all(int fd, char const * data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t written = ::write(fd, data, size);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            std::ostringstream what;
+            what << "Writing output failed: " << std::strerror(errno);
+            SEQAN_THROW(seqan::IOError(what.str()));
+        }
+        data += written;
+        size -= written;
+    }
+}
+
+void write_all(int fd, OutputBuffer const & buffer)
+{
+    if (buffer.size > 0)
+        write_all(fd, &buffer.data[0], buffer.size);
+}
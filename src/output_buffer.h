@@ -0,0 +1,59 @@
+#ifndef OUTPUT_BUFFER_H_
+#define OUTPUT_BUFFER_H_
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+// Reusable byte buffer for formatting output
+// -----------------------------------------------------------------------------
+
+// Default capacity of an output buffer.
+const size_t OUTPUT_BUFFER_SIZE = 1 << 22;
+
+// Bytes are appended with memcpy. A buffer with a file descriptor is written to it
+// with a single write() whenever it is full, a buffer without one (fd = -1) grows.
+struct OutputBuffer
+{
+    std::vector<char> data;
+    size_t size;
+    int fd;
+
+    explicit OutputBuffer(int fd = -1, size_t capacity = OUTPUT_BUFFER_SIZE) :
+        data(capacity), size(0), fd(fd)
+    {}
+
+    void append(char const * s, size_t n)
+    {
+        if (size + n > data.size())
+            makeRoom(n);
+        std::memcpy(&data[size], s, n);
+        size += n;
+    }
+
+    void append(std::string const & s)
+    {
+        append(s.data(), s.size());
+    }
+
+    void append(char c)
+    {
+        if (size == data.size())
+            makeRoom(1);
+        data[size++] = c;
+    }
+
+    void clear()
+    {
+        size = 0;
+    }
+
+    void makeRoom(size_t n);
+    void flush();
+};
+
+void write_all(int fd, char const * data, size_t size);
+void write_all(int fd, OutputBuffer const & buffer);
+
+#endif  // OUTPUT_BUFFER_H_
@@ -0,0 +1,210 @@
+#ifndef PIPELINE_H_
+#define PIPELINE_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+// Queue for passing batches between threads
+// -----------------------------------------------------------------------------
+
+template <typename TValue>
+struct WorkQueue
+{
+    std::queue<TValue> values;
+    std::mutex mutex;
+    std::condition_variable changed;
+    bool closed;
+
+    WorkQueue() : closed(false) {}
+
+    void push(TValue value)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            values.push(value);
+        }
+        changed.notify_one();
+    }
+
+    // Blocks until a value is available. Returns false if the queue is closed and empty.
+    bool pop(TValue & value)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this]{ return !values.empty() || closed; });
+        if (values.empty())
+            return false;
+        value = values.front();
+        values.pop();
+        return true;
+    }
+
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+        }
+        changed.notify_all();
+    }
+};
+
+// -----------------------------------------------------------------------------
+// Function runPipeline()
+// -----------------------------------------------------------------------------
+
+// Streams batches through a reader, 'numThreads' workers and a single writer.
+//
+// The calling thread reads: readBatch(batch) fills a batch and returns false at
+// the end of the input. Worker threads call processBatch(batch, threadId). The
+// writer thread calls writeBatch(batch) in the order the batches were read, or
+// in the order they finish if 'ordered' is false. Batches are recycled, so at
+// most batches.size() of them are in flight. Each batch needs a member 'id'.
+// The first exception thrown by any stage stops the pipeline and is rethrown.
+template <typename TBatch, typename TRead, typename TProcess, typename TWrite>
+void runPipeline(std::vector<TBatch> & batches,
+                 TRead readBatch,
+                 TProcess processBatch,
+                 TWrite writeBatch,
+                 unsigned numThreads,
+                 bool ordered)
+{
+    // Without additional threads, simply run all stages one after the other.
+    if (numThreads <= 1)
+    {
+        TBatch & batch = batches[0];
+        batch.id = 0;
+        while (readBatch(batch))
+        {
+            processBatch(batch, 0u);
+            writeBatch(batch);
+            ++batch.id;
+        }
+        return;
+    }
+
+    WorkQueue<TBatch *> emptyBatches;
+    WorkQueue<TBatch *> readBatches;
+    WorkQueue<TBatch *> processedBatches;
+    for (TBatch & batch : batches)
+        emptyBatches.push(&batch);
+
+    // After a failure, batches still pass through all queues but are not touched anymore.
+    std::atomic<bool> failed(false);
+    std::exception_ptr error;
+    std::mutex errorMutex;
+    auto fail = [&]() {
+        std::lock_guard<std::mutex> lock(errorMutex);
+        if (!error)
+            error = std::current_exception();
+        failed = true;
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < numThreads; ++t)
+    {
+        workers.emplace_back([&, t]() {
+            TBatch * batch;
+            while (readBatches.pop(batch))
+            {
+                if (!failed)
+                {
+                    try { processBatch(*batch, t); }
+                    catch (...) { fail(); }
+                }
+                processedBatches.push(batch);
+            }
+        });
+    }
+
+    std::thread writer([&]() {
+        std::map<uint64_t, TBatch *> pending;
+        uint64_t nextId = 0;
+        TBatch * batch;
+        while (processedBatches.pop(batch))
+        {
+            // Hold back batches until all batches read before them are written.
+            pending[ordered ? batch->id : nextId] = batch;
+            while (!pending.empty() && pending.begin()->first == nextId)
+            {
+                if (!failed)
+                {
+                    try { writeBatch(*pending.begin()->second); }
+                    catch (...) { fail(); }
+                }
+                emptyBatches.push(pending.begin()->second);
+                pending.erase(pending.begin());
+                ++nextId;
+            }
+        }
+    });
+
+    uint64_t id = 0;
+    TBatch * batch;
+    while (!failed && emptyBatches.pop(batch))
+    {
+        batch->id = id;
+        try
+        {
+            if (!readBatch(*batch))
+                break;
+        }
+        catch (...)
+        {
+            fail();
+            break;
+        }
+        readBatches.push(batch);
+        ++id;
+    }
+    readBatches.close();
+
+    for (std::thread & worker : workers)
+        worker.join();
+    processedBatches.close();
+    writer.join();
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
+// -----------------------------------------------------------------------------
+// Function runParallel()
+// -----------------------------------------------------------------------------
+
+// Calls process(t) for t = 0..numThreads-1 on numThreads threads and waits for all of them.
+// The first exception thrown by any thread is rethrown.
+template <typename TProcess>
+void runParallel(unsigned numThreads, TProcess process)
+{
+    std::exception_ptr error;
+    std::mutex errorMutex;
+    auto run = [&](unsigned t) {
+        try { process(t); }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            if (!error)
+                error = std::current_exception();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned t = 1; t < numThreads; ++t)
+        threads.emplace_back(run, t);
+    run(0);
+    for (std::thread & thread : threads)
+        thread.join();
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
+#endif  // PIPELINE_H_
@@ -0,0 +1,147 @@
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <seqan/sequence.h>
+
+#include "sparse_index.h"
+#include "utils.h"
+
+using namespace seqan;
+
+// Estimated bytes per entry of the sparse index: key and value at a load factor of at most
+// 0.7 and the substitution positions.
+const double SPARSE_BYTES_PER_ENTRY = 24 / 0.7 + 2;
+
+// Neighbour of a whitelisted barcode. 'order' is the position of the barcode in the whitelist
+// times bcLength plus the substituted position, i.e. the order the dense index adds them in,
+// times 4 plus the base of the whitelisted barcode at the substituted position.
+struct SparseNeighbour
+{
+    BarcodeCode code;
+    uint64_t order;
+
+    bool operator<(SparseNeighbour const & other) const
+    {
+        return code < other.code || (code == other.code && order < other.order);
+    }
+};
+
+// Chooses the sparse index if barcodes do not fit into 64-bit codes or if the sparse index
+// is estimated to take less memory than the barcode table of the dense index.
+bool use_sparse_index(unsigned bcLength, uint64_t numBarcodes)
+{
+    if (bcLength > 32)
+        return true;
+    double dense = std::ldexp(1.0, 2 * bcLength) * 1.25 / 8;
+    double sparse = numBarcodes * (3.0 * bcLength + 1) * SPARSE_BYTES_PER_ENTRY;
+    return sparse < dense;
+}
+
+void attach_sparse_index(SparseIndex & index, uint64_t const * keys, uint64_t const * values, uint8_t const * positions,
+                         uint64_t numSlots, uint64_t numPositions)
+{
+    index.keys = keys;
+    index.values = values;
+    index.positions = positions;
+    index.numSlots = numSlots;
+    index.numPositions = numPositions;
+    index.shift = 64;
+    for (uint64_t n = numSlots; n > 1; n >>= 1)
+        --index.shift;
+}
+
+inline void sparse_insert(SparseIndex & index, BarcodeCode const & code, uint64_t value)
+{
+    uint64_t slot = sparse_slot(index, code);
+    while (index.key_storage[2 * slot] != SPARSE_EMPTY)
+        slot = (slot + 1) & (index.numSlots - 1);
+    index.key_storage[2 * slot] = code.hi;
+    index.key_storage[2 * slot + 1] = code.lo;
+    index.value_storage[slot] = value;
+}
+
+// Builds the index with the same statuses and substitution positions as the dense index: a
+// neighbour is a ONE_ERROR barcode unless it is whitelisted itself or has more than numAlts
+// alternatives, in which case it is not stored at all.
+void build_sparse_index(SparseIndex & index, CharString & filename, unsigned bcLength, unsigned numAlts)
+{
+    printStatus("Building sparse barcode index");
+
+    // Read the whitelist. The rank of a barcode is its position in lexicographical order.
+    std::vector<BarcodeCode> barcodes;
+    std::ifstream infile(toCString(filename));
+    std::string barcode;
+    while (infile >> barcode)
+    {
+        DnaString bc = barcode;
+        barcodes.push_back(hash_long(bc));
+    }
+    std::vector<BarcodeCode> whitelist(barcodes);
+    std::sort(whitelist.begin(), whitelist.end());
+    whitelist.erase(std::unique(whitelist.begin(), whitelist.end()), whitelist.end());
+
+    // Collect the neighbours of all barcodes grouped by code.
+    std::vector<SparseNeighbour> neighbours;
+    neighbours.reserve(barcodes.size() * 3 * bcLength);
+    for (uint64_t n = 0; n < barcodes.size(); ++n)
+    {
+        for (unsigned i = 0; i < bcLength; ++i)
+        {
+            uint64_t base = (i < 32 ? barcodes[n].lo >> 2*i : barcodes[n].hi >> 2*(i - 32)) & 3;
+            uint64_t order = (n * bcLength + i) << 2 | base;
+            neighbours.push_back({substitute(barcodes[n], i, 1), order});
+            neighbours.push_back({substitute(barcodes[n], i, 3), order});
+            neighbours.push_back({substitute(barcodes[n], i, 2), order});
+        }
+    }
+    std::vector<BarcodeCode>().swap(barcodes);
+    std::sort(neighbours.begin(), neighbours.end());
+
+    // Count the ONE_ERROR barcodes and their substitution positions to size the tables.
+    uint64_t numOneError = 0;
+    uint64_t numPositions = 0;
+    for (uint64_t first = 0, last; first < neighbours.size(); first = last)
+    {
+        for (last = first + 1; last < neighbours.size() && neighbours[last].code == neighbours[first].code; ++last) ;
+        if (last - first <= numAlts && !std::binary_search(whitelist.begin(), whitelist.end(), neighbours[first].code))
+        {
+            ++numOneError;
+            numPositions += 1 + last - first;
+        }
+    }
+
+    uint64_t numSlots = 16;
+    while (numSlots * 7 < (whitelist.size() + numOneError) * 10)
+        numSlots *= 2;
+    index.key_storage.assign(2 * numSlots, SPARSE_EMPTY);
+    index.value_storage.assign(numSlots, 0);
+    index.position_storage.clear();
+    index.position_storage.reserve((numPositions + 7) / 8 * 8);
+    attach_sparse_index(index, index.key_storage.data(), index.value_storage.data(), NULL, numSlots, numPositions);
+
+    // Insert the whitelisted barcodes and the ONE_ERROR barcodes.
+    for (uint64_t rank = 0; rank < whitelist.size(); ++rank)
+        sparse_insert(index, whitelist[rank], SPARSE_MATCH | rank);
+    for (uint64_t first = 0, last; first < neighbours.size(); first = last)
+    {
+        for (last = first + 1; last < neighbours.size() && neighbours[last].code == neighbours[first].code; ++last) ;
+        if (last - first > numAlts || std::binary_search(whitelist.begin(), whitelist.end(), neighbours[first].code))
+            continue;
+
+        sparse_insert(index, neighbours[first].code, SPARSE_ONE_ERROR | index.position_storage.size());
+        index.position_storage.push_back(last - first);
+        for (uint64_t k = first; k < last; ++k)
+            index.position_storage.push_back(((neighbours[k].order >> 2) % bcLength) << 2 | (neighbours[k].order & 3));
+    }
+
+    // Pad the positions to whole words as they are stored in the index file.
+    index.position_storage.resize((numPositions + 7) / 8 * 8, 0);
+    attach_sparse_index(index, index.key_storage.data(), index.value_storage.data(), index.position_storage.data(),
+                        numSlots, numPositions);
+    printDone();
+
+    std::ostringstream msg;
+    msg << "Sparse barcode index holds " << whitelist.size() << " whitelisted barcodes and " << numOneError
+        << " barcodes with one substitution in " << numSlots << " slots.";
+    printInfo(msg);
+}
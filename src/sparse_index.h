@@ -0,0 +1,82 @@
+#ifndef SPARSE_INDEX_H_
+#define SPARSE_INDEX_H_
+
+#include <cstdint>
+#include <vector>
+#include <seqan/sequence.h>
+
+#include "utils.h"
+
+// -----------------------------------------------------------------------------
+// Sparse barcode index
+// -----------------------------------------------------------------------------
+
+// Index for long barcodes and small whitelists that stores only the whitelisted barcodes
+// and their neighbours with one substitution instead of tables over all 4^bcLength codes.
+// Codes are kept in an open-addressing hash table with linear probing. The value of a
+// whitelisted barcode is its rank in the whitelist. The value of a neighbour is an offset
+// into a list of substitution entries, the number of entries followed by the entries in the
+// order the dense index stores them. An entry holds the substituted position and the base of
+// the whitelisted barcode as (position << 2 | base).
+
+// Values of the hash table. Empty slots have a key with all bits of 'hi' set, which is no
+// code of a barcode with less than 64 bases.
+const uint64_t SPARSE_MATCH = (uint64_t)1 << 62;
+const uint64_t SPARSE_ONE_ERROR = (uint64_t)2 << 62;
+const uint64_t SPARSE_STATUS = (uint64_t)3 << 62;
+const uint64_t SPARSE_PAYLOAD = ~SPARSE_STATUS;
+const uint64_t SPARSE_EMPTY = ~(uint64_t)0;
+
+// Longest barcode supported by the sparse index.
+const unsigned MAX_SPARSE_BARCODE_LENGTH = 63;
+
+struct SparseIndex
+{
+    // Lookup tables: the (hi, lo) keys and values of all slots and the substitution
+    // positions. They point either into the storage below or into a mapped index file.
+    uint64_t const * keys;
+    uint64_t const * values;
+    uint8_t const * positions;
+    uint64_t numSlots;
+    uint64_t numPositions;
+    unsigned shift;
+
+    std::vector<uint64_t> key_storage;
+    std::vector<uint64_t> value_storage;
+    std::vector<uint8_t> position_storage;
+
+    SparseIndex() : keys(NULL), values(NULL), positions(NULL), numSlots(0), numPositions(0), shift(64) {}
+};
+
+inline uint64_t sparse_slot(SparseIndex const & index, BarcodeCode const & code)
+{
+    uint64_t x = (code.lo ^ (code.hi * 0x9E3779B97F4A7C15ULL)) * 0xFF51AFD7ED558CCDULL;
+    return x >> index.shift;
+}
+
+// Returns the value of the code or 0 if it is not in the index.
+inline uint64_t sparse_lookup(SparseIndex const & index, BarcodeCode const & code)
+{
+    uint64_t slot = sparse_slot(index, code);
+    while (true)
+    {
+        uint64_t const * key = index.keys + 2 * slot;
+        if (key[1] == code.lo && key[0] == code.hi)
+            return index.values[slot];
+        if (key[0] == SPARSE_EMPTY)
+            return 0;
+        slot = (slot + 1) & (index.numSlots - 1);
+    }
+}
+
+inline void prefetch_sparse(SparseIndex const & index, BarcodeCode const & code)
+{
+    __builtin_prefetch(index.keys + 2 * sparse_slot(index, code));
+}
+
+bool use_sparse_index(unsigned bcLength, uint64_t numBarcodes);
+void build_sparse_index(SparseIndex & index, seqan::CharString & filename, unsigned bcLength, unsigned numAlts);
+void attach_sparse_index(SparseIndex & index, uint64_t const * keys, uint64_t const * values, uint8_t const * positions,
+                         uint64_t numSlots, uint64_t numPositions);
+
+#endif  // SPARSE_INDEX_H_
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cstring>
 #include <fstream>
 #include <seqan/stream.h>
 #include <seqan/bam_io.h>
@@ -56,6 +58,16 @@ void count_read_pair(BarcodeStats & stats, Dna5String barcode, std::vector<DnaSt
             stats.one_error_hist[qv].resize(length(barcode));
         ++stats.one_error_hist[qv][mismatch_pos[0]];
     }
+    else if (mismatch_pos.size() == 2)
+    {
+        ++stats.two_errors;
+    }
+    else
+    {
+        // Corrections have at most two substitutions. Other read pairs count as unrecognized
+        // so that the totals add up to the number of read pairs.
+        ++stats.unrecognized;
+    }
 }
 
 void write_stats(CharString & outputFile, BarcodeStats & stats)
@@ -64,6 +76,7 @@ void write_stats(CharString & outputFile, BarcodeStats & stats)
 
     out << "ERROR_FREE_BARCODES" << "\t" << stats.error_free << std::endl;
     out << "ONE_MISMATCH_BARCODES" << "\t" << stats.one_error << std::endl;
+    out << "TWO_MISMATCH_BARCODES" << "\t" << stats.two_errors << std::endl;
     out << "UNRECOGNIZED_BARCODES" << "\t" << stats.unrecognized << std::endl;
 
     out << "BARCODE_COUNT_HIST";
@@ -79,15 +92,33 @@ void write_stats(CharString & outputFile, BarcodeStats & stats)
         out << std::endl;
     }
 
+    if (!stats.raw_count_hist.empty())
+    {
+        out << "RAW_READS" << "\t" << stats.raw_reads << std::endl;
+        out << "RAW_DISTINCT_BARCODES" << "\t" << stats.raw_barcodes << std::endl;
+        out << "RAW_BARCODE_COUNT_HIST";
+        for (unsigned i = 0; i < stats.raw_count_hist.size(); ++i)
+            out << "\t" << stats.raw_count_hist[i];
+        out << std::endl;
+    }
+
     out.close();
 }
 
-void parse_kseq_comment(Dna5String & barcode, std::vector<seqan::DnaString> & barcodeCorrected, kstring_t * comment)
+// Parses the RX and BX tags of a FASTQ comment. Returns false if the comment has neither, e.g.
+// for the second reads of an interleaved FASTQ file.
+bool parse_kseq_comment(Dna5String & barcode, std::vector<seqan::DnaString> & barcodeCorrected, kstring_t * comment)
 {
-    for (unsigned i = 0; i < strlen(comment->s) - 5; ++i)
+    if (comment->s == NULL)
+        return false;
+
+    bool tagged = false;
+    size_t len = comment->l;
+    for (size_t i = 0; i + 5 < len; ++i)
     {
         if (comment->s[i] == 'B' && comment->s[i+1] == 'X')
         {
+            tagged = true;
             i += 5;
             if (comment->s[i] == '*')
             {
@@ -95,30 +126,32 @@ void parse_kseq_comment(Dna5String & barcode, std::vector<seqan::DnaString> & ba
             }
             else
             {
-                while (i < strlen(comment->s) && !isspace(comment->s[i]))
+                while (i < len && !isspace(comment->s[i]))
                 {
                     DnaString bc;
-                    while (i < strlen(comment->s) && !isspace(comment->s[i]) && comment->s[i] != ',')
+                    while (i < len && !isspace(comment->s[i]) && comment->s[i] != ',')
                     {
                         appendValue(bc, comment->s[i]);
                         ++i;
                     }
                     barcodeCorrected.push_back(bc);
-                    if (comment->s[i] == ',')
+                    if (i < len && comment->s[i] == ',')
                         ++i;
                 }
             }
         }
         else if (comment->s[i] == 'R' && comment->s[i+1] == 'X')
         {
+            tagged = true;
             i += 5;
-            while (i < strlen(comment->s) && !isspace(comment->s[i]))
+            while (i < len && !isspace(comment->s[i]))
             {
                 appendValue(barcode, comment->s[i]);
                 ++i;
             }
         }
     }
+    return tagged;
 }
 
 void stats_tsv(BarcodeStats & stats, CharString & inputFile)
@@ -152,21 +185,16 @@ void stats_fastq(BarcodeStats & stats, CharString & inputFile)
 
     printStatus("Streaming over the input FASTQ file");
 
-    Dna5String bc;
-    std::vector<seqan::DnaString> bcCorrected;
-    parse_kseq_comment(bc, bcCorrected, &seq->comment);
-
-    // Count the first pair.
-    count_read_pair(stats, bc, bcCorrected, seq->qual.s);
-
-    // Iterate and count the remaining FASTQ records.
-    while (kseq_read(seq) >= 0)
+    // Count the first reads of all pairs. Records without barcode tags are the second reads of
+    // an interleaved file.
+    do
     {
         Dna5String barcode;
         std::vector<seqan::DnaString> barcodeCorrected;
-        parse_kseq_comment(barcode, barcodeCorrected, &seq->comment);
-        count_read_pair(stats, barcode, barcodeCorrected, seq->qual.s);
+        if (parse_kseq_comment(barcode, barcodeCorrected, &seq->comment))
+            count_read_pair(stats, barcode, barcodeCorrected, seq->qual.s);
     }
+    while (kseq_read(seq) >= 0);
 
     // Close input file.
     kseq_destroy(seq);
@@ -214,3 +242,17 @@ void stats_bam(BarcodeStats & stats, CharString & inputFile)
 
     printDone();
 }
+
+// Makes a histogram of the counts of the uncorrected barcodes in a count table.
+void stats_count_table(BarcodeStats & stats, CountTable const & counts)
+{
+    stats.raw_reads = counts.header.numReads;
+    stats.raw_barcodes = counts.header.numBarcodes;
+    stats.raw_count_hist.assign(1000, 0);
+    for (uint64_t i = 0; i < counts.header.numBarcodes; ++i)
+    {
+        uint32_t count;
+        std::memcpy(&count, counts.records + i * COUNT_RECORD_SIZE + sizeof(uint64_t), sizeof(count));
+        ++stats.raw_count_hist[std::min<uint64_t>(count, stats.raw_count_hist.size() - 1)];
+    }
+}
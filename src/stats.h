@@ -6,6 +6,8 @@
 #include <zlib.h>
 #include <htslib/kseq.h>
 
+#include "count_table.h"
+
 #ifndef KSEQ_GZ
 #define KSEQ_GZ
 KSEQ_INIT(gzFile, gzread)
@@ -15,6 +17,7 @@ struct BarcodeStats
 {
     unsigned error_free;
     unsigned one_error;
+    unsigned two_errors;
     unsigned unrecognized;
 
     seqan::DnaString prev_corrected;
@@ -23,8 +26,13 @@ struct BarcodeStats
     std::vector<unsigned> count_hist;
     std::map<char, std::vector<unsigned> > one_error_hist;
 
+    // Counts of the uncorrected barcodes from a count table.
+    uint64_t raw_reads;
+    uint64_t raw_barcodes;
+    std::vector<unsigned> raw_count_hist;
+
     BarcodeStats() :
-        error_free(0), one_error(0), unrecognized(0), prev_count(0)
+        error_free(0), one_error(0), two_errors(0), unrecognized(0), prev_count(0), raw_reads(0), raw_barcodes(0)
     {}
 };
 
@@ -32,5 +40,6 @@ void write_stats(seqan::CharString & outputFile, BarcodeStats & stats);
 void stats_tsv(BarcodeStats & stats, seqan::CharString & inputFile);
 void stats_fastq(BarcodeStats & stats, seqan::CharString & inputFile);
 void stats_bam(BarcodeStats & stats, seqan::CharString & inputFile);
+void stats_count_table(BarcodeStats & stats, CountTable const & counts);
 
 #endif  // STATS_H_
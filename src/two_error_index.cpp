@@ -0,0 +1,164 @@
+#include <algorithm>
+#include <seqan/sequence.h>
+
+#include "barcode_index.h"
+#include "two_error_index.h"
+#include "utils.h"
+
+using namespace seqan;
+
+// Lowest bit of each 2-bit base code.
+const uint64_t LOW_BASE_BITS = 0x5555555555555555ULL;
+
+// Returns the number of bases that differ between two codes, ignoring the bases in 'mask'.
+inline unsigned code_distance(uint64_t a, uint64_t b, uint64_t mask)
+{
+    uint64_t x = (a ^ b) & ~mask;
+    return __builtin_popcountll((x | x >> 1) & LOW_BASE_BITS);
+}
+
+// Whether the corrections from position 'first' on hold the code.
+inline bool contains_code(CorrectedBarcodes const & bx, unsigned first, uint64_t code)
+{
+    for (unsigned k = first; k < bx.size; ++k)
+        if (bx.codes[k].lo == code)
+            return true;
+    return false;
+}
+
+// Sum of the qualities of the read at the positions of the bases set in x.
+template <typename TLength>
+inline unsigned substitution_key(uint64_t x, char const * qx, TLength bcLength)
+{
+    unsigned key = 0;
+    for (unsigned i = 0; i < bcLength; ++i)
+        if ((x >> 2*i) & 3)
+            key += qx[bcLength-1 - i];
+    return key;
+}
+
+void build_two_error_index(TwoErrorIndex & index, std::vector<uint64_t> const & whitelist, unsigned bcLength)
+{
+    printStatus("Building index for barcodes with two substitutions");
+
+    std::vector<uint64_t> barcodes(whitelist);
+    std::sort(barcodes.begin(), barcodes.end());
+    barcodes.erase(std::unique(barcodes.begin(), barcodes.end()), barcodes.end());
+
+    // Split the code into four parts, the first part holding the bases of the lowest bits.
+    uint64_t parts[TWO_ERROR_PARTS];
+    for (unsigned p = 0; p < TWO_ERROR_PARTS; ++p)
+    {
+        unsigned begin = p * bcLength / TWO_ERROR_PARTS;
+        unsigned end = (p + 1) * bcLength / TWO_ERROR_PARTS;
+        parts[p] = 0;
+        for (unsigned i = begin; i < end; ++i)
+            parts[p] |= (uint64_t)3 << 2*i;
+    }
+    unsigned pair = 0;
+    for (unsigned p = 0; p < TWO_ERROR_PARTS; ++p)
+        for (unsigned q = p + 1; q < TWO_ERROR_PARTS; ++q)
+            index.masks[pair++] = parts[p] | parts[q];
+
+    // Use about one bucket per whitelisted barcode.
+    uint64_t numBuckets = 2;
+    index.shift = 63;
+    while (numBuckets < barcodes.size())
+    {
+        numBuckets *= 2;
+        --index.shift;
+    }
+    index.bcLength = bcLength;
+
+    // Sort the barcodes into the buckets of each pair by counting.
+    for (unsigned pair = 0; pair < TWO_ERROR_PAIRS; ++pair)
+    {
+        std::vector<uint32_t> & offsets = index.offsets[pair];
+        offsets.assign(numBuckets + 1, 0);
+        for (uint64_t code : barcodes)
+            ++offsets[two_error_bucket(index, pair, code) + 1];
+        for (uint64_t b = 0; b < numBuckets; ++b)
+            offsets[b + 1] += offsets[b];
+
+        std::vector<uint32_t> next(offsets.begin(), offsets.end() - 1);
+        index.codes[pair].resize(barcodes.size());
+        for (uint64_t code : barcodes)
+            index.codes[pair][next[two_error_bucket(index, pair, code)]++] = code;
+    }
+    printDone();
+
+    std::ostringstream msg;
+    msg << "Index for barcodes with two substitutions holds " << barcodes.size() << " barcodes in "
+        << TWO_ERROR_PAIRS << " x " << numBuckets << " buckets.";
+    printInfo(msg);
+}
+
+void build_two_error_index(TwoErrorIndex & index, CharString & filename, unsigned bcLength)
+{
+    std::vector<uint64_t> whitelist;
+    read_whitelist(whitelist, filename, bcLength);
+    build_two_error_index(index, whitelist, bcLength);
+}
+
+// Looks up the whitelisted barcodes with two substitutions of an unrecognized barcode.
+// Ns count as substitutions. Returns false if there is none, if a whitelisted barcode with
+// less than two substitutions exists or if there are more than numAlts barcodes, otherwise
+// adds them to bx ordered by the qualities at the substituted positions as for ONE_ERROR
+// barcodes.
+template <typename TLength>
+bool retrieve_two_errors(CorrectedBarcodes & bx, TwoErrorIndex const & index, char const * seq, char const * qx,
+                         unsigned numAlts, TLength bcLength)
+{
+    // Encode the barcode with N as A and mark the bases of N in 'maskN'.
+    uint64_t h = 0;
+    uint64_t maskN = 0;
+    unsigned numN = 0;
+    for (unsigned i = 0; i < bcLength; ++i)
+    {
+        h <<= 2;
+        maskN <<= 2;
+        if (is_base(seq[i]))
+        {
+            h |= base_code(seq[i]);
+        }
+        else
+        {
+            maskN |= 3;
+            ++numN;
+        }
+    }
+    if (numN > 2)
+        return false;
+
+    unsigned first = bx.size;
+    for (unsigned pair = 0; pair < TWO_ERROR_PAIRS; ++pair)
+    {
+        // The key is unknown if the parts hold an N, but then another pair holds no error.
+        if ((maskN & index.masks[pair]) != 0)
+            continue;
+
+        uint64_t bucket = two_error_bucket(index, pair, h);
+        uint64_t const * codes = index.codes[pair].data();
+        for (uint32_t k = index.offsets[pair][bucket]; k < index.offsets[pair][bucket + 1]; ++k)
+        {
+            unsigned d = code_distance(h, codes[k], maskN) + numN;
+            if (d > 2 || contains_code(bx, first, codes[k]))
+                continue;
+            if (d < 2 || bx.size - first == numAlts)
+            {
+                bx.size = first;
+                return false;
+            }
+            insert_correction(bx, BarcodeCode{0, codes[k]}, substitution_key((h ^ codes[k]) | maskN, qx, bcLength));
+        }
+    }
+    return bx.size != first;
+}
+
+bool retrieve_two_errors(CorrectedBarcodes & bx, TwoErrorIndex const & index, char const * seq, char const * qx,
+                         unsigned numAlts)
+{
+    return with_barcode_length(index.bcLength, true, [&](auto bcLength) {
+        return retrieve_two_errors(bx, index, seq, qx, numAlts, bcLength);
+    });
+}
@@ -0,0 +1,49 @@
+#ifndef TWO_ERROR_INDEX_H_
+#define TWO_ERROR_INDEX_H_
+
+#include <cstdint>
+#include <vector>
+#include <seqan/sequence.h>
+
+// -----------------------------------------------------------------------------
+// Index for barcodes with two substitutions
+// -----------------------------------------------------------------------------
+
+// Second-tier index for unrecognized barcodes of up to 32 bases. A barcode is split into
+// four parts of about equal length. A whitelisted barcode with at most two substitutions
+// matches the read in at least two of the four parts (pigeonhole principle), thus it is
+// found in the bucket of the read in at least one of the six tables keyed by the codes of a
+// pair of parts. Buckets hold the codes of the whitelisted barcodes in lexicographical order.
+
+struct CorrectedBarcodes;
+
+const unsigned TWO_ERROR_PARTS = 4;
+const unsigned TWO_ERROR_PAIRS = 6;
+
+struct TwoErrorIndex
+{
+    unsigned bcLength;
+    unsigned shift;                               // 64 - log2 of the number of buckets.
+    uint64_t masks[TWO_ERROR_PAIRS];              // Bits of the codes of the two parts of each pair.
+    std::vector<uint32_t> offsets[TWO_ERROR_PAIRS];  // Start of each bucket in 'codes'.
+    std::vector<uint64_t> codes[TWO_ERROR_PAIRS];
+
+    TwoErrorIndex() : bcLength(0), shift(64), masks{} {}
+};
+
+inline bool two_error_index_built(TwoErrorIndex const & index)
+{
+    return index.bcLength != 0;
+}
+
+inline uint64_t two_error_bucket(TwoErrorIndex const & index, unsigned pair, uint64_t code)
+{
+    return ((code & index.masks[pair]) * 0x9E3779B97F4A7C15ULL) >> index.shift;
+}
+
+void build_two_error_index(TwoErrorIndex & index, std::vector<uint64_t> const & whitelist, unsigned bcLength);
+void build_two_error_index(TwoErrorIndex & index, seqan::CharString & filename, unsigned bcLength);
+bool retrieve_two_errors(CorrectedBarcodes & bx, TwoErrorIndex const & index, char const * seq, char const * qx,
+                         unsigned numAlts);
+
+#endif  // TWO_ERROR_INDEX_H_
@@ -3,6 +3,8 @@
 
 #include <seqan/sequence.h>
 
+#include "utils.h"
+
 using namespace seqan;
 
 // ---------------------------------------------------------------------------------------
@@ -20,6 +22,11 @@ uint64_t hash(DnaString & barcode)
     return h;
 }
 
+unsigned hash(uint64_t & h, unsigned & posN, char const * seq, unsigned bcLength)
+{
+    return encode_barcode(h, posN, seq, RuntimeLength{bcLength});
+}
+
 // ---------------------------------------------------------------------------------------
 // Function unhash()
 // ---------------------------------------------------------------------------------------
@@ -36,6 +43,53 @@ DnaString unhash(uint64_t h, unsigned bcLength)
     return barcode;
 }
 
+// ---------------------------------------------------------------------------------------
+// Functions hash_long() and unhash_long()
+// ---------------------------------------------------------------------------------------
+
+BarcodeCode hash_long(DnaString & barcode)
+{
+    BarcodeCode code = {0, 0};
+    Iterator<DnaString>::Type it = begin(barcode);
+    Iterator<DnaString>::Type itEnd = end(barcode);
+    for (; it != itEnd; ++it)
+    {
+        code.hi = (code.hi << 2) | (code.lo >> 62);
+        code.lo = (code.lo << 2) | ordValue((Dna)*it);
+    }
+    return code;
+}
+
+// Encodes barcodes of up to 64 bases as hash() does for up to 32 bases.
+unsigned hash_long(BarcodeCode & code, unsigned & posN, char const * seq, unsigned bcLength)
+{
+    if (bcLength <= 32)
+    {
+        code.hi = 0;
+        return hash(code.lo, posN, seq, bcLength);
+    }
+
+    unsigned headLength = bcLength - 32;
+    unsigned posTailN;
+    unsigned numN = hash(code.hi, posN, seq, headLength);
+    unsigned numTailN = hash(code.lo, posTailN, seq + headLength, 32);
+    if (numN == 0 && numTailN != 0)
+        posN = headLength + posTailN;
+    return numN + numTailN;
+}
+
+DnaString unhash_long(BarcodeCode const & code, unsigned bcLength)
+{
+    DnaString barcode;
+    resize(barcode, bcLength);
+    for (unsigned i = 0; i < bcLength; ++i)
+    {
+        uint64_t word = i < 32 ? code.lo >> 2*i : code.hi >> 2*(i - 32);
+        barcode[bcLength - 1 - i] = (Dna)(word & 3);
+    }
+    return barcode;
+}
+
 // ---------------------------------------------------------------------------------------
 // Functions union() and find()
 // ---------------------------------------------------------------------------------------
@@ -75,6 +129,10 @@ std::vector<DnaString> parseBarcodeList(const char * cBarcode)
     std::istringstream barcodeStream(cBarcode);
     while (std::getline(barcodeStream, bc, ','))
     {
+        // Remove a 10X-style GEM group suffix, e.g. '-1' in BAM files.
+        size_t dash = bc.find('-');
+        if (dash != std::string::npos)
+            bc.resize(dash);
         DnaString barcode = bc;
         barcodes.push_back(barcode);
     }
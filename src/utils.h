@@ -2,10 +2,164 @@
 #define UTILS_H_
 
 #include <sstream>
+#include <type_traits>
+#if defined(__SSE2__) && defined(__x86_64__)
+#include <emmintrin.h>
+#endif
 #include <seqan/sequence.h>
 
+// 2-bit code of a barcode of up to 64 bases as computed by hash(), with all bases but the
+// last 32 in 'hi'. Codes compare in the lexicographical order of the barcodes.
+struct BarcodeCode
+{
+    uint64_t hi;
+    uint64_t lo;
+};
+
+inline bool operator==(BarcodeCode const & a, BarcodeCode const & b)
+{
+    return a.hi == b.hi && a.lo == b.lo;
+}
+
+inline bool operator<(BarcodeCode const & a, BarcodeCode const & b)
+{
+    return a.hi < b.hi || (a.hi == b.hi && a.lo < b.lo);
+}
+
+// Substitutes the base at position i from the end of the barcode by XOR with v.
+inline BarcodeCode substitute(BarcodeCode code, unsigned i, uint64_t v)
+{
+    if (i < 32)
+        code.lo ^= v << 2*i;
+    else
+        code.hi ^= v << 2*(i - 32);
+    return code;
+}
+
+// Returns the 2-bit code of an ASCII base (A=0, C=1, G=2, T=3, case-insensitive).
+inline uint64_t base_code(char c)
+{
+    return ((c >> 1) & 3) ^ ((c >> 2) & 1);
+}
+
+inline bool is_base(char c)
+{
+    c &= 0xDF;
+    return c == 'A' || c == 'C' || c == 'G' || c == 'T';
+}
+
+// Barcode length known at run time. Kernels templated on the barcode length take a
+// RuntimeLength or, for common lengths, a std::integral_constant so that the compiler unrolls
+// their loops over the bases (see with_barcode_length()).
+struct RuntimeLength
+{
+    unsigned value;
+
+    constexpr operator unsigned() const { return value; }
+};
+
+// Whether kernels are instantiated for the barcode length as a compile-time constant.
+inline bool is_specialized_length(unsigned bcLength)
+{
+    return bcLength == 12 || bcLength == 14 || bcLength == 16 || bcLength == 18 || bcLength == 20;
+}
+
+// Calls f with the barcode length as std::integral_constant if kernels are specialized for it
+// and 'specialized' is set, otherwise with a RuntimeLength.
+template <typename TFunction>
+inline auto with_barcode_length(unsigned bcLength, bool specialized, TFunction f)
+{
+    if (specialized)
+    {
+        switch (bcLength)
+        {
+            case 12:
+                return f(std::integral_constant<unsigned, 12>());
+            case 14:
+                return f(std::integral_constant<unsigned, 14>());
+            case 16:
+                return f(std::integral_constant<unsigned, 16>());
+            case 18:
+                return f(std::integral_constant<unsigned, 18>());
+            case 20:
+                return f(std::integral_constant<unsigned, 20>());
+            default:
+                break;
+        }
+    }
+    return f(RuntimeLength{bcLength});
+}
+
+// Packs the first bcLength ASCII bases of seq into h, two bits per base as hash(DnaString)
+// does. Characters other than A, C, G and T (N) are encoded as A. Returns the number of N
+// and sets posN to the position of the first N. seq needs to hold at least bcLength
+// characters. hash() calls it with the barcode length known at run time.
+template <typename TLength>
+inline unsigned encode_barcode(uint64_t & h, unsigned & posN, char const * seq, TLength bcLength)
+{
+    h = 0;
+    unsigned numN = 0;
+    unsigned i = 0;
+
+#if defined(__SSE2__) && defined(__x86_64__)
+    // Encode 16 bases at a time.
+    for (; i + 16 <= bcLength; i += 16)
+    {
+        __m128i c = _mm_loadu_si128(reinterpret_cast<__m128i const *>(seq + i));
+
+        // Mark all characters that are not A, C, G or T.
+        __m128i upper = _mm_and_si128(c, _mm_set1_epi8((char)0xDF));
+        __m128i valid = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(upper, _mm_set1_epi8('A')),
+                                                  _mm_cmpeq_epi8(upper, _mm_set1_epi8('C'))),
+                                     _mm_or_si128(_mm_cmpeq_epi8(upper, _mm_set1_epi8('G')),
+                                                  _mm_cmpeq_epi8(upper, _mm_set1_epi8('T'))));
+        unsigned maskN = ~_mm_movemask_epi8(valid) & 0xFFFF;
+        if (maskN != 0)
+        {
+            if (numN == 0)
+                posN = i + __builtin_ctz(maskN);
+            numN += __builtin_popcount(maskN);
+        }
+
+        // Compute the 2-bit code of each byte (see base_code()) and set N to A.
+        __m128i v = _mm_xor_si128(_mm_and_si128(_mm_srli_epi16(c, 1), _mm_set1_epi8(3)),
+                                  _mm_and_si128(_mm_srli_epi16(c, 2), _mm_set1_epi8(1)));
+        v = _mm_and_si128(v, valid);
+
+        // Pack the codes, first base in the most significant bits: 2 -> 4 -> 8 -> 16 bits per lane.
+        v = _mm_and_si128(_mm_or_si128(_mm_slli_epi16(v, 2), _mm_srli_epi16(v, 8)), _mm_set1_epi16(0x00FF));
+        v = _mm_and_si128(_mm_or_si128(_mm_slli_epi32(v, 4), _mm_srli_epi32(v, 16)), _mm_set1_epi32(0x000000FF));
+        v = _mm_and_si128(_mm_or_si128(_mm_slli_epi64(v, 8), _mm_srli_epi64(v, 32)), _mm_set_epi32(0, 0xFFFF, 0, 0xFFFF));
+        uint64_t first = _mm_cvtsi128_si64(v);
+        uint64_t second = _mm_cvtsi128_si64(_mm_unpackhi_epi64(v, v));
+        h = (h << 32) | (first << 16) | second;
+    }
+#endif
+
+    // Encode the remaining bases one at a time.
+    for (; i < bcLength; ++i)
+    {
+        if (is_base(seq[i]))
+        {
+            h = (h << 2) | base_code(seq[i]);
+        }
+        else
+        {
+            if (numN == 0)
+                posN = i;
+            ++numN;
+            h <<= 2;
+        }
+    }
+    return numN;
+}
+
 uint64_t hash(seqan::DnaString & barcode);
+unsigned hash(uint64_t & h, unsigned & posN, char const * seq, unsigned bcLength);
 seqan::DnaString unhash(uint64_t h, unsigned bcLength);
+BarcodeCode hash_long(seqan::DnaString & barcode);
+unsigned hash_long(BarcodeCode & code, unsigned & posN, char const * seq, unsigned bcLength);
+seqan::DnaString unhash_long(BarcodeCode const & code, unsigned bcLength);
 
 bool union_by_index(std::vector<unsigned> & uf, unsigned a, unsigned b);
 unsigned find(std::vector<unsigned> & uf, unsigned a);